@@ -12,3 +12,12 @@ BOOST_AUTO_TEST_CASE(cb_explore_adf_should_throw_empty_multi_example) {
   // An empty example collection is invalid and so should throw.
   BOOST_REQUIRE_THROW(vw->learn(example_collection), VW::vw_exception);
 }
+
+BOOST_AUTO_TEST_CASE(cb_explore_adf_should_refuse_rank_top) {
+  auto vw = VW::initialize("--cb_explore_adf --quiet", nullptr, false, nullptr, nullptr);
+
+  // Exploration needs the score of every action.
+  BOOST_REQUIRE_THROW(VW::set_rank_top(*vw, 3), VW::vw_exception);
+  VW::set_rank_top(*vw, 0);
+  VW::finish(*vw);
+}
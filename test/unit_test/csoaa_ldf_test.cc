@@ -0,0 +1,34 @@
+#define BOOST_TEST_DYN_LINK
+
+#include <boost/test/unit_test.hpp>
+
+#include "vw.h"
+
+BOOST_AUTO_TEST_CASE(csoaa_ldf_rank_top_returns_best_actions_in_order) {
+  auto vw = VW::initialize("--csoaa_ldf m --csoaa_rank --noconstant --quiet", nullptr, false, nullptr, nullptr);
+  const char* actions[] = { "1:2.0 | a", "2:1.0 | b", "3:0.0 | c", "4:3.0 | d", "5:1.5 | e" };
+  multi_ex examples;
+  for (const char* action : actions)
+    examples.push_back(VW::read_example(*vw, action));
+  for (int i = 0; i < 20; i++)
+    vw->learn(examples);
+
+  vw->predict(examples);
+  v_array<ACTION_SCORE::action_score> all_actions = v_init<ACTION_SCORE::action_score>();
+  copy_array(all_actions, examples[0]->pred.a_s);
+  BOOST_CHECK_EQUAL(all_actions.size(), 5);
+
+  VW::set_rank_top(*vw, 2);
+  vw->predict(examples);
+  auto& top = examples[0]->pred.a_s;
+  BOOST_REQUIRE_EQUAL(top.size(), 2);
+  for (size_t i = 0; i < top.size(); i++)
+  {
+    BOOST_CHECK_EQUAL(top[i].action, all_actions[i].action);
+    BOOST_CHECK_EQUAL(top[i].score, all_actions[i].score);
+  }
+
+  all_actions.delete_v();
+  VW::finish_example(*vw, examples);
+  VW::finish(*vw);
+}
@@ -10,11 +10,70 @@ license as described in the file LICENSE.
 #include "reductions.h"
 #include <math.h>
 
+#if !defined(VW_NO_INLINE_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SIMD_SKETCH
+#endif
+
 using namespace std;
 using namespace LEARNER;
 
 #define NORM2 (m+1)
 
+// Kernels over the m sketch coordinates [1, m] of one feature.  The
+// elementwise ones do per lane exactly the arithmetic of the scalar loops;
+// only sketch_dot sums in a different order.
+
+// acc[i] += w[i] * x * D[i]
+inline void sketch_add(float* acc, const float* w, float x, const float* D, int m)
+{
+  int i = 1;
+#ifdef HAVE_SIMD_SKETCH
+  __m128 vx = _mm_set1_ps(x);
+  for (; i + 3 <= m; i += 4)
+  {
+    __m128 v = _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(w + i), vx), _mm_loadu_ps(D + i));
+    _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), v));
+  }
+#endif
+  for (; i <= m; i++)
+    acc[i] += w[i] * x * D[i];
+}
+
+// w[i] += delta[i] * s / D[i]
+inline void sketch_update(float* w, const float* delta, float s, const float* D, int m)
+{
+  int i = 1;
+#ifdef HAVE_SIMD_SKETCH
+  __m128 vs = _mm_set1_ps(s);
+  for (; i + 3 <= m; i += 4)
+  {
+    __m128 v = _mm_div_ps(_mm_mul_ps(_mm_loadu_ps(delta + i), vs), _mm_loadu_ps(D + i));
+    _mm_storeu_ps(w + i, _mm_add_ps(_mm_loadu_ps(w + i), v));
+  }
+#endif
+  for (; i <= m; i++)
+    w[i] += delta[i] * s / D[i];
+}
+
+// sum plus the terms w[i] * x * D[i] * b[i]
+inline float sketch_dot(float sum, const float* w, float x, const float* D, const float* b, int m)
+{
+  int i = 1;
+#ifdef HAVE_SIMD_SKETCH
+  __m128 vx = _mm_set1_ps(x);
+  __m128 acc = _mm_setzero_ps();
+  for (; i + 3 <= m; i += 4)
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(w + i), vx), _mm_loadu_ps(D + i)), _mm_loadu_ps(b + i)));
+  float lanes[4];
+  _mm_storeu_ps(lanes, acc);
+  sum += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+  for (; i <= m; i++)
+    sum += w[i] * x * D[i] * b[i];
+  return sum;
+}
+
 struct update_data
 {
   struct OjaNewton *ON;
@@ -54,6 +113,7 @@ struct OjaNewton
   float learning_rate_cnt;
   bool normalize;
   bool random_init;
+  bool K_large; // |K| was past the conversion threshold at the last check()
 
   void initialize_Z(parameters& weights)
   {
@@ -87,6 +147,10 @@ struct OjaNewton
       }
     }
 
+    // the simple initialization is already orthonormal, so Gram-Schmidt would
+    // only make m^2 passes over the whole table to leave it unchanged
+    if (!random_init) return;
+
     // Gram-Schmidt
     for (int j = 1; j <= m; j++)
     {
@@ -162,13 +226,22 @@ struct OjaNewton
   void update_K()
   {
     float tmp = data.norm2_x * data.sketch_cnt * data.sketch_cnt;
+    float sketch_cnt = data.sketch_cnt;
+    const float* delta = data.delta;
+    const float* Zx = data.Zx;
     for (int i = 1; i <= m; i++)
     {
+      // row at a time through locals, so the compiler can vectorize over j
+      float* Ki = K[i];
+      float delta_i = delta[i];
+      float Zx_i = Zx[i];
       for (int j = 1; j <= m; j++)
       {
-        K[i][j] += data.delta[i] * data.Zx[j] * data.sketch_cnt;
-        K[i][j] += data.delta[j] * data.Zx[i] * data.sketch_cnt;
-        K[i][j] += data.delta[i] * data.delta[j] * tmp;
+        float k = Ki[j];
+        k += delta_i * Zx[j] * sketch_cnt;
+        k += delta[j] * Zx_i * sketch_cnt;
+        k += delta_i * delta[j] * tmp;
+        Ki[j] = k;
       }
     }
   }
@@ -177,14 +250,17 @@ struct OjaNewton
   {
     for (int i = 1; i <= m; i++)
     {
-
+      // zv and the update of A[i] are accumulated a row of K and A at a time;
+      // every entry still sums its terms in increasing k, but the inner loops
+      // now run over contiguous memory
       for (int j = 1; j < i; j++)
-      {
         zv[j] = 0;
-        for (int k = 1; k <= i; k++)
-        {
-          zv[j] += A[i][k] * K[k][j];
-        }
+      for (int k = 1; k <= i; k++)
+      {
+        float a = A[i][k];
+        const float* Kk = K[k];
+        for (int j = 1; j < i; j++)
+          zv[j] += a * Kk[j];
       }
 
       for (int j = 1; j < i; j++)
@@ -196,12 +272,13 @@ struct OjaNewton
         }
       }
 
-      for (int j = 1; j < i; j++)
+      float* Ai = A[i];
+      for (int k = 1; k < i; k++)
       {
-        for (int k = j; k < i; k++)
-        {
-          A[i][j] -= vv[k] * A[k][j];
-        }
+        float v = vv[k];
+        const float* Ak = A[k];
+        for (int j = 1; j <= k; j++)
+          Ai[j] -= v * Ak[j];
       }
 
       float norm = 0;
@@ -225,15 +302,20 @@ struct OjaNewton
 
   void update_b()
   {
+    // the column sums over A are accumulated row by row into tmp, in the
+    // same order of i as a column walk would add them
     for (int j = 1; j <= m; j++)
+      tmp[j] = 0;
+    for (int i = 1; i <= m; i++)
     {
-      float tmp = 0;
-      for (int i = j; i <= m; i++)
-      {
-        tmp += ev[i] * data.AZx[i] * A[i][j] / (alpha * (alpha + ev[i]));
-      }
-      b[j] += tmp * data.g;
+      float c = ev[i] * data.AZx[i];
+      float s = alpha * (alpha + ev[i]);
+      const float* Ai = A[i];
+      for (int j = 1; j <= i; j++)
+        tmp[j] += c * Ai[j] / s;
     }
+    for (int j = 1; j <= m; j++)
+      b[j] += tmp[j] * data.g;
   }
 
   void update_D()
@@ -263,7 +345,8 @@ struct OjaNewton
       for (int j = i; j <= m ; j++)
         max_norm = fmax(max_norm, fabs(K[i][j]));
     //printf("|K| = %f\n", max_norm);
-    if (max_norm < 1e7) return;
+    K_large = max_norm >= 1e7;
+    if (!K_large) return;
 
     // implicit -> explicit representation
     // printf("begin conversion: t = %d, norm(K) = %f\n", t, max_norm);
@@ -273,7 +356,7 @@ struct OjaNewton
     // K <- AK
     for (int j = 1; j <= m; j++)
     {
-      memset(tmp, 0, sizeof(double) * (m+1));
+      memset(tmp, 0, sizeof(float) * (m+1));
 
       for (int i = 1; i <= m; i++)
       {
@@ -289,7 +372,7 @@ struct OjaNewton
     // K <- KA'
     for (int i = 1; i <= m; i++)
     {
-      memset(tmp, 0, sizeof(double) * (m+1));
+      memset(tmp, 0, sizeof(float) * (m+1));
 
       for (int j = 1; j <= m; j++)
         for (int h = 1; h <= m; h++)
@@ -311,7 +394,7 @@ struct OjaNewton
         w += (&w)[j] * b[j] * D[j];
     }
 
-    memset(b, 0, sizeof(double) * (m+1));
+    memset(b, 0, sizeof(float) * (m+1));
 
     //third step: Z <- ADZ, A, D <- Identity
 
@@ -335,7 +418,7 @@ struct OjaNewton
 
     for (int i = 1; i <= m; i++)
     {
-      memset(A[i], 0, sizeof(double) * (m+1));
+      memset(A[i], 0, sizeof(float) * (m+1));
       D[i] = 1;
       A[i][i] = 1;
     }
@@ -382,10 +465,7 @@ void make_pred(update_data& data, float x, float& wref)
   }
 
   data.prediction += w[0] * x;
-  for (int i = 1; i <= m; i++)
-  {
-    data.prediction += w[i] * x * data.ON->D[i] * data.ON->b[i];
-  }
+  data.prediction = sketch_dot(data.prediction, w, x, data.ON->D, data.ON->b, m);
 }
 
 void predict(OjaNewton& ON, base_learner&, example& ec)
@@ -403,10 +483,7 @@ void update_Z_and_wbar(update_data& data, float x, float& wref)
   if (data.ON->normalize) x /= sqrt(w[NORM2]);
   float s = data.sketch_cnt * x;
 
-  for (int i = 1; i <= m; i++)
-  {
-    w[i] += data.delta[i] * s / data.ON->D[i];
-  }
+  sketch_update(w, data.delta, s, data.ON->D, m);
   w[0] -= s * data.bdelta;
 }
 
@@ -416,10 +493,7 @@ void compute_Zx_and_norm(update_data& data, float x, float& wref)
   int m = data.ON->m;
   if (data.ON->normalize) x /= sqrt(w[NORM2]);
 
-  for (int i = 1; i <= m; i++)
-  {
-    data.Zx[i] += w[i] * x * data.ON->D[i];
-  }
+  sketch_add(data.Zx, w, x, data.ON->D, m);
   data.norm2_x += x * x;
 }
 
@@ -431,10 +505,7 @@ void update_wbar_and_Zx(update_data& data, float x, float& wref)
 
   float g = data.g * x;
 
-  for (int i = 1; i <= m; i++)
-  {
-    data.Zx[i] += w[i] * x * data.ON->D[i];
-  }
+  sketch_add(data.Zx, w, x, data.ON->D, m);
   w[0] -= g / data.ON->alpha;
 }
 
@@ -492,7 +563,11 @@ void learn(OjaNewton& ON, base_learner& base, example& ec)
   ON.compute_AZx();
 
   ON.update_b();
-  ON.check();
+
+  // K only changes at the end of an epoch or in a conversion, so check()
+  // cannot find anything to do in between unless the last one converted
+  if (ON.cnt == ON.epoch_size || ON.K_large)
+    ON.check();
 
   if (ON.cnt == ON.epoch_size)
   {
@@ -550,6 +625,7 @@ base_learner* OjaNewton_setup(arguments& arg)
 
   ON->cnt = 0;
   ON->t = 1;
+  ON->K_large = true; // unknown until the first check()
   ON->ev = calloc_or_throw<float>(ON->m+1);
   ON->b = calloc_or_throw<float>(ON->m+1);
   ON->D = calloc_or_throw<float>(ON->m+1);
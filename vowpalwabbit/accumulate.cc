@@ -14,6 +14,7 @@ Alekh Agarwal and John Langford, with help Olivier Chapelle.
 #include <stdint.h>
 #include "global_data.h"
 #include "vw_allreduce.h"
+#include "parse_regressor.h"
 
 using namespace std;
 
@@ -142,6 +143,11 @@ void accumulate_weighted_avg(vw& all, parameters& weights)
   if (weights.sparse)
     cout << "sparse parameters not supported with parallel computation!" << endl;
   else
+  {
+    // the table is received into directly, which a background save may
+    // still have write protected
+    wait_for_background_save(all);
     all_reduce<float, add_float>(all, weights.dense_weights.first(), ((size_t)length)*weights.stride_shift());
+  }
   delete[] local_weights;
 }
@@ -41,14 +41,73 @@ typedef int socket_t;
 #endif
 #include "vw_exception.h"
 #include <assert.h>
+#include <vector>
+#include <algorithm>
+#include <ctime>
+#include <iostream>
 
 const size_t ar_buf_size = 1<<16;
 
+// Writing to a peer that died must surface as an error we can recover from,
+// not as a SIGPIPE that kills the surviving node.
+#ifdef MSG_NOSIGNAL
+#define AR_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define AR_SEND_FLAGS 0
+#endif
+
+const size_t shm_ring_size = 1<<20;
+
+struct shm_segment;
+struct shm_ring;
+
+// Tree edge between two processes on the same host.  Data moves through a
+// pair of single-producer/single-consumer rings in a POSIX shared memory
+// segment instead of through TCP loopback; the TCP connection is kept only
+// to notice when the peer dies.
+class shm_channel
+{
+private:
+  shm_segment* seg;
+  shm_ring* out;
+  shm_ring* in;
+
+  shm_channel(shm_segment* pseg, bool is_child);
+
+public:
+  // Called on the child end of an edge: creates a fresh segment and returns its name.
+  static shm_channel* create(std::string& name);
+  // Called on the parent end with the name received over TCP, nullptr if it is not visible here.
+  static shm_channel* open(const std::string& name);
+  static void unlink(const std::string& name);
+  ~shm_channel();
+
+  // Both are non-blocking and return the number of bytes moved, possibly 0.
+  size_t send_some(const char* buf, size_t n);
+  size_t recv_some(char* buf, size_t n);
+
+  bool readable();
+  bool writable();
+  // Block for at most ms milliseconds, returning early once the peer has
+  // written (resp. read) something.
+  void wait_readable(int ms);
+  void wait_writable(int ms);
+};
+
 struct node_socks
 { std::string current_master;
   socket_t parent;
   socket_t children[2];
+  shm_channel* parent_shm;
+  shm_channel* children_shm[2];
   ~node_socks()
+  { reset();
+  }
+  node_socks ()
+  { current_master = "";
+    parent_shm = children_shm[0] = children_shm[1] = nullptr;
+  }
+  void reset()
   { if(current_master != "")
     { if(parent != -1)
         CLOSESOCK(this->parent);
@@ -57,9 +116,12 @@ struct node_socks
       if(children[1] != -1)
         CLOSESOCK(this->children[1]);
     }
-  }
-  node_socks ()
-  { current_master = "";
+    delete parent_shm;
+    delete children_shm[0];
+    delete children_shm[1];
+    parent_shm = children_shm[0] = children_shm[1] = nullptr;
+    parent = children[0] = children[1] = -1;
+    current_master = "";
   }
 };
 
@@ -174,15 +236,31 @@ private:
   node_socks socks;
   std::string span_server;
   size_t unique_id; //unique id for each node in the network, id == 0 means extra io.
+  size_t max_retries; //number of times the tree is rebuilt after a peer fails during one all_reduce
+  size_t timeout; //seconds without progress from a peer before it is considered dead, 0 waits forever
+  size_t pass; //pass of the current all_reduce
+  size_t seq; //all_reduce calls completed in this pass
+  bool out_of_step; //the span server refused the tree because the nodes are at different calls
+  std::vector<char> contribution; //this node's input to the current all_reduce, for retries
 
   void all_reduce_init();
+  void set_timeout(socket_t s);
+  void negotiate_shm_parent();
+  void negotiate_shm_child(int i);
+  void wait_for(socket_t peer, shm_channel* c, bool write);
+  void send_all(socket_t s, shm_channel* c, const char* buffer, size_t n);
 
   template <class T> void pass_up(char* buffer, size_t left_read_pos, size_t right_read_pos, size_t& parent_sent_pos)
   { size_t my_bufsize = (std::min)(ar_buf_size, (std::min)(left_read_pos, right_read_pos) / sizeof(T) * sizeof(T) - parent_sent_pos);
 
     if (my_bufsize > 0)
     { //going to pass up this chunk of data to the parent
-      int write_size = send(socks.parent, buffer + parent_sent_pos, (int)my_bufsize, 0);
+      if (socks.parent_shm != nullptr)
+      { send_all(socks.parent, socks.parent_shm, buffer + parent_sent_pos, my_bufsize);
+        parent_sent_pos += my_bufsize;
+        return;
+      }
+      int write_size = send(socks.parent, buffer + parent_sent_pos, (int)my_bufsize, AR_SEND_FLAGS);
       if (write_size < 0)
         THROW("Write to parent failed " << my_bufsize << " " << write_size << " " << parent_sent_pos << " " << left_read_pos << " " << right_read_pos);
 
@@ -195,12 +273,13 @@ private:
 
     fd_set fds;
     FD_ZERO(&fds);
-    if (socks.children[0] != -1)
-      FD_SET(socks.children[0], &fds);
-    if (socks.children[1] != -1)
-      FD_SET(socks.children[1], &fds);
+    socket_t max_fd = 0;
+    for (int i = 0; i < 2; i++)
+      if (socks.children[i] != -1 && socks.children_shm[i] == nullptr)
+      { FD_SET(socks.children[i], &fds);
+        max_fd = (std::max)(max_fd, socks.children[i] + 1);
+      }
 
-    socket_t max_fd = (std::max) (socks.children[0], socks.children[1]) + 1;
     size_t child_read_pos[2] = { 0,0 }; //First unread float from left and right children
     int child_unprocessed[2] = { 0,0 }; //The number of bytes sent by the child but not yet added to the buffer
     char child_read_buf[2][ar_buf_size + sizeof(T) - 1];
@@ -222,36 +301,74 @@ private:
       if (parent_sent_pos >= n && child_read_pos[0] >= n && child_read_pos[1] >= n) break;
 
       if (child_read_pos[0] < n || child_read_pos[1] < n)
-      { if (max_fd > 0 && select((int)max_fd, &fds, nullptr, nullptr, nullptr) == -1)
+      { // shared memory children cannot be select()ed on: with one of them
+        // pending only peek at the TCP children, and block on the ring below
+        bool polling = false;
+        for (int i = 0; i < 2; i++)
+          polling |= socks.children_shm[i] != nullptr && child_read_pos[i] < n;
+
+        timeval wait;
+        wait.tv_sec = polling ? 0 : (long)timeout;
+        wait.tv_usec = 0;
+        int ready = max_fd > 0 ? select((int)max_fd, &fds, nullptr, nullptr, (polling || timeout > 0) ? &wait : nullptr) : 0;
+        if (ready == -1)
+        { if (errno == EINTR)
+            continue;
           THROWERRNO("select");
+        }
+        if (ready == 0 && max_fd > 0 && !polling)
+          THROW("no data from children for " << timeout << " seconds");
 
+        bool progress = false;
         for(int i = 0; i < 2; i++)
-        { if(socks.children[i] != -1 && FD_ISSET(socks.children[i],&fds))
+        { int read_size;
+          size_t count = (std::min) (ar_buf_size, n - child_read_pos[i]);
+          if (socks.children_shm[i] != nullptr)
+          { if (child_read_pos[i] == n)
+              continue;
+            read_size = (int)socks.children_shm[i]->recv_some(&child_read_buf[i][child_unprocessed[i]], count);
+            if (read_size == 0)
+              continue;
+          }
+          else if(socks.children[i] != -1 && FD_ISSET(socks.children[i],&fds))
           { //there is data to be left from left child
             if (child_read_pos[i] == n)
               THROW("I think child has no data to send but he thinks he has " << FD_ISSET(socks.children[0], &fds) << " " << FD_ISSET(socks.children[1], &fds));
 
-
-            size_t count = (std::min) (ar_buf_size, n - child_read_pos[i]);
-            int read_size = recv(socks.children[i], &child_read_buf[i][child_unprocessed[i]], (int)count, 0);
+            read_size = recv(socks.children[i], &child_read_buf[i][child_unprocessed[i]], (int)count, 0);
             if (read_size == -1)
               THROWERRNO("recv from child");
+            if (read_size == 0)
+              THROW("child " << i << " closed the connection");
+          }
+          else
+          { if (socks.children[i] != -1 && child_read_pos[i] != n)
+              FD_SET(socks.children[i], &fds);
+            continue;
+          }
+          progress = true;
 
-            addbufs<T, f>((T*)buffer + child_read_pos[i] / sizeof(T), (T*)child_read_buf[i], (child_read_pos[i] + read_size) / sizeof(T) - child_read_pos[i] / sizeof(T));
+          addbufs<T, f>((T*)buffer + child_read_pos[i] / sizeof(T), (T*)child_read_buf[i], (child_read_pos[i] + read_size) / sizeof(T) - child_read_pos[i] / sizeof(T));
 
-            child_read_pos[i] += read_size;
-            int old_unprocessed = child_unprocessed[i];
-            child_unprocessed[i] = child_read_pos[i] % (int)sizeof(T);
-            for(int j = 0; j < child_unprocessed[i]; j++)
-            { child_read_buf[i][j] = child_read_buf[i][((old_unprocessed + read_size)/(int)sizeof(T))*sizeof(T)+j];
-            }
-
-            if (child_read_pos[i] == n) //Done reading parent
-              FD_CLR(socks.children[i], &fds);
+          child_read_pos[i] += read_size;
+          int old_unprocessed = child_unprocessed[i];
+          child_unprocessed[i] = child_read_pos[i] % (int)sizeof(T);
+          for(int j = 0; j < child_unprocessed[i]; j++)
+          { child_read_buf[i][j] = child_read_buf[i][((old_unprocessed + read_size)/(int)sizeof(T))*sizeof(T)+j];
           }
-          else if (socks.children[i] != -1 && child_read_pos[i] != n)
-            FD_SET(socks.children[i], &fds);
+
+          if (child_read_pos[i] == n && socks.children_shm[i] == nullptr) //Done reading parent
+            FD_CLR(socks.children[i], &fds);
         }
+
+        // nothing from anyone: sleep on a shared memory child still owing
+        // data; TCP children just queue up in the kernel meanwhile
+        if (!progress)
+          for (int i = 0; i < 2; i++)
+            if (socks.children_shm[i] != nullptr && child_read_pos[i] < n)
+            { wait_for(socks.children[i], socks.children_shm[i], false);
+              break;
+            }
       }
       if (socks.parent == -1 && child_read_pos[0] == n && child_read_pos[1] == n)
         parent_sent_pos = n;
@@ -262,8 +379,10 @@ private:
   void broadcast(char* buffer, const size_t n);
 
 public:
-  AllReduceSockets(std::string pspan_server, const size_t punique_id, size_t ptotal, const size_t pnode)
-    : AllReduce(ptotal, pnode), span_server(pspan_server), unique_id(punique_id)
+  AllReduceSockets(std::string pspan_server, const size_t punique_id, size_t ptotal, const size_t pnode,
+                   const size_t pmax_retries = 0, const size_t ptimeout = 0)
+    : AllReduce(ptotal, pnode), span_server(pspan_server), unique_id(punique_id),
+      max_retries(pmax_retries), timeout(ptimeout), pass(0), seq(0), out_of_step(false)
   {
   }
 
@@ -271,10 +390,45 @@ public:
   {
   }
 
-  template <class T, void(*f)(T&, const T&)> void all_reduce(T* buffer, const size_t n)
-  { if (span_server != socks.current_master)
-      all_reduce_init();
-    reduce<T, f>((char*)buffer, n*sizeof(T));
-    broadcast((char*)buffer, n*sizeof(T));
+  // current_pass and the number of calls already made in it identify the
+  // call, so the span server can tell whether every node is retrying the same one.
+  template <class T, void(*f)(T&, const T&)> void all_reduce(T* buffer, const size_t n, const size_t current_pass)
+  { if (current_pass != pass)
+    { pass = current_pass;
+      seq = 0;
+    }
+    if (max_retries == 0)
+    { if (span_server != socks.current_master)
+        all_reduce_init();
+      reduce<T, f>((char*)buffer, n*sizeof(T));
+      broadcast((char*)buffer, n*sizeof(T));
+      seq++;
+      return;
+    }
+
+    // A failed peer closes its connections, which makes its neighbours fail
+    // in turn until every survivor is back at the span server. The server
+    // then rebuilds the tree once the restarted node rejoins, and everybody
+    // repeats this reduction from its original contribution. The copy lives
+    // in one buffer that is only ever grown, so steady state calls do not allocate.
+    contribution.assign((char*)buffer, (char*)(buffer + n));
+    for (size_t attempt = 0;; attempt++)
+    { try
+      { if (span_server != socks.current_master)
+          all_reduce_init();
+        reduce<T, f>((char*)buffer, n*sizeof(T));
+        broadcast((char*)buffer, n*sizeof(T));
+        seq++;
+        return;
+      }
+      catch (VW::vw_exception& e)
+      { if (attempt >= max_retries || out_of_step)
+          throw;
+        std::cerr << "all_reduce failed (" << e.what() << "), rebuilding spanning tree, attempt "
+                  << (attempt + 1) << " of " << max_retries << std::endl;
+        socks.reset();
+        memcpy(buffer, contribution.data(), n*sizeof(T));
+      }
+    }
   }
 };
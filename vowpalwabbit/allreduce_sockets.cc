@@ -23,13 +23,213 @@ Alekh Agarwal and John Langford, with help Olivier Chapelle.
 #else
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 #endif
 #include <sys/timeb.h>
+#include <atomic>
+#include <thread>
+#include <chrono>
 #include "allreduce.h"
 #include "vw_exception.h"
 
 using namespace std;
 
+struct shm_ring
+{
+  atomic<uint64_t> written; // total bytes ever produced
+  atomic<uint64_t> read; // total bytes ever consumed
+  atomic<uint32_t> produced; // bumped after each write, the reader sleeps on it
+  atomic<uint32_t> consumed; // bumped after each read, the writer sleeps on it
+  atomic<uint32_t> reader_asleep;
+  atomic<uint32_t> writer_asleep;
+  char data[shm_ring_size];
+};
+
+struct shm_segment
+{
+  shm_ring up; // child -> parent, used by reduce
+  shm_ring down; // parent -> child, used by broadcast
+};
+
+shm_channel::shm_channel(shm_segment* pseg, bool is_child) : seg(pseg)
+{
+  out = is_child ? &seg->up : &seg->down;
+  in = is_child ? &seg->down : &seg->up;
+}
+
+#ifdef _WIN32
+shm_channel* shm_channel::create(string&) { return nullptr; }
+shm_channel* shm_channel::open(const string&) { return nullptr; }
+void shm_channel::unlink(const string&) {}
+shm_channel::~shm_channel() {}
+#else
+static shm_segment* map_segment(int fd)
+{
+  void* mem = mmap(nullptr, sizeof(shm_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  return mem == MAP_FAILED ? nullptr : (shm_segment*)mem;
+}
+
+shm_channel* shm_channel::create(string& name)
+{
+  static atomic<uint32_t> counter(0);
+  stringstream ss;
+  ss << "/vw_allreduce_" << getpid() << "_" << counter++;
+  name = ss.str();
+
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+  if (fd < 0)
+    return nullptr;
+  if (ftruncate(fd, sizeof(shm_segment)) < 0)
+  {
+    ::close(fd);
+    shm_unlink(name.c_str());
+    return nullptr;
+  }
+  shm_segment* seg = map_segment(fd);
+  if (seg == nullptr)
+  {
+    shm_unlink(name.c_str());
+    return nullptr;
+  }
+  for (shm_ring* ring : { &seg->up, &seg->down })
+  {
+    ring->written = ring->read = 0;
+    ring->produced = ring->consumed = 0;
+    ring->reader_asleep = ring->writer_asleep = 0;
+  }
+  return new shm_channel(seg, true);
+}
+
+shm_channel* shm_channel::open(const string& name)
+{
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0)
+    return nullptr;
+  shm_segment* seg = map_segment(fd);
+  return seg == nullptr ? nullptr : new shm_channel(seg, false);
+}
+
+void shm_channel::unlink(const string& name)
+{
+  shm_unlink(name.c_str());
+}
+
+shm_channel::~shm_channel()
+{
+  munmap(seg, sizeof(shm_segment));
+}
+#endif
+
+// Sleeps until *word no longer holds expected, it is woken, or ms pass.
+// The word lives in memory shared between processes, so no private futex.
+static void sleep_on(atomic<uint32_t>& word, uint32_t expected, int ms)
+{
+#ifdef __linux__
+  static_assert(sizeof(atomic<uint32_t>) == sizeof(uint32_t), "futex word must be a plain 32 bit integer");
+  timespec wait;
+  wait.tv_sec = ms / 1000;
+  wait.tv_nsec = (long)(ms % 1000) * 1000000;
+  syscall(SYS_futex, (uint32_t*)&word, FUTEX_WAIT, expected, &wait, nullptr, 0);
+#else
+  // no process-shared futex here: nap for a millisecond instead
+  (void)ms;
+  if (word.load() == expected)
+    this_thread::sleep_for(chrono::milliseconds(1));
+#endif
+}
+
+static void wake(atomic<uint32_t>& word)
+{
+#ifdef __linux__
+  syscall(SYS_futex, (uint32_t*)&word, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+#else
+  (void)word;
+#endif
+}
+
+// The sleeper announces itself before its last look at the ring and the
+// other side bumps the event word before checking for a sleeper (both
+// sequentially consistent), so either the sleeper sees the new data or
+// space, or the other side sees it asleep and wakes it.  A wake that
+// races ahead of the sleep makes the futex call return at once, since the
+// event word no longer holds the value the sleeper read.
+bool shm_channel::readable()
+{
+  return in->written.load(memory_order_acquire) != in->read.load(memory_order_relaxed);
+}
+
+bool shm_channel::writable()
+{
+  return out->written.load(memory_order_relaxed) - out->read.load(memory_order_acquire) < shm_ring_size;
+}
+
+void shm_channel::wait_readable(int ms)
+{
+  uint32_t seen = in->produced.load();
+  in->reader_asleep.store(1);
+  if (!readable())
+    sleep_on(in->produced, seen, ms);
+  in->reader_asleep.store(0);
+}
+
+void shm_channel::wait_writable(int ms)
+{
+  uint32_t seen = out->consumed.load();
+  out->writer_asleep.store(1);
+  if (!writable())
+    sleep_on(out->consumed, seen, ms);
+  out->writer_asleep.store(0);
+}
+
+size_t shm_channel::send_some(const char* buf, size_t n)
+{
+  uint64_t w = out->written.load(memory_order_relaxed);
+  uint64_t r = out->read.load(memory_order_acquire);
+  n = min(n, (size_t)(shm_ring_size - (w - r)));
+
+  size_t start = (size_t)(w % shm_ring_size);
+  size_t first = min(n, shm_ring_size - start);
+  memcpy(out->data + start, buf, first);
+  memcpy(out->data, buf + first, n - first);
+
+  out->written.store(w + n, memory_order_release);
+  if (n > 0)
+  {
+    out->produced.fetch_add(1);
+    if (out->reader_asleep.load())
+      wake(out->produced);
+  }
+  return n;
+}
+
+size_t shm_channel::recv_some(char* buf, size_t n)
+{
+  uint64_t r = in->read.load(memory_order_relaxed);
+  uint64_t w = in->written.load(memory_order_acquire);
+  n = min(n, (size_t)(w - r));
+
+  size_t start = (size_t)(r % shm_ring_size);
+  size_t first = min(n, shm_ring_size - start);
+  memcpy(buf, in->data + start, first);
+  memcpy(buf + first, in->data, n - first);
+
+  in->read.store(r + n, memory_order_release);
+  if (n > 0)
+  {
+    in->consumed.fetch_add(1);
+    if (in->writer_asleep.load())
+      wake(in->consumed);
+  }
+  return n;
+}
+
 // port is already in network order
 socket_t sock_connect(const uint32_t ip, const int port)
 {
@@ -130,6 +330,10 @@ void AllReduceSockets::all_reduce_init()
   if(send(master_sock, (char*)&node, sizeof(node), 0) < (int)sizeof(node))
     cerr << "write node=" << node << " to span server failed" << endl;
   else cerr << "wrote node=" << node << endl;
+  if(send(master_sock, (char*)&pass, sizeof(pass), 0) < (int)sizeof(pass) ||
+      send(master_sock, (char*)&seq, sizeof(seq), 0) < (int)sizeof(seq))
+    cerr << "write position to span server failed" << endl;
+  else cerr << "wrote pass=" << pass << " allreduce=" << seq << endl;
   int ok;
   if (recv(master_sock, (char*)&ok, sizeof(ok), 0) < (int)sizeof(ok))
     cerr << "read ok from span server failed" << endl;
@@ -144,6 +348,13 @@ void AllReduceSockets::all_reduce_init()
   if(recv(master_sock, (char*)&kid_count, sizeof(kid_count), 0) < (int)sizeof(kid_count))
     cerr << "read kid_count from span server failed" << endl;
   else cerr << "read kid_count=" << kid_count << endl;
+  if (kid_count == (uint16_t)-1)
+  {
+    CLOSESOCK(master_sock);
+    out_of_step = true;
+    THROW("span server refused the tree: the nodes are at different all_reduce calls (here pass " << pass
+          << ", call " << seq << "); a restarted node can only rejoin at a pass boundary it has a --span_checkpoint for");
+  }
 
   socket_t sock = -1;
   short unsigned int netport = htons(26544);
@@ -212,6 +423,7 @@ void AllReduceSockets::all_reduce_init()
   if(parent_ip != (uint32_t)-1)
   {
     socks.parent = sock_connect(parent_ip, parent_port);
+    negotiate_shm_parent();
   }
   else
     socks.parent = -1;
@@ -230,10 +442,177 @@ void AllReduceSockets::all_reduce_init()
     // getnameinfo((sockaddr *) &child_address, sizeof(sockaddr), hostname, NI_MAXHOST, servInfo, NI_MAXSERV, NI_NUMERICSERV);
     // cerr << "connected to " << hostname << ':' << ntohs(port) << endl;
     socks.children[i] = f;
+    negotiate_shm_child(i);
   }
 
   if (kid_count > 0)
     CLOSESOCK(sock);
+
+  if (timeout > 0)
+  {
+    if (socks.parent != -1)
+      set_timeout(socks.parent);
+    for (int i = 0; i < kid_count; i++)
+      set_timeout(socks.children[i]);
+  }
+}
+
+// Identifies the machine, so that the two ends of an edge can compare notes.
+static string host_token()
+{
+  char name[256];
+  if (gethostname(name, sizeof(name)) < 0)
+    return "";
+  name[sizeof(name) - 1] = '\0';
+  return name;
+}
+
+static void fail_send(socket_t s, const void* buf, int count)
+{
+  if (send(s, (const char*)buf, count, AR_SEND_FLAGS) < count)
+    THROWERRNO("send");
+}
+
+static void fail_recv(socket_t s, void* buf, int count)
+{
+  if (recv(s, (char*)buf, count, MSG_WAITALL) < count)
+    THROWERRNO("recv");
+}
+
+// The child sends its host token and the parent answers whether it matches
+// its own, so both ends take the same decision.  On the same host the child
+// then creates the segment and offers its name; an empty name or a zero ack
+// falls back to TCP (e.g. different IPC namespaces on one host).
+void AllReduceSockets::negotiate_shm_parent()
+{
+  string token = host_token();
+  uint16_t length = (uint16_t)token.size();
+  fail_send(socks.parent, &length, sizeof(length));
+  fail_send(socks.parent, token.c_str(), length);
+  char same_host;
+  fail_recv(socks.parent, &same_host, sizeof(same_host));
+  if (!same_host)
+    return;
+
+  string name;
+  shm_channel* channel = shm_channel::create(name);
+  length = channel == nullptr ? 0 : (uint16_t)name.size();
+  fail_send(socks.parent, &length, sizeof(length));
+  if (length == 0)
+    return;
+
+  // The parent unlinks the name as soon as it has mapped the segment; we
+  // only do it if that cannot have happened, so nothing is left behind in
+  // /dev/shm when either side dies in between.
+  char ack;
+  try
+  {
+    fail_send(socks.parent, name.c_str(), length);
+    fail_recv(socks.parent, &ack, sizeof(ack));
+  }
+  catch (VW::vw_exception&)
+  {
+    shm_channel::unlink(name);
+    delete channel;
+    throw;
+  }
+  if (ack)
+    socks.parent_shm = channel;
+  else
+  {
+    shm_channel::unlink(name);
+    delete channel;
+  }
+}
+
+void AllReduceSockets::negotiate_shm_child(int i)
+{
+  uint16_t length;
+  fail_recv(socks.children[i], &length, sizeof(length));
+  string token(length, '\0');
+  if (length > 0)
+    fail_recv(socks.children[i], &token[0], length);
+  char same_host = length > 0 && token == host_token();
+  fail_send(socks.children[i], &same_host, sizeof(same_host));
+  if (!same_host)
+    return;
+
+  fail_recv(socks.children[i], &length, sizeof(length));
+  if (length == 0)
+    return;
+  string name(length, '\0');
+  fail_recv(socks.children[i], &name[0], length);
+
+  socks.children_shm[i] = shm_channel::open(name);
+  char ack = socks.children_shm[i] != nullptr;
+  if (ack)
+    shm_channel::unlink(name);
+  fail_send(socks.children[i], &ack, sizeof(ack));
+}
+
+// Blocks until the shared memory peer has data for us (or room, when we
+// write).  The sleep is cut into short slices; between them the peer's TCP
+// connection, readable only once the peer has gone away, is checked, and
+// --span_timeout bounds how long the peer may stay silent.
+void AllReduceSockets::wait_for(socket_t peer, shm_channel* c, bool write)
+{
+  const int slice_ms = 50;
+  time_t start = time(nullptr);
+  while (write ? !c->writable() : !c->readable())
+  {
+    if (write)
+      c->wait_writable(slice_ms);
+    else
+      c->wait_readable(slice_ms);
+    if (write ? c->writable() : c->readable())
+      return;
+
+    int ready;
+    do
+    {
+      fd_set fds;
+      FD_ZERO(&fds);
+      FD_SET(peer, &fds);
+      timeval now;
+      now.tv_sec = 0;
+      now.tv_usec = 0;
+      ready = select((int)peer + 1, &fds, nullptr, nullptr, &now);
+    }
+    while (ready < 0 && errno == EINTR);
+    if (ready < 0)
+      THROWERRNO("select");
+    if (ready > 0)
+      THROW("shared memory peer closed the connection");
+    if (timeout > 0 && difftime(time(nullptr), start) > (double)timeout)
+      THROW("no data from shared memory peer for " << timeout << " seconds");
+  }
+}
+
+void AllReduceSockets::send_all(socket_t s, shm_channel* c, const char* buffer, size_t n)
+{
+  while (n > 0)
+  {
+    size_t sent = c->send_some(buffer, n);
+    if (sent == 0)
+      wait_for(s, c, true);
+    buffer += sent;
+    n -= sent;
+  }
+}
+
+void AllReduceSockets::set_timeout(socket_t s)
+{
+#ifdef _WIN32
+  DWORD tv = (DWORD)(timeout * 1000);
+#else
+  timeval tv;
+  tv.tv_sec = (long)timeout;
+  tv.tv_usec = 0;
+#endif
+  if (setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (char*)&tv, sizeof(tv)) < 0)
+    cerr << "setsockopt SO_RCVTIMEO: " << strerror(errno) << endl;
+  if (setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, (char*)&tv, sizeof(tv)) < 0)
+    cerr << "setsockopt SO_SNDTIMEO: " << strerror(errno) << endl;
 }
 
 
@@ -245,10 +624,13 @@ void AllReduceSockets::pass_down(char* buffer, const size_t parent_read_pos, siz
   if(my_bufsize > 0)
   {
     //going to pass up this chunk of data to the children
-    if(socks.children[0] != -1 && send(socks.children[0], buffer+children_sent_pos, (int)my_bufsize, 0) < (int)my_bufsize)
-      cerr<<"Write to left child failed\n";
-    if(socks.children[1] != -1 && send(socks.children[1], buffer+children_sent_pos, (int)my_bufsize, 0) < (int)my_bufsize)
-      cerr<<"Write to right child failed\n";
+    for (int i = 0; i < 2; i++)
+    {
+      if (socks.children_shm[i] != nullptr)
+        send_all(socks.children[i], socks.children_shm[i], buffer+children_sent_pos, my_bufsize);
+      else if(socks.children[i] != -1 && send(socks.children[i], buffer+children_sent_pos, (int)my_bufsize, AR_SEND_FLAGS) < (int)my_bufsize)
+        THROWERRNO("Write to " << (i == 0 ? "left" : "right") << " child failed");
+    }
 
     children_sent_pos += my_bufsize;
   }
@@ -281,11 +663,19 @@ void AllReduceSockets::broadcast(char* buffer, const size_t n)
         THROW("I think parent has no data to send but he thinks he has");
 
       size_t count = min(ar_buf_size,n-parent_read_pos);
-      int read_size = recv(socks.parent, buffer + parent_read_pos, (int)count, 0);
-      if(read_size == -1)
+      if (socks.parent_shm != nullptr)
       {
-        cerr <<" recv from parent: " << strerror(errno) << endl;
+        size_t read_size;
+        while ((read_size = socks.parent_shm->recv_some(buffer + parent_read_pos, count)) == 0)
+          wait_for(socks.parent, socks.parent_shm, false);
+        parent_read_pos += read_size;
+        continue;
       }
+      int read_size = recv(socks.parent, buffer + parent_read_pos, (int)count, 0);
+      if(read_size == -1)
+        THROWERRNO("recv from parent");
+      if(read_size == 0)
+        THROW("parent closed the connection");
       parent_read_pos += read_size;
     }
   }
@@ -122,6 +122,8 @@ public:
 
 	inline weight& strided_index(size_t index) { return operator[](index << _stride_shift); }
 
+	bool exists(size_t i) const { return _map.find(i & _weight_mask) != _map.end(); }
+
 	void shallow_copy(const sparse_parameters& input)
 	{
 		// TODO: this is level-1 copy (weight* are stilled shared)
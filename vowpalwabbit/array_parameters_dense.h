@@ -1,6 +1,9 @@
 #pragma once
 
 #include <cstdint>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 #include "memory.h"
 
 typedef float weight;
@@ -45,6 +48,20 @@ private:
   uint64_t _weight_mask;  // (stride*(1 << num_bits) -1)
   uint32_t _stride_shift;
   bool _seeded; // whether the instance is sharing model state with others
+  size_t _mapped_bytes; // non-zero when _begin is a file mapping rather than a heap allocation
+
+  void release()
+  {
+#ifndef _WIN32
+    if (_mapped_bytes > 0)
+    {
+      munmap(_begin, _mapped_bytes);
+      _mapped_bytes = 0;
+      return;
+    }
+#endif
+    free(_begin);
+  }
 
 public:
   typedef dense_iterator<weight> iterator;
@@ -53,16 +70,16 @@ public:
     : _begin(calloc_mergable_or_throw<weight>(length << stride_shift)),
     _weight_mask((length << stride_shift) - 1),
     _stride_shift(stride_shift),
-    _seeded(false)
+    _seeded(false), _mapped_bytes(0)
   { }
 
   dense_parameters()
-    : _begin(nullptr), _weight_mask(0), _stride_shift(0), _seeded(false)
+    : _begin(nullptr), _weight_mask(0), _stride_shift(0), _seeded(false), _mapped_bytes(0)
   {}
 
   bool not_null() { return (_weight_mask > 0 && _begin != nullptr); }
 
-  dense_parameters(const dense_parameters &other) { shallow_copy(other); }
+  dense_parameters(const dense_parameters &other) : _begin(nullptr), _seeded(true), _mapped_bytes(0) { shallow_copy(other); }
   dense_parameters(dense_parameters &&) = delete;
 
   weight* first() { return _begin; } //TODO: Temporary fix for allreduce.
@@ -79,7 +96,7 @@ public:
   void shallow_copy(const dense_parameters& input)
   {
     if (!_seeded)
-      free(_begin);
+      release();
     _begin = input._begin;
     _weight_mask = input._weight_mask;
     _stride_shift = input._stride_shift;
@@ -127,17 +144,38 @@ public:
     size_t float_count = length << _stride_shift;
     weight* dest = shared_weights;
     memcpy(dest, _begin, float_count * sizeof(float));
-    free(_begin);
+    release();
     _begin = dest;
   }
 #endif
+
+  // Replace the weight table with a private (copy-on-write) mapping of
+  // float_count weights stored at offset in fd.  Pages stay shared with the
+  // page cache, and with other processes mapping the same model, until they
+  // are written.  Returns false, leaving the table untouched, if the file
+  // cannot be mapped.
+  bool map_file(int fd, int64_t offset, size_t float_count)
+  {
+    if (_seeded || float_count != _weight_mask + 1)
+      return false;
+    size_t bytes = float_count * sizeof(weight);
+    void* mem = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, (off_t)offset);
+    if (mem == MAP_FAILED)
+      return false;
+    release();
+    _begin = (weight*)mem;
+    _mapped_bytes = bytes;
+    return true;
+  }
+
+  bool mapped() const { return _mapped_bytes > 0; }
 #endif
 
   ~dense_parameters()
   {
     if (_begin != nullptr && !_seeded)  // don't free weight vector if it is shared with another instance
     {
-      free(_begin);
+      release();
       _begin = nullptr;
     }
   }
@@ -20,6 +20,7 @@ Implementation by Miro Dudik.
 #include "reductions.h"
 #include "gd.h"
 #include "vw_exception.h"
+#include "thread_pool.h"
 
 using namespace std;
 using namespace LEARNER;
@@ -54,6 +55,7 @@ class curv_exception: public exception {} curv_ex;
 // w[3] = preconditioner
 
 const float max_precond_ratio = 10000.f;
+const size_t max_row_sums = 4; // most totals one pass over the rows collects
 
 struct bfgs
 {
@@ -99,6 +101,10 @@ struct bfgs
   bool first_pass;
   bool gradient_pass;
   bool preconditioner_pass;
+
+  thread_pool* pool;         // splits passes over the weights, with --bfgs_threads
+  size_t chunks;             // chunks of rows in the last pass over the weights
+  v_array<double> chunk_sums; // max_row_sums running totals per chunk
 };
 
 const char* curv_message = "Zero or negative curvature detected.\n"
@@ -173,20 +179,64 @@ float dot_with_direction(vw& all, example& ec)
   return temp;
 }
 
+// Call f(w, row, sums) for every row of the weight table, where w is the row's
+// W_XT slot and sums holds the running totals of the chunk the row falls in.
+// Rows are visited in order in a single chunk; use total() for the results.
+template<class T, class F>
+void for_each_row(bfgs& b, T& weights, size_t sums, F f)
+{
+  b.chunks = 1;
+  memset(b.chunk_sums.begin(), 0, sums * sizeof(double));
+  for (typename T::iterator w = weights.begin(); w != weights.end(); ++w)
+    f(&(*w), w.index() >> weights.stride_shift(), b.chunk_sums.begin());
+}
+
+// With --bfgs_threads a dense table is split into contiguous chunks of rows
+// that run on the pool, each with its own totals.
+template<class F>
+void for_each_row(bfgs& b, dense_parameters& weights, size_t sums, F f)
+{
+  uint64_t rows = (weights.mask() + 1) >> weights.stride_shift();
+  b.chunks = b.pool == nullptr ? 1 : b.pool->size();
+  memset(b.chunk_sums.begin(), 0, b.chunks * sums * sizeof(double));
+
+  weight* first = weights.first();
+  uint32_t stride_shift = weights.stride_shift();
+  auto chunk = [&b, &f, rows, sums, first, stride_shift](size_t c)
+  {
+    double* chunk_sums = b.chunk_sums.begin() + c * sums;
+    for (uint64_t row = c * rows / b.chunks; row < (c + 1) * rows / b.chunks; row++)
+      f(first + (row << stride_shift), row, chunk_sums);
+  };
+
+  if (b.chunks == 1)
+    chunk(0);
+  else
+    b.pool->parallel_for(b.chunks, chunk);
+}
+
+// The j'th total of the last for_each_row, added up in chunk order.
+double total(bfgs& b, size_t sums, size_t j)
+{
+  double ret = b.chunk_sums[j];
+  for (size_t c = 1; c < b.chunks; c++)
+    ret += b.chunk_sums[c * sums + j];
+  return ret;
+}
+
 template<class T>
 double regularizer_direction_magnitude(vw& all, bfgs& b, double regularizer, T& weights)
 {
-  double ret = 0.;
   if (b.regularizers == nullptr)
-    for (typename T::iterator iter = weights.begin(); iter != weights.end(); ++iter)
-      ret += regularizer* (&(*iter))[W_DIR] * (&(*iter))[W_DIR];
-
+    for_each_row(b, weights, 1, [regularizer](weight* w, uint64_t, double* sums)
+    { sums[0] += regularizer * w[W_DIR] * w[W_DIR]; });
   else
   {
-    for (typename T::iterator iter = weights.begin(); iter != weights.end(); ++iter)
-      ret += ((double)b.regularizers[2 * (iter.index() >> weights.stride_shift())]) * (&(*iter))[W_DIR] * (&(*iter))[W_DIR];
+    weight* regularizers = b.regularizers;
+    for_each_row(b, weights, 1, [regularizers](weight* w, uint64_t i, double* sums)
+    { sums[0] += ((double)regularizers[2 * i]) * w[W_DIR] * w[W_DIR]; });
   }
-  return ret;
+  return total(b, 1, 0);
 }
 
 double regularizer_direction_magnitude(vw& all, bfgs& b, float regularizer)
@@ -204,43 +254,45 @@ double regularizer_direction_magnitude(vw& all, bfgs& b, float regularizer)
 }
 
 template<class T>
-float direction_magnitude(vw& all, T& weights)
+float direction_magnitude(vw& all, bfgs& b, T& weights)
 {
   //compute direction magnitude
-  double ret = 0.;
-  for (typename T::iterator iter = weights.begin(); iter != weights.end(); ++iter)
-    ret += ((double)(&(*iter))[W_DIR]) * (&(*iter))[W_DIR];
+  for_each_row(b, weights, 1, [](weight* w, uint64_t, double* sums)
+  { sums[0] += ((double)w[W_DIR]) * w[W_DIR]; });
 
-  return (float)ret;
+  return (float)total(b, 1, 0);
 }
 
-float direction_magnitude(vw& all)
+float direction_magnitude(vw& all, bfgs& b)
 {
   //compute direction magnitude
   if (all.weights.sparse)
-    return direction_magnitude(all, all.weights.sparse_weights);
+    return direction_magnitude(all, b, all.weights.sparse_weights);
   else
-    return direction_magnitude(all, all.weights.dense_weights);
+    return direction_magnitude(all, b, all.weights.dense_weights);
 }
 
 template<class T>
 void bfgs_iter_start(vw& all, bfgs& b, float* mem, int& lastj, double importance_weight_sum, int&origin, T& weights)
 {
-  double g1_Hg1 = 0.;
-  double g1_g1 = 0.;
-
   origin = 0;
-  for (typename T::iterator w = weights.begin(); w != weights.end(); ++w)
+  int mem_stride = b.mem_stride;
+  int mem_xt = (MEM_XT + origin) % mem_stride;
+  int mem_gt = (MEM_GT + origin) % mem_stride;
+  bool keep_xt = b.m > 0;
+  for_each_row(b, weights, 2, [=](weight* w, uint64_t i, double* sums)
   {
-    float* mem1 = mem + (w.index() >> weights.stride_shift()) * b.mem_stride;
-    if (b.m>0)
-      mem1[(MEM_XT + origin) % b.mem_stride] = (&(*w))[W_XT];
-    mem1[(MEM_GT + origin) % b.mem_stride] = (&(*w))[W_GT];
-    g1_Hg1 += ((double)(&(*w))[W_GT]) * ((&(*w))[W_GT]) * ((&(*w))[W_COND]);
-    g1_g1 += ((double)((&(*w))[W_GT])) * ((&(*w))[W_GT]);
-    (&(*w))[W_DIR] = -(&(*w))[W_COND] * ((&(*w))[W_GT]);
-    ((&(*w))[W_GT]) = 0;
-  }
+    float* mem1 = mem + i * mem_stride;
+    if (keep_xt)
+      mem1[mem_xt] = w[W_XT];
+    mem1[mem_gt] = w[W_GT];
+    sums[0] += ((double)w[W_GT]) * (w[W_GT]) * (w[W_COND]);
+    sums[1] += ((double)(w[W_GT])) * (w[W_GT]);
+    w[W_DIR] = -w[W_COND] * (w[W_GT]);
+    (w[W_GT]) = 0;
+  });
+  double g1_Hg1 = total(b, 2, 0);
+  double g1_g1 = total(b, 2, 1);
   lastj = 0;
   if (!all.quiet)
     fprintf(stderr, "%-10.5f\t%-10.5f\t%-10s\t%-10s\t%-10s\t",
@@ -259,43 +311,38 @@ void bfgs_iter_start(vw& all, bfgs& b, float* mem, int& lastj, double importance
 template<class T>
 void bfgs_iter_middle(vw& all, bfgs& b, float* mem, double* rho, double* alpha, int& lastj, int &origin, T& weights)
 {
-  float* mem0 = mem;
-  uint32_t length = 1 << all.num_bits;
+  int mem_stride = b.mem_stride;
   // implement conjugate gradient
   if (b.m == 0)
   {
-    double g_Hy = 0.;
-    double g_Hg = 0.;
-    double y = 0.;
-
-
-    for (typename T::iterator w = weights.begin(); w != weights.end(); ++w)
+    int mem_gt = (MEM_GT + origin) % mem_stride;
+    for_each_row(b, weights, 2, [=](weight* w, uint64_t i, double* sums)
     {
-      mem = mem0 + (w.index() >> weights.stride_shift()) * b.mem_stride;
-      y = (&(*w))[W_GT] - mem[(MEM_GT + origin) % b.mem_stride];
-      g_Hy += ((double)(&(*w))[W_GT]) * ((&(*w))[W_COND]) * y;
-      g_Hg += ((double)mem[(MEM_GT + origin) % b.mem_stride]) * ((&(*w))[W_COND]) * mem[(MEM_GT + origin) % b.mem_stride];
-    }
+      float* mem1 = mem + i * mem_stride;
+      double y = w[W_GT] - mem1[mem_gt];
+      sums[0] += ((double)w[W_GT]) * (w[W_COND]) * y;
+      sums[1] += ((double)mem1[mem_gt]) * (w[W_COND]) * mem1[mem_gt];
+    });
+    double g_Hy = total(b, 2, 0);
+    double g_Hg = total(b, 2, 1);
 
     float beta = (float)(g_Hy / g_Hg);
 
     if (beta<0.f || nanpattern(beta))
       beta = 0.f;
 
-    for (typename T::iterator w = weights.begin(); w != weights.end(); ++w)
+    for_each_row(b, weights, 0, [=](weight* w, uint64_t i, double*)
     {
-      mem = mem0 + (w.index() >> weights.stride_shift()) * b.mem_stride;
-      mem[(MEM_GT + origin) % b.mem_stride] = (&(*w))[W_GT];
+      float* mem1 = mem + i * mem_stride;
+      mem1[mem_gt] = w[W_GT];
 
-      (&(*w))[W_DIR] *= beta;
-      (&(*w))[W_DIR] -= ((&(*w))[W_COND])*((&(*w))[W_GT]);
-      (&(*w))[W_GT] = 0;
-    }
+      w[W_DIR] *= beta;
+      w[W_DIR] -= (w[W_COND])*(w[W_GT]);
+      w[W_GT] = 0;
+    });
     if (!all.quiet)
       fprintf(stderr, "%f\t", beta);
     return;
-
-    mem = mem0 + (length - 1)* b.mem_stride;
   }
   else
   {
@@ -304,20 +351,25 @@ void bfgs_iter_middle(vw& all, bfgs& b, float* mem, double* rho, double* alpha,
   }
 
   // implement bfgs
-  double y_s = 0.;
-  double y_Hy = 0.;
-  double s_q = 0.;
-
-  for (typename T::iterator w = weights.begin(); w != weights.end(); ++w)
   {
-    float* mem1 = mem + (w.index() >> weights.stride_shift()) * b.mem_stride;
-    mem1[(MEM_YT + origin) % b.mem_stride] = (&(*w))[W_GT] - mem1[(MEM_GT + origin) % b.mem_stride];
-    mem1[(MEM_ST + origin) % b.mem_stride] = (&(*w))[W_XT] - mem1[(MEM_XT + origin) % b.mem_stride];
-    (&(*w))[W_DIR] = (&(*w))[W_GT];
-    y_s += ((double)mem1[(MEM_YT + origin) % b.mem_stride]) * mem1[(MEM_ST + origin) % b.mem_stride];
-    y_Hy += ((double)mem1[(MEM_YT + origin) % b.mem_stride]) * mem1[(MEM_YT + origin) % b.mem_stride] * ((&(*w))[W_COND]);
-    s_q += ((double)mem1[(MEM_ST + origin) % b.mem_stride]) * ((&(*w))[W_GT]);
+    int mem_yt = (MEM_YT + origin) % mem_stride;
+    int mem_st = (MEM_ST + origin) % mem_stride;
+    int mem_gt = (MEM_GT + origin) % mem_stride;
+    int mem_xt = (MEM_XT + origin) % mem_stride;
+    for_each_row(b, weights, 3, [=](weight* w, uint64_t i, double* sums)
+    {
+      float* mem1 = mem + i * mem_stride;
+      mem1[mem_yt] = w[W_GT] - mem1[mem_gt];
+      mem1[mem_st] = w[W_XT] - mem1[mem_xt];
+      w[W_DIR] = w[W_GT];
+      sums[0] += ((double)mem1[mem_yt]) * mem1[mem_st];
+      sums[1] += ((double)mem1[mem_yt]) * mem1[mem_yt] * (w[W_COND]);
+      sums[2] += ((double)mem1[mem_st]) * (w[W_GT]);
+    });
   }
+  double y_s = total(b, 3, 0);
+  double y_Hy = total(b, 3, 1);
+  double s_q = total(b, 3, 2);
 
   if (y_s <= 0. || y_Hy <= 0.)
     throw curv_ex;
@@ -328,46 +380,60 @@ void bfgs_iter_middle(vw& all, bfgs& b, float* mem, double* rho, double* alpha,
   for (int j = 0; j<lastj; j++)
   {
     alpha[j] = rho[j] * s_q;
-    s_q = 0.;
-    for (typename T::iterator w = weights.begin(); w != weights.end(); ++w)
+    float alpha_j = (float)alpha[j];
+    int mem_yt = (2 * j + MEM_YT + origin) % mem_stride;
+    int mem_st = (2 * j + 2 + MEM_ST + origin) % mem_stride;
+    for_each_row(b, weights, 1, [=](weight* w, uint64_t i, double* sums)
     {
-      mem = mem0 + (w.index() >> weights.stride_shift()) * b.mem_stride;
-      (&(*w))[W_DIR] -= (float)alpha[j] * mem[(2 * j + MEM_YT + origin) % b.mem_stride];
-      s_q += ((double)mem[(2 * j + 2 + MEM_ST + origin) % b.mem_stride]) * ((&(*w))[W_DIR]);
-    }
+      float* mem1 = mem + i * mem_stride;
+      w[W_DIR] -= alpha_j * mem1[mem_yt];
+      sums[0] += ((double)mem1[mem_st]) * (w[W_DIR]);
+    });
+    s_q = total(b, 1, 0);
   }
 
   alpha[lastj] = rho[lastj] * s_q;
-  double y_r = 0.;
 
-  for (typename T::iterator w = weights.begin(); w != weights.end(); ++w)
   {
-    mem = mem0 + (w.index() >> weights.stride_shift()) * b.mem_stride;
-    (&(*w))[W_DIR] -= (float)alpha[lastj] * mem[(2 * lastj + MEM_YT + origin) % b.mem_stride];
-    (&(*w))[W_DIR] *= gamma*((&(*w))[W_COND]);
-    y_r += ((double)mem[(2 * lastj + MEM_YT + origin) % b.mem_stride]) * ((&(*w))[W_DIR]);
+    float alpha_last = (float)alpha[lastj];
+    int mem_yt = (2 * lastj + MEM_YT + origin) % mem_stride;
+    for_each_row(b, weights, 1, [=](weight* w, uint64_t i, double* sums)
+    {
+      float* mem1 = mem + i * mem_stride;
+      w[W_DIR] -= alpha_last * mem1[mem_yt];
+      w[W_DIR] *= gamma*(w[W_COND]);
+      sums[0] += ((double)mem1[mem_yt]) * (w[W_DIR]);
+    });
   }
+  double y_r = total(b, 1, 0);
 
   double coef_j;
 
   for (int j = lastj; j>0; j--)
   {
     coef_j = alpha[j] - rho[j] * y_r;
-    y_r = 0.;
-    for (typename T::iterator w = weights.begin(); w != weights.end(); ++w)
+    float coef = (float)coef_j;
+    int mem_st = (2 * j + MEM_ST + origin) % mem_stride;
+    int mem_yt = (2 * j - 2 + MEM_YT + origin) % mem_stride;
+    for_each_row(b, weights, 1, [=](weight* w, uint64_t i, double* sums)
     {
-      mem = mem0 + (w.index() >> weights.stride_shift()) * b.mem_stride;
-      (&(*w))[W_DIR] += (float)coef_j*mem[(2 * j + MEM_ST + origin) % b.mem_stride];
-      y_r += ((double)mem[(2 * j - 2 + MEM_YT + origin) % b.mem_stride]) * ((&(*w))[W_DIR]);
-    }
+      float* mem1 = mem + i * mem_stride;
+      w[W_DIR] += coef*mem1[mem_st];
+      sums[0] += ((double)mem1[mem_yt]) * (w[W_DIR]);
+    });
+    y_r = total(b, 1, 0);
   }
 
 
   coef_j = alpha[0] - rho[0] * y_r;
-  for (typename T::iterator w = weights.begin(); w != weights.end(); ++w)
   {
-    mem = mem0 + (w.index() >> weights.stride_shift()) * b.mem_stride;
-    (&(*w))[W_DIR] = -(&(*w))[W_DIR] - (float)coef_j*mem[(MEM_ST + origin) % b.mem_stride];
+    float coef = (float)coef_j;
+    int mem_st = (MEM_ST + origin) % mem_stride;
+    for_each_row(b, weights, 0, [=](weight* w, uint64_t i, double*)
+    {
+      float* mem1 = mem + i * mem_stride;
+      w[W_DIR] = -w[W_DIR] - coef*mem1[mem_st];
+    });
   }
 
   /*********************
@@ -375,14 +441,18 @@ void bfgs_iter_middle(vw& all, bfgs& b, float* mem, double* rho, double* alpha,
   ********************/
 
   lastj = (lastj<b.m - 1) ? lastj + 1 : b.m - 1;
-  origin = (origin + b.mem_stride - 2) % b.mem_stride;
+  origin = (origin + mem_stride - 2) % mem_stride;
 
-  for (typename T::iterator w = weights.begin(); w != weights.end(); ++w)
   {
-    mem = mem0 + (w.index() >> weights.stride_shift()) * b.mem_stride;
-    mem[(MEM_GT + origin) % b.mem_stride] = (&(*w))[W_GT];
-    mem[(MEM_XT + origin) % b.mem_stride] = (&(*w))[W_XT];
-    (&(*w))[W_GT] = 0;
+    int mem_gt = (MEM_GT + origin) % mem_stride;
+    int mem_xt = (MEM_XT + origin) % mem_stride;
+    for_each_row(b, weights, 0, [=](weight* w, uint64_t i, double*)
+    {
+      float* mem1 = mem + i * mem_stride;
+      mem1[mem_gt] = w[W_GT];
+      mem1[mem_xt] = w[W_XT];
+      w[W_GT] = 0;
+    });
   }
   for (int j = lastj; j>0; j--)
     rho[j] = rho[j - 1];
@@ -399,20 +469,20 @@ void bfgs_iter_middle(vw& all, bfgs& b, float* mem, double* rho, double* alpha,
 template<class T>
 double wolfe_eval(vw& all, bfgs& b, float* mem, double loss_sum, double previous_loss_sum, double step_size, double importance_weight_sum, int &origin, double& wolfe1, T& weights)
 {
-  double g0_d = 0.;
-  double g1_d = 0.;
-  double g1_Hg1 = 0.;
-  double g1_g1 = 0.;
-
-
-  for (typename T::iterator w = weights.begin(); w != weights.end(); ++w)
+  int mem_stride = b.mem_stride;
+  int mem_gt = (MEM_GT + origin) % mem_stride;
+  for_each_row(b, weights, 4, [=](weight* w, uint64_t i, double* sums)
   {
-    float* mem1 = mem + (w.index() >> weights.stride_shift()) * b.mem_stride;
-    g0_d += ((double)mem1[(MEM_GT + origin) % b.mem_stride]) * ((&(*w))[W_DIR]);
-    g1_d += ((double)(&(*w))[W_GT]) * (&(*w))[W_DIR];
-    g1_Hg1 += ((double)(&(*w))[W_GT]) * (&(*w))[W_GT] * ((&(*w))[W_COND]);
-    g1_g1 += ((double)(&(*w))[W_GT]) * (&(*w))[W_GT];
-  }
+    float* mem1 = mem + i * mem_stride;
+    sums[0] += ((double)mem1[mem_gt]) * (w[W_DIR]);
+    sums[1] += ((double)w[W_GT]) * w[W_DIR];
+    sums[2] += ((double)w[W_GT]) * w[W_GT] * (w[W_COND]);
+    sums[3] += ((double)w[W_GT]) * w[W_GT];
+  });
+  double g0_d = total(b, 4, 0);
+  double g1_d = total(b, 4, 1);
+  double g1_Hg1 = total(b, 4, 2);
+  double g1_g1 = total(b, 4, 3);
 
   wolfe1 = (loss_sum - previous_loss_sum) / (step_size*g0_d);
   double wolfe2 = g1_d / g0_d;
@@ -437,19 +507,22 @@ template <class T> double add_regularization(vw& all, bfgs& b, float regularizat
   double ret = 0.;
 
   if (b.regularizers == nullptr)
-    for (typename T::iterator w = weights.begin(); w != weights.end(); ++w)
+    for_each_row(b, weights, 1, [regularization](weight* w, uint64_t, double* sums)
     {
-      (&(*w))[W_GT] += regularization*(*w);
-      ret += 0.5*regularization*(*w)*(*w);
-    }
+      w[W_GT] += regularization*(*w);
+      sums[0] += 0.5*regularization*(*w)*(*w);
+    });
   else
-    for (typename T::iterator w = weights.begin(); w != weights.end(); ++w)
+  {
+    weight* regularizers = b.regularizers;
+    for_each_row(b, weights, 1, [regularizers](weight* w, uint64_t i, double* sums)
     {
-      uint64_t i = w.index() >> weights.stride_shift();
-      weight delta_weight = *w - b.regularizers[2 * i + 1];
-      (&(*w))[W_GT] += b.regularizers[2 * i] * delta_weight;
-      ret += 0.5*b.regularizers[2 * i] * delta_weight*delta_weight;
-    }
+      weight delta_weight = *w - regularizers[2 * i + 1];
+      w[W_GT] += regularizers[2 * i] * delta_weight;
+      sums[0] += 0.5*regularizers[2 * i] * delta_weight*delta_weight;
+    });
+  }
+  ret = total(b, 1, 0);
 
   // if we're not regularizing the intercept term, then subtract it off from the result above
   if (all.no_bias)
@@ -482,34 +555,41 @@ double add_regularization(vw& all, bfgs& b, float regularization)
 template <class T>
 void finalize_preconditioner(vw& all, bfgs& b, float regularization, T& weights)
 {
-  float max_hessian = 0.f;
-
+  // Each chunk keeps its largest curvature in its only total.
   if (b.regularizers == nullptr)
-    for (typename T::iterator w = weights.begin(); w != weights.end(); ++w)
+    for_each_row(b, weights, 1, [regularization](weight* w, uint64_t, double* max_hessian)
     {
-      (&(*w))[W_COND] += regularization;
-      if ((&(*w))[W_COND] > max_hessian)
-        max_hessian = (&(*w))[W_COND];
-      if ((&(*w))[W_COND] > 0)
-        (&(*w))[W_COND] = 1.f / (&(*w))[W_COND];
-    }
+      w[W_COND] += regularization;
+      if (w[W_COND] > *max_hessian)
+        *max_hessian = w[W_COND];
+      if (w[W_COND] > 0)
+        w[W_COND] = 1.f / w[W_COND];
+    });
   else
-    for (typename T::iterator w = weights.begin(); w != weights.end(); ++w)
+  {
+    weight* regularizers = b.regularizers;
+    for_each_row(b, weights, 1, [regularizers](weight* w, uint64_t i, double* max_hessian)
     {
-      (&(*w))[W_COND] += b.regularizers[2 * (w.index()>> weights.stride_shift())];
-      if ((&(*w))[W_COND] > max_hessian)
-        max_hessian = (&(*w))[W_COND];
-      if ((&(*w))[W_COND] > 0)
-        (&(*w))[W_COND] = 1.f / (&(*w))[W_COND];
-    }
+      w[W_COND] += regularizers[2 * i];
+      if (w[W_COND] > *max_hessian)
+        *max_hessian = w[W_COND];
+      if (w[W_COND] > 0)
+        w[W_COND] = 1.f / w[W_COND];
+    });
+  }
+
+  float max_hessian = 0.f;
+  for (size_t c = 0; c < b.chunks; c++)
+    if (b.chunk_sums[c] > max_hessian)
+      max_hessian = (float)b.chunk_sums[c];
 
   float max_precond = (max_hessian == 0.f) ? 0.f : max_precond_ratio / max_hessian;
 
-  for (typename T::iterator w = weights.begin(); w != weights.end(); ++w)
+  for_each_row(b, weights, 0, [max_precond](weight* w, uint64_t, double*)
   {
     if (infpattern(*w) || *w >max_precond)
-      (&(*w))[W_COND] = max_precond;
-  }
+      w[W_COND] = max_precond;
+  });
 }
 void finalize_preconditioner(vw& all, bfgs& b, float regularization)
 {
@@ -531,23 +611,27 @@ void preconditioner_to_regularizer(vw& all, bfgs& b, float regularization, T& we
     if (b.regularizers == nullptr)
       THROW("Failed to allocate weight array: try decreasing -b <bits>");
 
-    for (typename T::iterator w = weights.begin(); w != weights.end(); ++w)
+    weight* regularizers = b.regularizers;
+    for_each_row(b, weights, 0, [regularizers, regularization](weight* w, uint64_t i, double*)
     {
-      uint64_t i = w.index() >> weights.stride_shift();
-      b.regularizers[2 * i] = regularization;
-      if ((&(*w))[W_COND] > 0.f)
-        b.regularizers[2 * i] += 1.f / (&(*w))[W_COND];
-    }
+      regularizers[2 * i] = regularization;
+      if (w[W_COND] > 0.f)
+        regularizers[2 * i] += 1.f / w[W_COND];
+    });
   }
   else
-    for (typename T::iterator w = weights.begin(); w != weights.end(); ++w)
+  {
+    weight* regularizers = b.regularizers;
+    for_each_row(b, weights, 0, [regularizers](weight* w, uint64_t i, double*)
     {
-      if ((&(*w))[W_COND] > 0.f)
-        b.regularizers[2 * (w.index() >> weights.stride_shift())] += 1.f / (&(*w))[W_COND];
-    }
+      if (w[W_COND] > 0.f)
+        regularizers[2 * i] += 1.f / w[W_COND];
+    });
+  }
 
-  for (typename T::iterator w = weights.begin(); w != weights.end(); ++w)
-    b.regularizers[2 * (w.index()>> weights.stride_shift()) + 1] = *w;
+  weight* regularizers = b.regularizers;
+  for_each_row(b, weights, 0, [regularizers](weight* w, uint64_t i, double*)
+  { regularizers[2 * i + 1] = *w; });
 }
 void preconditioner_to_regularizer(vw& all, bfgs& b, float regularization)
 {
@@ -562,12 +646,12 @@ void regularizer_to_weight(vw& all, bfgs& b, T& weights)
 {
   if (b.regularizers != nullptr)
   {
-    for (typename T::iterator w = weights.begin(); w != weights.end(); ++w)
+    weight* regularizers = b.regularizers;
+    for_each_row(b, weights, 0, [regularizers](weight* w, uint64_t i, double*)
     {
-      uint64_t i = w.index() >> weights.stride_shift();
-      (&(*w))[W_COND] = b.regularizers[2 * i];
-      *w = b.regularizers[2 * i + 1];
-    }
+      w[W_COND] = regularizers[2 * i];
+      *w = regularizers[2 * i + 1];
+    });
   }
 }
 
@@ -589,13 +673,14 @@ void zero_state(vw& all)
 template<class T>
 double derivative_in_direction(vw& all, bfgs& b, float* mem, int &origin, T& weights)
 {
-  double ret = 0.;
-  for (typename T::iterator w = weights.begin(); w != weights.end();  ++w)
+  int mem_stride = b.mem_stride;
+  int mem_gt = (MEM_GT + origin) % mem_stride;
+  for_each_row(b, weights, 1, [=](weight* w, uint64_t i, double* sums)
   {
-    float* mem1 = mem + (w.index() >> weights.stride_shift()) * b.mem_stride;
-    ret += ((double)mem1[(MEM_GT + origin) % b.mem_stride]) * (&(*w))[W_DIR];
-  }
-  return ret;
+    float* mem1 = mem + i * mem_stride;
+    sums[0] += ((double)mem1[mem_gt]) * w[W_DIR];
+  });
+  return total(b, 1, 0);
 }
 
 double derivative_in_direction(vw& all, bfgs& b, float* mem, int &origin)
@@ -608,21 +693,20 @@ double derivative_in_direction(vw& all, bfgs& b, float* mem, int &origin)
 }
 
 template<class T>
-void update_weight(vw& all, float step_size, T& w)
+void update_weight(vw& all, bfgs& b, float step_size, T& weights)
 {
-  for (typename T::iterator iter = w.begin(); iter != w.end(); ++iter)
-    (&(*iter))[W_XT] += step_size * (&(*iter))[W_DIR];
+  for_each_row(b, weights, 0, [step_size](weight* w, uint64_t, double*)
+  { w[W_XT] += step_size * w[W_DIR]; });
 }
 
-void update_weight(vw& all, float step_size)
+void update_weight(vw& all, bfgs& b, float step_size)
 {
   if (all.weights.sparse)
-    update_weight(all, step_size, all.weights.sparse_weights);
+    update_weight(all, b, step_size, all.weights.sparse_weights);
   else
-    update_weight(all, step_size, all.weights.dense_weights);
+    update_weight(all, b, step_size, all.weights.dense_weights);
 }
 
-
 int process_pass(vw& all, bfgs& b)
 {
   int status = LEARN_OK;
@@ -663,13 +747,13 @@ int process_pass(vw& all, bfgs& b)
     else
     {
       b.step_size = 0.5;
-      float d_mag = direction_magnitude(all);
+      float d_mag = direction_magnitude(all, b);
       ftime(&b.t_end_global);
       b.net_time = (int) (1000.0 * (b.t_end_global.time - b.t_start_global.time) + (b.t_end_global.millitm - b.t_start_global.millitm));
       if (!all.quiet)
         fprintf(stderr, "%-10s\t%-10.5f\t%-.5f\n", "", d_mag, b.step_size);
       b.predictions.clear();
-      update_weight(all, b.step_size);
+      update_weight(all, b, b.step_size);
     }
   }
   else
@@ -728,7 +812,7 @@ int process_pass(vw& all, bfgs& b)
                   "","",ratio,
                   new_step);
         b.predictions.clear();
-        update_weight(all, (float)(-b.step_size+new_step));
+        update_weight(all, b, (float)(-b.step_size+new_step));
         b.step_size = (float)new_step;
         zero_derivative(all);
         b.loss_sum = 0.;
@@ -770,13 +854,13 @@ int process_pass(vw& all, bfgs& b)
         }
         else
         {
-          float d_mag = direction_magnitude(all);
+          float d_mag = direction_magnitude(all, b);
           ftime(&b.t_end_global);
           b.net_time = (int) (1000.0 * (b.t_end_global.time - b.t_start_global.time) + (b.t_end_global.millitm - b.t_start_global.millitm));
           if (!all.quiet)
             fprintf(stderr, "%-10s\t%-10.5f\t%-.5f\n", "", d_mag, b.step_size);
           b.predictions.clear();
-          update_weight(all, b.step_size);
+          update_weight(all, b, b.step_size);
         }
       }
     }
@@ -809,10 +893,10 @@ int process_pass(vw& all, bfgs& b)
       else
         b.step_size = - dd/(float)b.curvature;
 
-      float d_mag = direction_magnitude(all);
+      float d_mag = direction_magnitude(all, b);
 
       b.predictions.clear();
-      update_weight(all, b.step_size);
+      update_weight(all, b, b.step_size);
       ftime(&b.t_end_global);
       b.net_time = (int) (1000.0 * (b.t_end_global.time - b.t_start_global.time) + (b.t_end_global.millitm - b.t_start_global.millitm));
 
@@ -954,6 +1038,8 @@ void learn(bfgs& b, base_learner& base, example& ec)
 void finish(bfgs& b)
 {
   b.predictions.delete_v();
+  b.chunk_sums.delete_v();
+  delete b.pool;
   free(b.mem);
   free(b.rho);
   free(b.alpha);
@@ -1087,6 +1173,9 @@ base_learner* bfgs_setup(arguments& arg)
         ("mem", b->m, 15, "memory in bfgs")
         ("termination", b->rel_threshold, 0.001f,"Termination threshold").missing())
       return nullptr;
+  size_t threads;
+  arg.new_options("")
+      ("bfgs_threads", threads, (size_t)1, "Split the passes over a dense weight table across this many threads").missing();
   b->all = arg.all;
   b->wolfe1_bound = 0.01;
   b->first_hessian_on=true;
@@ -1097,6 +1186,10 @@ base_learner* bfgs_setup(arguments& arg)
   b->final_pass=arg.all->numpasses;
   b->no_win_counter = 0;
 
+  if (threads > 1)
+    b->pool = new thread_pool(threads);
+  b->chunk_sums.resize(max_row_sums * (threads > 1 ? threads : 1));
+
   if(!arg.all->holdout_set_off)
   {
     arg.all->sd->holdout_best_loss = FLT_MAX;
@@ -22,6 +22,7 @@
 #include "reductions.h"
 #include "vw.h"
 #include "rand48.h"
+#include "gd.h"
 
 using namespace std;
 using namespace LEARNER;
@@ -53,8 +54,30 @@ struct boosting
   std::vector<float> alpha;
   std::vector<float> v;
   int t;
+
+  bool fused; // gd with an identity link right below, so the weak learners can share passes
+  polyprediction* pred; // for multipredict
+  float* label; // for multiupdate
+  float* weight;
 };
 
+// the weak learners share no weights, so each one's prediction before its
+// own update is also its prediction before any update on this example: all
+// of them can be read in one pass over the features...
+void predict_all(boosting& o, single_learner& base, example& ec, size_t count)
+{
+  o.all->set_minmax(o.all->sd, ec.l.simple.label);
+  base.multipredict(ec, 0, count, o.pred, true);
+}
+
+// ...and, once the boosting weights are known, updated in a second one
+void update_all(boosting& o, single_learner& base, example& ec)
+{
+  for (int i = 0; i < o.N; i++)
+    o.label[i] = o.weight[i] > 0 ? ec.l.simple.label : FLT_MAX;
+  base.multiupdate(ec, 0, o.N, o.pred, o.label, o.weight);
+}
+
 //---------------------------------------------------
 // Online Boost-by-Majority (BBM)
 // --------------------------------------------------
@@ -70,6 +93,10 @@ void predict_or_learn(boosting& o, LEARNER::single_learner& base, example& ec)
 
   if (is_learn) o.t++;
 
+  bool fused = o.fused && !o.all->reg_mode;
+  if (fused)
+    predict_all(o, base, ec, o.N);
+
   for (int i = 0; i < o.N; i++)
   {
     if (is_learn)
@@ -90,23 +117,34 @@ void predict_or_learn(boosting& o, LEARNER::single_learner& base, example& ec)
       // update ec.weight, weight for learner i (starting from 0)
       ec.weight = u * w;
 
-      base.predict(ec, i);
+      if (fused)
+        ec.pred.scalar = o.pred[i].scalar;
+      else
+        base.predict(ec, i);
 
       // ec.pred.scalar is now the i-th learner prediction on this example
       s += ld.label * ec.pred.scalar;
 
       final_prediction += ec.pred.scalar;
 
-      base.learn(ec, i);
+      if (fused)
+        o.weight[i] = ec.weight;
+      else
+        base.learn(ec, i);
     }
     else
     {
-      base.predict(ec, i);
+      if (fused)
+        ec.pred.scalar = o.pred[i].scalar;
+      else
+        base.predict(ec, i);
       final_prediction += ec.pred.scalar;
     }
   }
 
   ec.weight = u;
+  if (is_learn && fused)
+    update_all(o, base, ec);
   ec.partial_prediction = final_prediction;
   ec.pred.scalar = sign(final_prediction);
 
@@ -132,6 +170,10 @@ void predict_or_learn_logistic(boosting& o, LEARNER::single_learner& base, examp
   if (is_learn) o.t++;
   float eta = 4.f / sqrtf((float)o.t);
 
+  bool fused = o.fused && !o.all->reg_mode;
+  if (fused)
+    predict_all(o, base, ec, o.N);
+
   for (int i = 0; i < o.N; i++)
   {
 
@@ -141,7 +183,10 @@ void predict_or_learn_logistic(boosting& o, LEARNER::single_learner& base, examp
 
       ec.weight = u * w;
 
-      base.predict(ec, i);
+      if (fused)
+        ec.pred.scalar = o.pred[i].scalar;
+      else
+        base.predict(ec, i);
       float z;
       z = ld.label * ec.pred.scalar;
 
@@ -156,17 +201,25 @@ void predict_or_learn_logistic(boosting& o, LEARNER::single_learner& base, examp
       if (o.alpha[i] > 2.) o.alpha[i] = 2;
       if (o.alpha[i] < -2.) o.alpha[i] = -2;
 
-      base.learn(ec, i);
+      if (fused)
+        o.weight[i] = ec.weight;
+      else
+        base.learn(ec, i);
 
     }
     else
     {
-      base.predict(ec, i);
+      if (fused)
+        ec.pred.scalar = o.pred[i].scalar;
+      else
+        base.predict(ec, i);
       final_prediction += ec.pred.scalar * o.alpha[i];
     }
   }
 
   ec.weight = u;
+  if (is_learn && fused)
+    update_all(o, base, ec);
   ec.partial_prediction = final_prediction;
   ec.pred.scalar = sign(final_prediction);
 
@@ -192,6 +245,20 @@ void predict_or_learn_adaptive(boosting& o, LEARNER::single_learner& base, examp
 
   float stopping_point = merand48(o.all->random_state);
 
+  bool fused = o.fused && !o.all->reg_mode;
+  if (fused)
+  {
+    // prediction stops at the first learner past the stopping point
+    size_t count = o.N;
+    if (!is_learn)
+    {
+      float sum = 0;
+      for (count = 0; count < (size_t)o.N && sum <= stopping_point; count++)
+        sum += o.v[count];
+    }
+    predict_all(o, base, ec, count);
+  }
+
   for (int i = 0; i < o.N; i++)
   {
 
@@ -201,7 +268,10 @@ void predict_or_learn_adaptive(boosting& o, LEARNER::single_learner& base, examp
 
       ec.weight = u * w;
 
-      base.predict(ec, i);
+      if (fused)
+        ec.pred.scalar = o.pred[i].scalar;
+      else
+        base.predict(ec, i);
       float z;
 
       z = ld.label * ec.pred.scalar;
@@ -229,25 +299,34 @@ void predict_or_learn_adaptive(boosting& o, LEARNER::single_learner& base, examp
       if (o.alpha[i] > 2.) o.alpha[i] = 2;
       if (o.alpha[i] < -2.) o.alpha[i] = -2;
 
-      base.learn(ec, i);
+      if (fused)
+        o.weight[i] = ec.weight;
+      else
+        base.learn(ec, i);
 
     }
     else
     {
-      base.predict(ec, i);
-      if (v_partial_sum <= stopping_point)
-      {
-        final_prediction += ec.pred.scalar * o.alpha[i];
-      }
-      else
+      if (v_partial_sum > stopping_point)
       {
         // stopping at learner i
         break;
       }
+      if (fused)
+        ec.pred.scalar = o.pred[i].scalar;
+      else
+        base.predict(ec, i);
+      final_prediction += ec.pred.scalar * o.alpha[i];
       v_partial_sum += o.v[i];
     }
   }
 
+  if (is_learn && fused)
+  {
+    ec.weight = u;
+    update_all(o, base, ec);
+  }
+
   // normalize v vector in training
   if (is_learn)
   {
@@ -330,6 +409,9 @@ void finish(boosting& o)
 {
   o.C.~vector();
   o.alpha.~vector();
+  free(o.pred);
+  free(o.label);
+  free(o.weight);
 }
 
 void return_example(vw& all, boosting& a, example& ec)
@@ -405,21 +487,29 @@ LEARNER::base_learner* boosting_setup(arguments& arg)
   data->alpha = std::vector<float>(data->N,0);
   data->v = std::vector<float>(data->N,1);
 
+  data->pred = calloc_or_throw<polyprediction>(data->N);
+  data->label = calloc_or_throw<float>(data->N);
+  data->weight = calloc_or_throw<float>(data->N);
+
+  single_learner* base = as_singleline(setup_base(arg));
+  data->fused = base == arg.all->scorer && arg.all->linear_scorer && !arg.all->audit &&
+                (!arg.vm.count("link") || arg.vm["link"].as<string>() == "identity");
+
   learner<boosting,example>* l;
   if (data->alg == "BBM")
-    l = &init_learner<boosting,example>(data, as_singleline(setup_base(arg)),
+    l = &init_learner<boosting,example>(data, base,
                                 predict_or_learn<true>,
                                 predict_or_learn<false>, data->N);
   else if (data->alg == "logistic")
     {
-      l = &init_learner<boosting, example>(data, as_singleline(setup_base(arg)),
+      l = &init_learner<boosting, example>(data, base,
                                   predict_or_learn_logistic<true>,
                                   predict_or_learn_logistic<false>, data->N);
       l->set_save_load(save_load);
     }
   else if (data->alg == "adaptive")
     {
-      l = &init_learner<boosting, example>(data, as_singleline(setup_base(arg)),
+      l = &init_learner<boosting, example>(data, base,
                                   predict_or_learn_adaptive<true>,
                                   predict_or_learn_adaptive<false>, data->N);
       l->set_save_load(save_load_sampling);
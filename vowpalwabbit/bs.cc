@@ -14,6 +14,7 @@ license as described in the file LICENSE.
 #include "vw.h"
 #include "rand48.h"
 #include "bs.h"
+#include "gd.h"
 #include "vw_exception.h"
 
 using namespace std;
@@ -27,6 +28,10 @@ struct bs
   float ub;
   vector<double>* pred_vec;
   vw* all; // for raw prediction and loss
+  bool fused; // gd with an identity link right below, so the replicas can share passes
+  polyprediction* pred; // for multipredict
+  float* label;  // for multiupdate
+  float* weight;
 };
 
 void bs_predict_mean(vw& all, example& ec, vector<double> &pred_vec)
@@ -189,23 +194,53 @@ void predict_or_learn(bs& d, single_learner& base, example& ec)
   stringstream outputStringStream;
   d.pred_vec->clear();
 
-  for (size_t i = 1; i <= d.B; i++)
+  if (d.fused && !all.reg_mode)
   {
-    ec.weight = weight_temp * (float) BS::weight_gen(all);
+    // every replica read in one pass over the features and updated in
+    // another, with its own Poisson weight; the replicas share no weights,
+    // so this is what B learn() calls would do
+    float label = ec.l.simple.label;
+    all.set_minmax(all.sd, label);
+    base.multipredict(ec, 0, d.B, d.pred, false);
+    for (size_t i = 1; i <= d.B; i++)
+    {
+      ec.partial_prediction = d.pred[i-1].scalar;
+      d.pred[i-1].scalar = GD::finalize_prediction(all.sd, ec.partial_prediction);
+      d.weight[i-1] = weight_temp * (float) BS::weight_gen(all);
+      d.label[i-1] = (d.weight[i-1] > 0) ? label : FLT_MAX;
+      d.pred_vec->push_back(d.pred[i-1].scalar);
 
+      if (shouldOutput)
+      {
+        if (i > 1) outputStringStream << ' ';
+        outputStringStream << i << ':' << ec.partial_prediction;
+      }
+    }
     if (is_learn)
-      base.learn(ec, i-1);
-    else
-      base.predict(ec, i-1);
+      base.multiupdate(ec, 0, d.B, d.pred, d.label, d.weight);
 
-    d.pred_vec->push_back(ec.pred.scalar);
-
-    if (shouldOutput)
+    ec.pred.scalar = d.pred[d.B-1].scalar;
+    if (d.weight[d.B-1] > 0 && label != FLT_MAX)
+      ec.loss = all.loss->getLoss(all.sd, ec.pred.scalar, label) * d.weight[d.B-1];
+  }
+  else
+    for (size_t i = 1; i <= d.B; i++)
     {
-      if (i > 1) outputStringStream << ' ';
-      outputStringStream << i << ':' << ec.partial_prediction;
+      ec.weight = weight_temp * (float) BS::weight_gen(all);
+
+      if (is_learn)
+        base.learn(ec, i-1);
+      else
+        base.predict(ec, i-1);
+
+      d.pred_vec->push_back(ec.pred.scalar);
+
+      if (shouldOutput)
+      {
+        if (i > 1) outputStringStream << ' ';
+        outputStringStream << i << ':' << ec.partial_prediction;
+      }
     }
-  }
 
   ec.weight = weight_temp;
 
@@ -232,7 +267,12 @@ void finish_example(vw& all, bs& d, example& ec)
 }
 
 void finish(bs& d)
-{ delete d.pred_vec; }
+{
+  delete d.pred_vec;
+  free(d.pred);
+  free(d.label);
+  free(d.weight);
+}
 
 base_learner* bs_setup(arguments& arg)
 {
@@ -265,7 +305,14 @@ base_learner* bs_setup(arguments& arg)
   data->pred_vec->reserve(data->B);
   data->all = arg.all;
 
-  learner<bs,example>& l = init_learner(data, as_singleline(setup_base(arg)), predict_or_learn<true>,
+  data->pred = calloc_or_throw<polyprediction>(data->B);
+  data->label = calloc_or_throw<float>(data->B);
+  data->weight = calloc_or_throw<float>(data->B);
+
+  single_learner* base = as_singleline(setup_base(arg));
+  data->fused = base == arg.all->scorer && arg.all->linear_scorer && !arg.all->audit &&
+                (!arg.vm.count("link") || arg.vm["link"].as<string>() == "identity");
+  learner<bs,example>& l = init_learner(data, base, predict_or_learn<true>,
                                 predict_or_learn<false>, data->B);
   l.set_finish_example(finish_example);
   l.set_finish(finish);
@@ -371,7 +371,7 @@ void predict_or_learn_regcb(cb_explore_adf& data, multi_learner& base, multi_ex&
     //We want to preserve the score order in the returned action_probs if possible.  To do this,
     //sort top_actions and data.action_probs by the order induced in data.scores.
     sort(data.action_probs.begin(), data.action_probs.end(),
-         [data] (action_score as1, action_score as2)
+         [&data] (action_score as1, action_score as2)
          {
            if (as1.score > as2.score)
              return true;
@@ -800,6 +800,9 @@ base_learner* cb_explore_adf_setup(arguments& arg)
   multi_learner* base = as_multiline(setup_base(arg));
   arg.all->p->lp = CB::cb_label;
   arg.all->label_type = label_type::cb;
+  if (arg.all->rank_top > 0)
+    THROW("--rank_top can not be used with --cb_explore_adf, exploration needs the score of every action");
+  arg.all->all_action_scores = true;
 
   //Extract from lower level reductions.
   data->gen_cs.scorer = arg.all->scorer;
@@ -14,6 +14,7 @@ license as described in the file LICENSE.
 #include "vw_exception.h"
 #include <algorithm>
 #include "csoaa.h"
+#include "thread_pool.h"
 
 using namespace std;
 using namespace LEARNER;
@@ -25,6 +26,9 @@ struct csoaa
 {
   uint32_t num_classes;
   polyprediction* pred;
+  float* label;   // for multiupdate
+  bool fused;     // gd with an identity link right below, so classes can learn in one pass
+  vw* all;
 };
 
 template<bool is_learn>
@@ -51,6 +55,50 @@ inline void inner_loop(single_learner& base, example& ec, uint32_t i, float cost
 
 #define DO_MULTIPREDICT true
 
+// an example costing classes 1..k in order learns all of them with one
+// multipredict and one multiupdate, rather than a learn() per class.  the
+// classes share no weights, so this gives what the inner_loop calls would.
+// returns false when the loop must be used after all.
+bool learn_all_classes(csoaa& c, single_learner& base, example& ec, COST_SENSITIVE::label& ld,
+                       uint32_t& prediction, float& score)
+{
+  vw& all = *c.all;
+  if (!c.fused || all.reg_mode || ld.costs.size() != c.num_classes)
+    return false;
+  for (uint32_t i = 0; i < c.num_classes; i++)
+  {
+    float cost = ld.costs[i].x;
+    if (ld.costs[i].class_index != i+1)
+      return false;
+    // a widened label range would change the predictions of the classes after it
+    if (all.set_minmax != noop_mm && cost != FLT_MAX && (cost < all.sd->min_label || cost > all.sd->max_label))
+      return false;
+  }
+
+  ec.l.simple = { FLT_MAX, 0.f, 0.f };
+  base.multipredict(ec, 0, c.num_classes, c.pred, false);
+  for (uint32_t i = 1; i <= c.num_classes; i++)
+  {
+    float partial_prediction = c.pred[i-1].scalar;
+    ld.costs[i-1].partial_prediction = partial_prediction;
+    if (partial_prediction < score)
+    {
+      score = partial_prediction;
+      prediction = i;
+    }
+    add_passthrough_feature(ec, i, partial_prediction);
+
+    c.pred[i-1].scalar = GD::finalize_prediction(all.sd, partial_prediction);
+    c.label[i-1] = ld.costs[i-1].x;
+  }
+
+  ec.weight = 1.f;
+  base.multiupdate(ec, 0, c.num_classes, c.pred, c.label);
+  ec.weight = (ld.costs.last().x == FLT_MAX) ? 0.f : 1.f;
+  ec.l.simple.label = ld.costs.last().x;
+  return true;
+}
+
 template <bool is_learn>
 void predict_or_learn(csoaa& c, single_learner& base, example& ec)
 {
@@ -62,8 +110,9 @@ void predict_or_learn(csoaa& c, single_learner& base, example& ec)
   ec.l.simple = { 0., 0., 0. };
   if (ld.costs.size() > 0)
   {
-    for (auto& cl : ld.costs)
-      inner_loop<is_learn>(base, ec, cl.class_index, cl.x, prediction, score, cl.partial_prediction);
+    if (!is_learn || !learn_all_classes(c, base, ec, ld, prediction, score))
+      for (auto& cl : ld.costs)
+        inner_loop<is_learn>(base, ec, cl.class_index, cl.x, prediction, score, cl.partial_prediction);
     ec.partial_prediction = score;
   }
   else if (DO_MULTIPREDICT && !is_learn)
@@ -119,6 +168,7 @@ void finish_example(vw& all, csoaa&, example& ec)
 void finish(csoaa& c)
 {
   free(c.pred);
+  free(c.label);
 }
 
 
@@ -130,8 +180,14 @@ base_learner* csoaa_setup(arguments& arg)
     return nullptr;
 
   c->pred = calloc_or_throw<polyprediction>(c->num_classes);
-
-  learner<csoaa,example>& l = init_learner(c, as_singleline(setup_base(arg)), predict_or_learn<true>,
+  c->label = calloc_or_throw<float>(c->num_classes);
+  c->all = arg.all;
+
+  single_learner* base = as_singleline(setup_base(arg));
+  arg.all->linear_cost_sensitive = base == arg.all->scorer && arg.all->linear_scorer;
+  c->fused = arg.all->linear_cost_sensitive && !arg.all->audit &&
+             (!arg.vm.count("link") || arg.vm["link"].as<string>() == "identity");
+  learner<csoaa,example>& l = init_learner(c, base, predict_or_learn<true>,
                                    predict_or_learn<false>, c->num_classes, prediction_type::multiclass);
   arg.all->p->lp = cs_label;
   arg.all->label_type = label_type::cs;
@@ -162,8 +218,15 @@ struct ldf
   uint64_t ft_offset;
 
   v_array<action_scores > stored_preds;
+
+  bool linear_base; // scores come from gd right below the scorer
+
+  thread_pool* pool; // scores actions when predicting, with --score_threads
+  v_array<features*> action_label_fs;
 };
 
+const size_t parallel_min_actions = 32; // fewer are not worth waking the pool for
+
 bool ec_is_label_definition(example& ec) // label defs look like "0:___" or just "label:___"
 {
   if (ec.indices.size() < 1) return false;
@@ -240,14 +303,41 @@ void unsubtract_example(example *ec)
   ec->indices.decr();
 }
 
-void make_single_prediction(ldf& data, single_learner& base, example& ec)
+// When the base is linear and there are no interactions, the shared header
+// adds the same amount to every action's score.  It is computed once per
+// multi_ex and passed as the initial prediction instead of appending the
+// shared features to each action.
+bool can_cache_shared(ldf& data)
+{
+  vw& all = *data.all;
+  return data.linear_base && all.interactions.size() == 0 && all.l1_lambda == 0.
+         && !all.audit && !all.hash_inv;
+}
+
+float shared_score(ldf& data, example& shared)
+{
+  vw& all = *data.all;
+  float score = 0.f;
+  for (namespace_index ns : shared.indices)
+  {
+    if (ns == constant_namespace || (all.ignore_some_linear && all.ignore_linear[ns]))
+      continue;
+    features& fs = shared.feature_space[ns];
+    for (size_t i = 0; i < fs.size(); i++)
+      score += all.weights[fs.indicies[i] + data.ft_offset] * fs.values[i];
+  }
+  return score;
+}
+
+void make_single_prediction(ldf& data, single_learner& base, example& ec, float initial, features& label_fs)
 {
   COST_SENSITIVE::label ld = ec.l.cs;
   label_data simple_label;
-  simple_label.initial = 0.;
+  simple_label.initial = initial;
   simple_label.label = FLT_MAX;
 
-  LabelDict::add_example_namespace_from_memory(data.label_features, ec, ld.costs[0].class_index);
+  if (label_fs.size() > 0)
+    LabelDict::add_example_namespace(ec, 'l', label_fs);
 
   ec.l.simple = simple_label;
   uint64_t old_offset = ec.ft_offset;
@@ -256,10 +346,40 @@ void make_single_prediction(ldf& data, single_learner& base, example& ec)
   ec.ft_offset = old_offset;
   ld.costs[0].partial_prediction = ec.partial_prediction;
 
-  LabelDict::del_example_namespace_from_memory(data.label_features, ec, ld.costs[0].class_index);
+  if (label_fs.size() > 0)
+    LabelDict::del_example_namespace(ec, 'l', label_fs);
   ec.l.cs = ld;
 }
 
+features& label_features(ldf& data, example& ec)
+{
+  size_t lab = ec.l.cs.costs[0].class_index;
+  return data.label_features.get(lab, LabelDict::hash_lab(lab));
+}
+
+// Fill in partial_prediction for every action.  With --score_threads the
+// actions are spread over the pool, which only exists when the base only
+// reads the weights (see csldf_setup), and the label features are looked up
+// beforehand since the lookup moves the map's cursor.
+void predict_actions(ldf& data, single_learner& base, multi_ex& ec_seq, size_t start_K, float shared)
+{
+  size_t actions = ec_seq.size() - start_K;
+  if (data.pool == nullptr || actions < parallel_min_actions)
+  {
+    for (size_t k=start_K; k<ec_seq.size(); k++)
+      make_single_prediction(data, base, *ec_seq[k], shared, label_features(data, *ec_seq[k]));
+    return;
+  }
+
+  data.action_label_fs.clear();
+  for (size_t k=start_K; k<ec_seq.size(); k++)
+    data.action_label_fs.push_back(&label_features(data, *ec_seq[k]));
+  data.pool->parallel_for(actions, [&](size_t i)
+  {
+    make_single_prediction(data, base, *ec_seq[start_K + i], shared, *data.action_label_fs[i]);
+  });
+}
+
 bool test_ldf_sequence(ldf& data, size_t start_K, multi_ex& ec_seq)
 {
   bool isTest;
@@ -401,6 +521,34 @@ void do_actual_learning_oaa(ldf& data, single_learner& base, size_t start_K, mul
 }
 
 
+inline bool ranks_before(const action_score& a, const action_score& b) { return score_comp(&a, &b) < 0; }
+
+// Keep the top best actions in a heap whose root is the worst of them, so
+// each remaining action costs one comparison unless it gets in.  The result
+// is what a full sort truncated to top entries would give.
+void rank_top_actions(ldf& data, multi_ex& ec_seq, size_t start_K, size_t top)
+{
+  action_scores& a_s = data.a_s;
+  for (size_t k=start_K; k<ec_seq.size(); k++)
+  {
+    action_score s;
+    s.score = ec_seq[k]->partial_prediction;
+    s.action = (uint32_t)(k - start_K);
+    if (a_s.size() < top)
+    {
+      a_s.push_back(s);
+      push_heap(a_s.begin(), a_s.end(), ranks_before);
+    }
+    else if (ranks_before(s, a_s[0]))
+    {
+      pop_heap(a_s.begin(), a_s.end(), ranks_before);
+      a_s[a_s.size() - 1] = s;
+      push_heap(a_s.begin(), a_s.end(), ranks_before);
+    }
+  }
+  sort_heap(a_s.begin(), a_s.end(), ranks_before);
+}
+
 /*
 * The begining of the multi_ex sequence may be labels.  Process those
 * and return the start index of the un-processed examples
@@ -434,14 +582,26 @@ void do_actual_learning(ldf& data, single_learner& base, multi_ex& ec_seq_all)
   /////////////////////// add headers
   uint32_t K = (uint32_t)ec_seq.size();
   uint32_t start_K = 0;
+  float shared = 0.f;
+  bool headers_added = false;
 
   if (ec_is_example_header(*ec_seq[0]))
-  {
     start_K = 1;
-    for (uint32_t k=1; k<K; k++)
-      LabelDict::add_example_namespaces_from_example(*ec_seq[k], *ec_seq[0]);
-  }
   bool isTest = test_ldf_sequence(data, start_K, ec_seq);
+
+  // Scores the actions are learned from keep their exact summation order, so
+  // the shared score is only cached when nothing is learned.
+  if (start_K > 0)
+  {
+    if ((!is_learn || isTest) && can_cache_shared(data))
+      shared = shared_score(data, *ec_seq[0]);
+    else
+    {
+      for (uint32_t k=1; k<K; k++)
+        LabelDict::add_example_namespaces_from_example(*ec_seq[k], *ec_seq[0]);
+      headers_added = true;
+    }
+  }
   /////////////////////// do prediction
   uint32_t predicted_K = start_K;
   if(data.rank)
@@ -451,25 +611,31 @@ void do_actual_learning(ldf& data, single_learner& base, multi_ex& ec_seq_all)
     if (start_K > 0)
       data.stored_preds.push_back(ec_seq[0]->pred.a_s);
     for (uint32_t k=start_K; k<K; k++)
-    {
       data.stored_preds.push_back(ec_seq[k]->pred.a_s);
-      example *ec = ec_seq[k];
-      make_single_prediction(data, base, *ec);
-      action_score s;
-      s.score = ec->partial_prediction;
-      s.action = k - start_K;
-      data.a_s.push_back(s);
+    predict_actions(data, base, ec_seq, start_K, shared);
+    size_t top = data.all->rank_top;
+    if (top == 0 || top >= K - start_K)
+    {
+      for (uint32_t k=start_K; k<K; k++)
+      {
+        example *ec = ec_seq[k];
+        action_score s;
+        s.score = ec->partial_prediction;
+        s.action = k - start_K;
+        data.a_s.push_back(s);
+      }
+      qsort((void*) data.a_s.begin(), data.a_s.size(), sizeof(action_score), score_comp);
     }
-
-    qsort((void*) data.a_s.begin(), data.a_s.size(), sizeof(action_score), score_comp);
+    else
+      rank_top_actions(data, ec_seq, start_K, top);
   }
   else
   {
     float  min_score = FLT_MAX;
+    predict_actions(data, base, ec_seq, start_K, shared);
     for (uint32_t k=start_K; k<K; k++)
     {
       example *ec = ec_seq[k];
-      make_single_prediction(data, base, *ec);
       if (ec->partial_prediction < min_score)
       {
         min_score = ec->partial_prediction;
@@ -493,10 +659,9 @@ void do_actual_learning(ldf& data, single_learner& base, multi_ex& ec_seq_all)
       ec_seq[0]->pred.a_s = data.stored_preds[0];
     }
     for (size_t k=start_K; k<K; k++)
-    {
       ec_seq[k]->pred.a_s = data.stored_preds[k];
-      ec_seq[0]->pred.a_s.push_back(data.a_s[k-start_K]);
-    }
+    for (action_score& s : data.a_s)
+      ec_seq[0]->pred.a_s.push_back(s);
   }
   else
   {
@@ -510,7 +675,7 @@ void do_actual_learning(ldf& data, single_learner& base, multi_ex& ec_seq_all)
     }
   }
   /////////////////////// remove header
-  if (start_K > 0)
+  if (headers_added)
     for (size_t k=1; k<K; k++)
       LabelDict::del_example_namespaces_from_example(*ec_seq[k], *ec_seq[0]);
 
@@ -756,6 +921,8 @@ void finish(ldf& data)
   LabelDict::free_label_features(data.label_features);
   data.a_s.delete_v();
   data.stored_preds.delete_v();
+  data.action_label_fs.delete_v();
+  delete data.pool;
 }
 
 /*
@@ -816,7 +983,9 @@ base_learner* csldf_setup(arguments& arg)
       .critical<string>("csoaa_ldf", po::value<string>(), "Use one-against-all multiclass learning with label dependent features.")
       ("ldf_override", po::value<string>(), "Override singleline or multiline from csoaa_ldf or wap_ldf, eg if stored in file")
       .keep(ld->rank, "csoaa_rank", "Return actions sorted by score order")
-      .keep(ld->is_probabilities, "probabilities", "predict probabilites of all classes").missing())
+      .keep(ld->is_probabilities, "probabilities", "predict probabilites of all classes")
+      ("score_threads", po::value<size_t>(), "Score the actions of a multi-line example on this many threads when predicting")
+      ("rank_top", arg.all->rank_top, "With --csoaa_rank or --rank_all, only return the best <arg> actions").missing())
     if (arg.new_options("").critical<string>("wap_ldf", po::value<string>(), "Use weighted all-pairs multiclass learning with label dependent features.  Specify singleline or multiline.").missing())
       return nullptr;
 
@@ -877,7 +1046,18 @@ base_learner* csldf_setup(arguments& arg)
     pred_type = prediction_type::multiclass;
 
   ld->read_example_this_loop = 0;
-  learner<ldf,multi_ex>& l = init_learner(ld, as_singleline(setup_base(arg)), do_actual_learning<true>, do_actual_learning<false>, 1, pred_type);
+  single_learner* base = as_singleline(setup_base(arg));
+  ld->linear_base = base == arg.all->scorer && arg.all->linear_scorer;
+  if (arg.vm.count("score_threads") && arg.vm["score_threads"].as<size_t>() > 1)
+  {
+    // gd under the scorer only reads dense weights; sparse weights insert
+    // on lookup and audit appends to shared buffers, so neither is thread safe
+    if (ld->linear_base && !arg.all->weights.sparse && !arg.all->audit)
+      ld->pool = new thread_pool(arg.vm["score_threads"].as<size_t>());
+    else if (!arg.all->quiet)
+      arg.all->trace_message << "warning: --score_threads needs gd directly under the scorer, dense weights and no audit, scoring on one thread" << endl;
+  }
+  learner<ldf,multi_ex>& l = init_learner(ld, base, do_actual_learning<true>, do_actual_learning<false>, 1, pred_type);
   l.set_finish_example(finish_multiline_example);
   l.set_finish(finish);
   l.set_end_pass(end_pass);
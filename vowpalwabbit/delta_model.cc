@@ -0,0 +1,324 @@
+/*
+Copyright (c) by respective owners including Yahoo!, Microsoft, and
+individual contributors. All rights reserved.  Released under a BSD (revised)
+license as described in the file LICENSE.
+ */
+#include <algorithm>
+#include <unordered_map>
+#include "delta_model.h"
+#include "parse_regressor.h"
+#include "vw_exception.h"
+
+using namespace std;
+
+namespace DELTA_MODEL
+{
+const char magic[] = "vw_delta";
+const uint64_t page_rows = 1 << 10;
+const uint64_t end_of_pages = (uint64_t)-1;
+
+// Deltas carry just the weight of each row.  The format has room for more
+// slots per row, but the online state they would hold is only useful with the
+// save_resume counters, which a delta cannot restore.
+const uint32_t saved_slots = 1;
+
+uint64_t page_count(vw& all)
+{
+  return (((uint64_t)1 << all.num_bits) + page_rows - 1) / page_rows;
+}
+
+// the last page is short when there are fewer rows than page_rows
+uint64_t rows_in_page(vw& all, uint64_t page)
+{
+  return min(page_rows, ((uint64_t)1 << all.num_bits) - page * page_rows);
+}
+
+inline bool zero_row(const weight* v, uint32_t slots)
+{
+  for (uint32_t k = 0; k < slots; k++)
+    if (v[k] != 0.)
+      return false;
+  return true;
+}
+
+// MurmurHash3's 64 bit finalizer
+inline uint64_t fmix64(uint64_t k)
+{
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+// Digests are 64 bit sums over non-zero rows so that they do not depend on
+// the order sparse weights are visited in, and a changed page goes unnoticed
+// with a chance of about 2^-64.
+inline uint64_t row_digest(const weight* v, uint32_t slots, uint64_t row)
+{
+  if (zero_row(v, slots))
+    return 0;
+  uint64_t h = fmix64(row + 1);
+  for (uint32_t k = 0; k < slots; k++)
+  {
+    uint32_t bits;
+    memcpy(&bits, &v[k], sizeof(bits));
+    h = fmix64(h ^ bits);
+  }
+  return h;
+}
+
+void digest(vw& all, dense_parameters& weights, vector<uint64_t>& digests, uint32_t slots)
+{
+  uint64_t rows = (uint64_t)1 << all.num_bits;
+  for (uint64_t row = 0; row < rows; row++)
+    digests[row / page_rows] += row_digest(&weights.strided_index(row), slots, row);
+}
+
+void digest(vw&, sparse_parameters& weights, vector<uint64_t>& digests, uint32_t slots)
+{
+  uint32_t shift = weights.stride_shift();
+  for (sparse_parameters::iterator iter = weights.begin(); iter != weights.end(); ++iter)
+  {
+    uint64_t row = iter.index() >> shift;
+    digests[row / page_rows] += row_digest(&(*iter), slots, row);
+  }
+}
+
+vector<uint64_t> digest_pages(vw& all)
+{
+  vector<uint64_t> digests(page_count(all), 0);
+  if (all.weights.sparse)
+    digest(all, all.weights.sparse_weights, digests, saved_slots);
+  else
+    digest(all, all.weights.dense_weights, digests, saved_slots);
+  return digests;
+}
+
+inline uint64_t total(const vector<uint64_t>& digests)
+{
+  uint64_t sum = 0;
+  for (uint64_t d : digests)
+    sum += d;
+  return sum;
+}
+
+uint64_t weights_digest(vw& all)
+{
+  return total(digest_pages(all));
+}
+
+bool track(vw& all)
+{
+  vector<uint64_t> digests = digest_pages(all);
+
+  // a delta cannot carry anything but weights, so when anything else in the
+  // model changed, the snapshot has to be a full model again
+  uint64_t state = model_state_digest(all);
+  bool have_base = all.page_digests.size() == digests.size() && state == all.snapshot_state;
+  all.snapshot_state = state;
+  all.snapshot_base = total(all.page_digests);
+  all.dirty_pages.clear();
+  if (have_base)
+    for (uint64_t p = 0; p < digests.size(); p++)
+      if (digests[p] != all.page_digests[p])
+        all.dirty_pages.push_back(p);
+  all.page_digests.swap(digests);
+  return have_base;
+}
+
+void gather(dense_parameters& weights, uint64_t page, uint64_t n, uint32_t slots, vector<weight>& out)
+{
+  fill(out.begin(), out.end(), 0.f);
+  for (uint64_t r = 0; r < n; r++)
+  {
+    weight* v = &weights.strided_index(page * page_rows + r);
+    for (uint32_t k = 0; k < slots; k++)
+      out[r * slots + k] = v[k];
+  }
+}
+
+// A page is stored as its non-zero rows, each prefixed by its offset in the
+// page, and a checksum of the whole page.
+void write_page(io_buf& model_file, uint64_t page, uint32_t slots, vector<weight>& rows)
+{
+  uint32_t nonzero = 0;
+  for (uint64_t r = 0; r < page_rows; r++)
+    if (!zero_row(&rows[r * slots], slots))
+      nonzero++;
+  uint32_t check = (uint32_t)uniform_hash(rows.data(), rows.size() * sizeof(weight), page);
+
+  bin_write_fixed(model_file, (char*)&page, sizeof(page));
+  bin_write_fixed(model_file, (char*)&nonzero, sizeof(nonzero));
+  for (uint16_t r = 0; r < page_rows; r++)
+    if (!zero_row(&rows[r * slots], slots))
+    {
+      bin_write_fixed(model_file, (char*)&r, sizeof(r));
+      bin_write_fixed(model_file, (char*)&rows[r * slots], slots * sizeof(weight));
+    }
+  bin_write_fixed(model_file, (char*)&check, sizeof(check));
+}
+
+bool read_page(io_buf& model_file, uint64_t page, uint32_t slots, vector<weight>& rows)
+{
+  uint32_t nonzero;
+  uint32_t check;
+  if (bin_read_fixed(model_file, (char*)&nonzero, sizeof(nonzero), "") < sizeof(nonzero) || nonzero > page_rows)
+    return false;
+  fill(rows.begin(), rows.end(), 0.f);
+  for (uint32_t i = 0; i < nonzero; i++)
+  {
+    uint16_t r;
+    if (bin_read_fixed(model_file, (char*)&r, sizeof(r), "") < sizeof(r) || r >= page_rows ||
+        bin_read_fixed(model_file, (char*)&rows[r * slots], slots * sizeof(weight), "") < slots * sizeof(weight))
+      return false;
+  }
+  return bin_read_fixed(model_file, (char*)&check, sizeof(check), "") == sizeof(check) &&
+         check == (uint32_t)uniform_hash(rows.data(), rows.size() * sizeof(weight), page);
+}
+
+void write_pages(vw& all, io_buf& model_file, dense_parameters& weights, uint32_t slots)
+{
+  vector<weight> rows(page_rows * slots);
+  for (uint64_t page : all.dirty_pages)
+  {
+    gather(weights, page, rows_in_page(all, page), slots, rows);
+    write_page(model_file, page, slots, rows);
+  }
+}
+
+void write_pages(vw& all, io_buf& model_file, sparse_parameters& weights, uint32_t slots)
+{
+  // reading absent rows through strided_index would allocate them, so the
+  // dirty pages are filled from one pass over the rows that exist
+  unordered_map<uint64_t, vector<weight>> pages;
+  for (uint64_t page : all.dirty_pages)
+    pages[page].resize(page_rows * slots, 0.f);
+  uint32_t shift = weights.stride_shift();
+  for (sparse_parameters::iterator iter = weights.begin(); iter != weights.end(); ++iter)
+  {
+    uint64_t row = iter.index() >> shift;
+    auto p = pages.find(row / page_rows);
+    if (p != pages.end())
+      memcpy(&p->second[(row % page_rows) * slots], &(*iter), slots * sizeof(weight));
+  }
+  for (uint64_t page : all.dirty_pages)
+    write_page(model_file, page, slots, pages[page]);
+}
+
+void save(vw& all, io_buf& model_file)
+{
+  uint32_t num_bits = all.num_bits;
+  uint32_t slots = saved_slots;
+  uint64_t rows = page_rows;
+  bin_write_fixed(model_file, magic, sizeof(magic));
+  bin_write_fixed(model_file, (char*)&num_bits, sizeof(num_bits));
+  bin_write_fixed(model_file, (char*)&slots, sizeof(slots));
+  bin_write_fixed(model_file, (char*)&rows, sizeof(rows));
+  bin_write_fixed(model_file, (char*)&all.snapshot_state, sizeof(all.snapshot_state));
+  uint64_t result = total(all.page_digests);
+  bin_write_fixed(model_file, (char*)&all.snapshot_base, sizeof(all.snapshot_base));
+  bin_write_fixed(model_file, (char*)&result, sizeof(result));
+
+  if (all.weights.sparse)
+    write_pages(all, model_file, all.weights.sparse_weights, slots);
+  else
+    write_pages(all, model_file, all.weights.dense_weights, slots);
+  bin_write_fixed(model_file, (char*)&end_of_pages, sizeof(end_of_pages));
+  model_file.flush();
+}
+
+void save(vw& all, string filename)
+{
+  string start_name = filename + ".writing";
+  io_buf model_file;
+  model_file.open_file(start_name.c_str(), all.stdin_off, io_buf::WRITE);
+  save(all, model_file);
+  model_file.close_file();
+
+  remove(filename.c_str());
+  if (0 != rename(start_name.c_str(), filename.c_str()))
+    THROW("delta checkpoint: cannot rename: " << start_name << " to " << filename);
+  if (!all.quiet)
+    all.trace_message << "delta checkpoint " << filename << ": " << all.dirty_pages.size() << " of "
+                      << all.page_digests.size() << " pages changed" << endl;
+}
+
+// Slots this process keeps beyond the ones in the file are left alone.
+void scatter(dense_parameters& weights, uint64_t first, uint64_t n, uint32_t slots, uint32_t file_slots, const weight* in)
+{
+  for (uint64_t r = 0; r < n; r++)
+  {
+    weight* v = &weights.strided_index(first + r);
+    for (uint32_t k = 0; k < slots; k++)
+      v[k] = in[r * file_slots + k];
+  }
+}
+
+// Rows that are zero in the delta are only written if they exist already.
+void scatter(sparse_parameters& weights, uint64_t first, uint64_t n, uint32_t slots, uint32_t file_slots, const weight* in)
+{
+  uint32_t shift = weights.stride_shift();
+  for (uint64_t r = 0; r < n; r++)
+  {
+    const weight* row = in + r * file_slots;
+    if (zero_row(row, slots) && !weights.exists((first + r) << shift))
+      continue;
+    weight* v = &weights.strided_index(first + r);
+    for (uint32_t k = 0; k < slots; k++)
+      v[k] = row[k];
+  }
+}
+
+void apply(vw& all, string filename, uint64_t& weights)
+{
+  io_buf model_file;
+  model_file.open_file(filename.c_str(), all.stdin_off, io_buf::READ);
+
+  char file_magic[sizeof(magic)];
+  uint32_t num_bits = 0, file_slots = 0;
+  uint64_t rows = 0, state = 0, base = 0, result = 0;
+  if (bin_read_fixed(model_file, file_magic, sizeof(file_magic), "") < sizeof(file_magic) || memcmp(file_magic, magic, sizeof(magic)) != 0)
+    THROW(filename << " is not a delta checkpoint");
+  bin_read_fixed(model_file, (char*)&num_bits, sizeof(num_bits), "");
+  bin_read_fixed(model_file, (char*)&file_slots, sizeof(file_slots), "");
+  bin_read_fixed(model_file, (char*)&rows, sizeof(rows), "");
+  bin_read_fixed(model_file, (char*)&state, sizeof(state), "");
+  bin_read_fixed(model_file, (char*)&base, sizeof(base), "");
+  if (bin_read_fixed(model_file, (char*)&result, sizeof(result), "") < sizeof(result))
+    THROW("Delta checkpoint " << filename << " is truncated");
+  if (num_bits != all.num_bits || rows != page_rows || file_slots == 0)
+    THROW("Delta checkpoint " << filename << " was written with " << num_bits << " bits, model has " << all.num_bits);
+  if (base != weights)
+    THROW("Delta checkpoint " << filename << " was not taken right after the weights loaded so far; apply a chain in order, starting with its base model");
+  // only the weights come from the delta, everything else from the base
+  if (state != model_state_digest(all))
+    THROW("Delta checkpoint " << filename << " was written on top of a model whose state besides the weights differs from the one loaded");
+
+  uint32_t slots = min(file_slots, (uint32_t)1 << all.weights.stride_shift());
+  vector<weight> page_data(rows * file_slots);
+  size_t applied = 0;
+  for (;;)
+  {
+    uint64_t page;
+    if (bin_read_fixed(model_file, (char*)&page, sizeof(page), "") < sizeof(page))
+      THROW("Delta checkpoint " << filename << " is truncated");
+    if (page == end_of_pages)
+      break;
+    if (page >= page_count(all) || !read_page(model_file, page, file_slots, page_data))
+      THROW("Delta checkpoint " << filename << " is corrupted");
+
+    if (all.weights.sparse)
+      scatter(all.weights.sparse_weights, page * page_rows, rows_in_page(all, page), slots, file_slots, page_data.data());
+    else
+      scatter(all.weights.dense_weights, page * page_rows, rows_in_page(all, page), slots, file_slots, page_data.data());
+    applied++;
+  }
+  model_file.close_file();
+  weights = result;
+
+  if (!all.quiet)
+    all.trace_message << "applied delta checkpoint " << filename << " (" << applied << " pages)" << endl;
+}
+}
@@ -0,0 +1,42 @@
+/*
+Copyright (c) by respective owners including Yahoo!, Microsoft, and
+individual contributors. All rights reserved.  Released under a BSD
+license as described in the file LICENSE.
+ */
+#pragma once
+#include <string>
+#include "global_data.h"
+
+// Delta checkpoints: with --delta_checkpoint the first snapshot taken by
+// save_predictor is a full model and every later one only holds the pages of
+// weight rows that changed since the snapshot before it.  A chain is loaded
+// (or compacted, with -f) by passing the base model with -i and then the
+// deltas in order with --delta_regressor.
+//
+// A delta only restores weights.  Reduction state and the rest of the model
+// come from the base, so a snapshot is a full model again whenever any of it
+// changed, and a delta refuses to load on top of a model whose state differs
+// from the one it was written against, or on top of weights other than those
+// of the snapshot it was taken after.  --save_resume is refused, since its
+// counters change with every example.
+namespace DELTA_MODEL
+{
+// Compare every page of weights against the digest taken at the previous
+// snapshot and remember the pages that differ.  Returns false when there is
+// no previous snapshot or the state besides the weights changed, i.e. a full
+// model has to be written.
+bool track(vw& all);
+
+// Write the pages found dirty by the last track() to a delta file.
+void save(vw& all, std::string filename);
+void save(vw& all, io_buf& model_file);
+
+// Digest of all weights, as a delta records it for the snapshot it was
+// taken after and the one it produces.
+uint64_t weights_digest(vw& all);
+
+// Apply the delta file on top of the weights loaded so far, whose digest is
+// weights; it has to be the one the delta was taken after.  On return
+// weights is the digest of the snapshot the delta produces.
+void apply(vw& all, std::string filename, uint64_t& weights);
+}
@@ -0,0 +1,307 @@
+/*
+Copyright (c) by respective owners including Yahoo!, Microsoft, and
+individual contributors. All rights reserved.  Released under a BSD (revised)
+license as described in the file LICENSE.
+ */
+#include <thread>
+#include <vector>
+#include "dense_model.h"
+#include "vw_exception.h"
+
+using namespace std;
+
+namespace DENSE_MODEL
+{
+const uint64_t alignment = 1 << 16; // covers page sizes and Windows' allocation granularity
+const uint64_t chunk_rows = 1 << 20; // rows per checksum
+const uint64_t checksum_seed = 0x7a3c;
+
+struct header
+{
+  uint32_t stride_shift;
+  uint64_t rows;
+  uint64_t chunk_rows;
+  uint32_t pad;
+};
+
+inline uint64_t chunk_count(const header& h) { return (h.rows + h.chunk_rows - 1) / h.chunk_rows; }
+
+inline uint32_t checksum(const weight* rows, uint64_t n)
+{
+  return (uint32_t)uniform_hash(rows, n * sizeof(weight), checksum_seed);
+}
+
+// Run f(chunk) for every chunk, spread over up to all.save_threads threads.
+// Exceptions are rethrown on the calling thread.
+template<class F> void for_each_chunk(vw& all, uint64_t chunks, F f)
+{
+  size_t threads = (size_t)min((uint64_t)max(all.save_threads, (size_t)1), chunks);
+  if (threads <= 1)
+  {
+    for (uint64_t c = 0; c < chunks; c++)
+      f(c);
+    return;
+  }
+
+  vector<exception_ptr> errors(threads);
+  vector<thread> workers;
+  for (size_t t = 0; t < threads; t++)
+    workers.push_back(thread([&, t]()
+    {
+      try
+      {
+        for (uint64_t c = t; c < chunks; c += threads)
+          f(c);
+      }
+      catch (...)
+      {
+        errors[t] = current_exception();
+      }
+    }));
+  for (thread& w : workers)
+    w.join();
+  for (exception_ptr& e : errors)
+    if (e)
+      rethrow_exception(e);
+}
+
+#ifdef _WIN32
+bool positioned(io_buf&, int64_t) { return false; }
+#else
+// Writes or reads at explicit offsets are possible on a plain file.
+bool positioned(io_buf& model_file, int64_t offset)
+{
+  return offset >= 0 && !model_file.compressed();
+}
+
+void pwrite_all(int fd, const char* buf, size_t n, int64_t offset)
+{
+  while (n > 0)
+  {
+    ssize_t done = pwrite(fd, buf, n, (off_t)offset);
+    if (done <= 0)
+      THROWERRNO("writing dense model table");
+    buf += done;
+    n -= done;
+    offset += done;
+  }
+}
+
+void pread_all(int fd, char* buf, size_t n, int64_t offset)
+{
+  while (n > 0)
+  {
+    ssize_t done = pread(fd, buf, n, (off_t)offset);
+    if (done <= 0)
+      THROW("Model content is corrupted, dense weight table is truncated");
+    buf += done;
+    n -= done;
+    offset += done;
+  }
+}
+#endif
+
+void gather(dense_parameters& weights, uint64_t first, uint64_t n, weight* out)
+{
+  for (uint64_t j = 0; j < n; j++)
+    out[j] = weights.strided_index(first + j);
+}
+
+void gather(weight_snapshot& weights, uint64_t first, uint64_t n, weight* out)
+{
+  for (uint64_t j = 0; j < n; j++)
+    out[j] = *weights.row((first + j) << weights.stride_shift());
+}
+
+// Only non-zero weights are stored, like the index/value layout does, so rows
+// that were zero keep whatever the regressor was initialized with.
+template<class T> void scatter(T& weights, uint64_t first, uint64_t n, const weight* in)
+{
+  for (uint64_t j = 0; j < n; j++)
+    if (in[j] != 0.)
+      weights.strided_index(first + j) = in[j];
+}
+
+template<class T> void save_table(vw& all, io_buf& model_file, T& weights, size_t threads)
+{
+  header h;
+  h.stride_shift = 0;
+  h.rows = (weights.mask() + 1) >> weights.stride_shift();
+  h.chunk_rows = chunk_rows;
+
+  if (all.num_bits < 31)
+  {
+    uint32_t sentinel = (uint32_t)-1;
+    bin_write_fixed(model_file, (char*)&sentinel, sizeof(sentinel));
+  }
+  else
+  {
+    uint64_t sentinel = (uint64_t)-1;
+    bin_write_fixed(model_file, (char*)&sentinel, sizeof(sentinel));
+  }
+  bin_write_fixed(model_file, (char*)&h.stride_shift, sizeof(h.stride_shift));
+  bin_write_fixed(model_file, (char*)&h.rows, sizeof(h.rows));
+  bin_write_fixed(model_file, (char*)&h.chunk_rows, sizeof(h.chunk_rows));
+
+  // pad so the table starts aligned; if the destination is not a plain file the
+  // offset is unknown and the loader falls back to reading the table
+  int64_t offset = model_file.write_offset();
+  h.pad = 0;
+  if (offset >= 0)
+    h.pad = (uint32_t)((alignment - (offset + sizeof(h.pad)) % alignment) % alignment);
+  bin_write_fixed(model_file, (char*)&h.pad, sizeof(h.pad));
+  char zeros[256] = {};
+  for (uint32_t left = h.pad; left > 0; left -= min(left, (uint32_t)sizeof(zeros)))
+    bin_write_fixed(model_file, zeros, min(left, (uint32_t)sizeof(zeros)));
+
+  uint64_t chunks = chunk_count(h);
+  vector<uint32_t> checksums(chunks);
+  offset = model_file.write_offset();
+  // an in-memory snapshot knows its offset but has no descriptor to pwrite to
+  if (positioned(model_file, offset) && model_file.files[0] >= 0 && threads > 1)
+  {
+#ifndef _WIN32
+    model_file.flush();
+    int fd = model_file.files[0];
+    for_each_chunk(all, chunks, [&](uint64_t c)
+    {
+      uint64_t first = c * h.chunk_rows;
+      uint64_t n = min(h.chunk_rows, h.rows - first);
+      vector<weight> rows(n);
+      gather(weights, first, n, rows.data());
+      checksums[c] = checksum(rows.data(), n);
+      pwrite_all(fd, (char*)rows.data(), n * sizeof(weight), offset + first * sizeof(weight));
+    });
+    if (lseek(fd, offset + h.rows * sizeof(weight), SEEK_SET) < 0)
+      THROWERRNO("writing dense model table");
+#endif
+  }
+  else
+  {
+    vector<weight> rows((size_t)min(h.chunk_rows, h.rows));
+    for (uint64_t c = 0; c < chunks; c++)
+    {
+      uint64_t first = c * h.chunk_rows;
+      uint64_t n = min(h.chunk_rows, h.rows - first);
+      gather(weights, first, n, rows.data());
+      checksums[c] = checksum(rows.data(), n);
+      bin_write_fixed(model_file, (char*)rows.data(), n * sizeof(weight));
+    }
+  }
+
+  bin_write_fixed(model_file, (char*)checksums.data(), chunks * sizeof(uint32_t));
+}
+
+void save(vw& all, io_buf& model_file, dense_parameters& weights)
+{
+  save_table(all, model_file, weights, all.save_threads);
+}
+
+// a snapshot is read in order, so only one thread can gather from it
+void save(vw& all, io_buf& model_file, weight_snapshot& weights)
+{
+  save_table(all, model_file, weights, 1);
+}
+
+header read_header(vw& all, io_buf& model_file)
+{
+  header h;
+  if (bin_read_fixed(model_file, (char*)&h.stride_shift, sizeof(h.stride_shift), "") < sizeof(h.stride_shift) ||
+      bin_read_fixed(model_file, (char*)&h.rows, sizeof(h.rows), "") < sizeof(h.rows) ||
+      bin_read_fixed(model_file, (char*)&h.chunk_rows, sizeof(h.chunk_rows), "") < sizeof(h.chunk_rows) ||
+      bin_read_fixed(model_file, (char*)&h.pad, sizeof(h.pad), "") < sizeof(h.pad))
+    THROW("Model content is corrupted, dense weight table header is truncated");
+  if (h.stride_shift != 0 || h.rows != ((uint64_t)1 << all.num_bits) || h.chunk_rows == 0)
+    THROW("Model content is corrupted, dense weight table of " << h.rows << " rows does not match " << all.num_bits << " bits");
+
+  char* skip;
+  for (uint32_t left = h.pad; left > 0;)
+  {
+    size_t n = buf_read(model_file, skip, min(left, (uint32_t)(1 << 16)));
+    if (n == 0)
+      THROW("Model content is corrupted, dense weight table is truncated");
+    left -= (uint32_t)n;
+  }
+  return h;
+}
+
+// The stored checksums are always consumed; they are only compared with
+// --verify_dense_model, otherwise computed is empty.
+void verify(const header& h, const vector<uint32_t>& computed, io_buf& model_file)
+{
+  vector<uint32_t> stored((size_t)chunk_count(h));
+  size_t bytes = stored.size() * sizeof(uint32_t);
+  if (bin_read_fixed(model_file, (char*)stored.data(), bytes, "") < bytes)
+    THROW("Model content is corrupted, dense weight table checksums are truncated");
+  for (size_t c = 0; c < computed.size(); c++)
+    if (stored[c] != computed[c])
+      THROW("Model content is corrupted, checksum mismatch in dense weight rows " << c * h.chunk_rows
+            << " to " << min((c + 1) * h.chunk_rows, h.rows) - 1);
+}
+
+// Sequential fallback, for compressed or in-memory models and sparse weights.
+template<class T> void read_rows(vw& all, io_buf& model_file, const header& h, T& weights)
+{
+  uint64_t chunks = chunk_count(h);
+  vector<uint32_t> checksums(all.verify_dense_model ? chunks : 0);
+  vector<weight> rows((size_t)min(h.chunk_rows, h.rows));
+  for (uint64_t c = 0; c < chunks; c++)
+  {
+    uint64_t first = c * h.chunk_rows;
+    uint64_t n = min(h.chunk_rows, h.rows - first);
+    if (bin_read_fixed(model_file, (char*)rows.data(), n * sizeof(weight), "") < n * sizeof(weight))
+      THROW("Model content is corrupted, dense weight table is truncated");
+    if (all.verify_dense_model)
+      checksums[c] = checksum(rows.data(), n);
+    scatter(weights, first, n, rows.data());
+  }
+  verify(h, checksums, model_file);
+}
+
+void load(vw& all, io_buf& model_file, dense_parameters& weights)
+{
+  header h = read_header(all, model_file);
+  int64_t offset = model_file.read_offset();
+  if (!positioned(model_file, offset))
+  {
+    read_rows(all, model_file, h, weights);
+    return;
+  }
+
+#ifndef _WIN32
+  int fd = model_file.files[model_file.current];
+  uint64_t chunks = chunk_count(h);
+  vector<uint32_t> checksums(all.verify_dense_model ? chunks : 0);
+
+  // A mapped table is only paged in as it is used, unless asked to verify it.
+  if (offset % alignment == 0 && weights.stride_shift() == 0 && weights.map_file(fd, offset, h.rows))
+  {
+    if (all.verify_dense_model)
+      for_each_chunk(all, chunks, [&](uint64_t c)
+      {
+        uint64_t first = c * h.chunk_rows;
+        checksums[c] = checksum(weights.first() + first, min(h.chunk_rows, h.rows - first));
+      });
+  }
+  else
+    for_each_chunk(all, chunks, [&](uint64_t c)
+    {
+      uint64_t first = c * h.chunk_rows;
+      uint64_t n = min(h.chunk_rows, h.rows - first);
+      vector<weight> rows(n);
+      pread_all(fd, (char*)rows.data(), n * sizeof(weight), offset + first * sizeof(weight));
+      if (all.verify_dense_model)
+        checksums[c] = checksum(rows.data(), n);
+      scatter(weights, first, n, rows.data()); // chunks cover disjoint rows
+    });
+
+  model_file.seek(offset + h.rows * sizeof(weight));
+  verify(h, checksums, model_file);
+#endif
+}
+
+void load(vw& all, io_buf& model_file, sparse_parameters& weights)
+{
+  read_rows(all, model_file, read_header(all, model_file), weights);
+}
+}
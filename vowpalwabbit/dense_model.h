@@ -0,0 +1,26 @@
+/*
+Copyright (c) by respective owners including Yahoo!, Microsoft, and
+individual contributors. All rights reserved.  Released under a BSD
+license as described in the file LICENSE.
+ */
+#pragma once
+#include "global_data.h"
+#include "weight_snapshot.h"
+
+// Dense model layout for the gd regressor: after a sentinel index, the weight
+// of every row is stored raw (stride 1) at a 64KB aligned file offset,
+// followed by a checksum per chunk of rows.  A test-only process maps the
+// table directly as its weight table; everybody else copies rows into place.
+// Chunks are written and read on all.save_threads threads.  The checksums
+// are only checked on load with --verify_dense_model, since checking a
+// mapped table reads all of it.
+namespace DENSE_MODEL
+{
+void save(vw& all, io_buf& model_file, dense_parameters& weights);
+// from a background save's snapshot, on a single thread
+void save(vw& all, io_buf& model_file, weight_snapshot& weights);
+
+// called once the sentinel index has been consumed
+void load(vw& all, io_buf& model_file, dense_parameters& weights);
+void load(vw& all, io_buf& model_file, sparse_parameters& weights);
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include <float.h>
 #include "learner.h"
 #include "vw.h"
 #include "parse_args.h"
@@ -7,16 +8,227 @@
 namespace ExpReplay
 {
 
+// what a buffered example needs to be learned again; its features live in
+// the arenas of expreplay, entries [start, start+size)
+struct replay_slot
+{ size_t start;
+  size_t size;
+  size_t capacity;  // entries reserved, so a slot is rewritten in place while its examples fit
+  uint64_t ft_offset;
+  float weight;
+  size_t example_counter;
+  size_t num_features;
+  float total_sum_feat_sq;
+  bool test_only;
+  bool sorted;
+  polylabel l;
+};
+
+// sums and minima over the slot priorities, a binary tree in an array with
+// the leaves at [size, 2*size)
+struct priority_tree
+{ size_t size;
+  v_array<float> sum;
+  v_array<float> min;
+};
+
 struct expreplay
 { vw* all;
   size_t N;      //how big is the buffer?
-  example* buf;  //the deep copies of examples (N of them)
-  bool* filled;  //which of buf[] is filled
+  replay_slot* slots;  //the examples in the buffer (N of them)
+  bool* filled;  //which of slots[] is filled
   size_t replay_count; //each time er.learn() is called, how many times do we call base.learn()? default=1 (in which case we're just permuting)
   LEARNER::single_learner* base;
+
+  // the features of all buffered examples.  a namespace is a header entry
+  // (index = namespace | feature count << 8, value = sum of squares, no
+  // name) followed by its features.  a slot that outgrows its entries
+  // moves to the end; the arenas are packed once the abandoned entries
+  // outnumber the live ones.
+  v_array<feature_index> indicies;
+  v_array<feature_value> values;
+  v_array<audit_strings_ptr> space_names; // only with audit or invert_hash
+  size_t live;  // entries reserved by slots
+  bool names;
+
+  example* replayed; // what base.learn() sees when a slot is replayed
+
+  bool prioritized; // replays drawn in proportion to the loss the base learner reported
+  priority_tree priorities;
 };
 
-template<bool is_learn, label_parser& lp>
+const float priority_floor = 0.01f; // so every buffered example can still be drawn
+const size_t min_pack_entries = 1 << 16;
+
+inline void set_priority(priority_tree& t, size_t n, float p)
+{ size_t i = t.size + n;
+  t.sum[i] = p;
+  t.min[i] = (p == 0.f) ? FLT_MAX : p;
+  for (i /= 2; i > 0; i /= 2)
+  { t.sum[i] = t.sum[2*i] + t.sum[2*i+1];
+    t.min[i] = std::min(t.min[2*i], t.min[2*i+1]);
+  }
+}
+
+inline size_t draw_priority(priority_tree& t, float r)
+{ size_t i = 1;
+  while (i < t.size)
+  { if (r < t.sum[2*i] || t.sum[2*i+1] == 0.f)
+      i = 2*i;
+    else
+    { r -= t.sum[2*i];
+      i = 2*i+1;
+    }
+  }
+  return i - t.size;
+}
+
+template<char er_level>
+float priority(example& ec)
+{ float p;
+  if (er_level == 'm')
+    p = (ec.pred.multiclass == ec.l.multi.label) ? 0.f : ec.weight;
+  else if (er_level == 'c')
+  { float min_cost = FLT_MAX, pred_cost = 0.f;
+    for (auto& cl : ec.l.cs.costs)
+    { min_cost = std::min(min_cost, cl.x);
+      if (cl.class_index == ec.pred.multiclass)
+        pred_cost = cl.x;
+    }
+    p = (min_cost == FLT_MAX) ? 0.f : pred_cost - min_cost;
+  }
+  else
+    p = ec.loss;
+  return std::max(p, priority_floor);
+}
+
+inline size_t entries(example& ec)
+{ size_t n = 0;
+  for (namespace_index ns : ec.indices)
+    n += 1 + ec.feature_space[ns].size();
+  return n;
+}
+
+inline void pack(expreplay& er)
+{ v_array<feature_index> indicies = v_init<feature_index>();
+  v_array<feature_value> values = v_init<feature_value>();
+  v_array<audit_strings_ptr> space_names = v_init<audit_strings_ptr>();
+  for (size_t n = 0; n < er.N; n++)
+  { replay_slot& s = er.slots[n];
+    if (s.capacity == 0)
+      continue;
+    size_t start = indicies.size();
+    for (size_t i = s.start; i < s.start + s.size; i++)
+    { indicies.push_back(er.indicies[i]);
+      values.push_back(er.values[i]);
+      if (er.names)
+        space_names.push_back(er.space_names[i]);
+    }
+    s.start = start;
+    s.capacity = s.size;
+  }
+  er.indicies.delete_v();
+  er.values.delete_v();
+  er.space_names.delete_v();
+  er.indicies = indicies;
+  er.values = values;
+  er.space_names = space_names;
+  er.live = er.indicies.size();
+}
+
+// the slot's entries, moved to the end of the arenas when they do not fit
+inline void reserve(expreplay& er, replay_slot& s, size_t needed)
+{ if (needed <= s.capacity)
+    return;
+  er.live -= s.capacity;
+  s.capacity = s.size = 0;
+  size_t abandoned = er.indicies.size() - er.live;
+  if (abandoned > er.live && abandoned > min_pack_entries)
+    pack(er);
+  s.start = er.indicies.size();
+  s.capacity = needed;
+  er.live += needed;
+  for (size_t i = 0; i < needed; i++)
+  { er.indicies.push_back(0);
+    er.values.push_back(0.f);
+    if (er.names)
+      er.space_names.push_back(nullptr);
+  }
+}
+
+template<label_parser& lp>
+void store(expreplay& er, size_t n, example& ec)
+{ replay_slot& s = er.slots[n];
+  reserve(er, s, entries(ec));
+  size_t i = s.start;
+  for (namespace_index ns : ec.indices)
+  { features& fs = ec.feature_space[ns];
+    er.indicies[i] = ns | ((uint64_t)fs.size() << 8);
+    er.values[i] = fs.sum_feat_sq;
+    if (er.names)
+      er.space_names[i] = nullptr;
+    ++i;
+    bool has_names = er.names && fs.space_names.size() > 0;
+    for (size_t f = 0; f < fs.size(); f++, i++)
+    { er.indicies[i] = fs.indicies[f];
+      er.values[i] = fs.values[f];
+      if (er.names)
+        er.space_names[i] = has_names ? fs.space_names[f] : nullptr;
+    }
+  }
+  s.size = i - s.start;
+
+  s.ft_offset = ec.ft_offset;
+  s.weight = ec.weight;
+  s.example_counter = ec.example_counter;
+  s.num_features = ec.num_features;
+  s.total_sum_feat_sq = ec.total_sum_feat_sq;
+  s.test_only = ec.test_only;
+  s.sorted = ec.sorted;
+  if (lp.copy_label)
+    lp.copy_label(&s.l, &ec.l);
+  else
+    s.l = ec.l;
+}
+
+// rebuild slot n in er.replayed, reusing its feature arrays
+template<label_parser& lp>
+example& load(expreplay& er, size_t n)
+{ replay_slot& s = er.slots[n];
+  example& ec = *er.replayed;
+  for (namespace_index ns : ec.indices)
+    ec.feature_space[ns].clear();
+  ec.indices.clear();
+
+  for (size_t i = s.start; i < s.start + s.size;)
+  { namespace_index ns = (namespace_index)(er.indicies[i] & 0xff);
+    size_t count = er.indicies[i] >> 8;
+    features& fs = ec.feature_space[ns];
+    ec.indices.push_back(ns);
+    fs.sum_feat_sq = er.values[i++];
+    for (size_t end = i + count; i < end; i++)
+    { fs.values.push_back(er.values[i]);
+      fs.indicies.push_back(er.indicies[i]);
+      if (er.names && er.space_names[i] != nullptr)
+        fs.space_names.push_back(er.space_names[i]);
+    }
+  }
+
+  ec.ft_offset = s.ft_offset;
+  ec.weight = s.weight;
+  ec.example_counter = s.example_counter;
+  ec.num_features = s.num_features;
+  ec.total_sum_feat_sq = s.total_sum_feat_sq;
+  ec.test_only = s.test_only;
+  ec.sorted = s.sorted;
+  if (lp.copy_label)
+    lp.copy_label(&ec.l, &s.l);
+  else
+    ec.l = s.l;
+  return ec;
+}
+
+template<bool is_learn, char er_level, label_parser& lp>
 void predict_or_learn(expreplay& er, LEARNER::single_learner& base, example& ec)
 { // regardless of what happens, we must predict
   base.predict(ec);
@@ -24,46 +236,67 @@ void predict_or_learn(expreplay& er, LEARNER::single_learner& base, example& ec)
   if (!is_learn || lp.get_weight(&ec.l) == 0.) return;
 
   for (size_t replay=1; replay<er.replay_count; replay++)
-  { size_t n = (size_t)(merand48(er.all->random_state) * (float)er.N);
+  { size_t n;
+    float weight_scale = 1.f;
+    if (er.prioritized)
+    { priority_tree& t = er.priorities;
+      if (t.sum[1] == 0.f)
+        continue;
+      n = draw_priority(t, merand48(er.all->random_state) * t.sum[1]);
+      // importance weight over the least likely draw, so it is at most one
+      weight_scale = t.min[1] / t.sum[t.size + n];
+    }
+    else
+      n = (size_t)(merand48(er.all->random_state) * (float)er.N);
     if (er.filled[n])
-      base.learn(er.buf[n]);
+    { example& replayed = load<lp>(er, n);
+      replayed.weight *= weight_scale;
+      base.learn(replayed);
+      if (er.prioritized)
+        set_priority(er.priorities, n, priority<er_level>(replayed));
+    }
   }
 
   size_t n = (size_t)(merand48(er.all->random_state) * (float)er.N);
   if (er.filled[n])
-    base.learn(er.buf[n]);
+    base.learn(load<lp>(er, n));
 
   er.filled[n] = true;
-  VW::copy_example_data(er.all->audit, &er.buf[n], &ec); // don't copy the label
-  if (lp.copy_label)
-    lp.copy_label(&er.buf[n].l, &ec.l);
-  else
-    er.buf[n].l = ec.l;
+  store<lp>(er, n, ec);
+  if (er.prioritized)
+    set_priority(er.priorities, n, priority<er_level>(ec));
 }
 
 void multipredict(expreplay&, LEARNER::single_learner& base, example& ec, size_t count, size_t step, polyprediction*pred, bool finalize_predictions)
 { base.multipredict(ec, count, step, pred, finalize_predictions);
 }
 
+template<label_parser& lp>
 void end_pass(expreplay& er)
 { // we need to go through and learn on everyone who remains
-  // also need to clean up remaining examples
   for (size_t n = 0; n < er.N; n++)
     if (er.filled[n])
     { // TODO: if er.replay_count > 1 do we need to play these more?
-      er.base->learn(er.buf[n]);
+      er.base->learn(load<lp>(er, n));
       er.filled[n] = false;
+      if (er.prioritized)
+        set_priority(er.priorities, n, 0.f);
     }
 }
 
 template<label_parser& lp>
 void finish(expreplay& er)
 { for (size_t n=0; n<er.N; n++)
-  { lp.delete_label(&er.buf[n].l);
-    VW::dealloc_example(NULL, er.buf[n], NULL);  // TODO: need to free label
-  }
-  free(er.buf);
+    lp.delete_label(&er.slots[n].l);
+  free(er.slots);
   free(er.filled);
+  er.indicies.delete_v();
+  er.values.delete_v();
+  er.space_names.delete_v();
+  VW::dealloc_example(lp.delete_label, *er.replayed);
+  free(er.replayed);
+  er.priorities.sum.delete_v();
+  er.priorities.min.delete_v();
 }
 
 template<char er_level, label_parser& lp>
@@ -73,29 +306,48 @@ LEARNER::base_learner* expreplay_setup(arguments& arg)
   replay_string += er_level;
   std::string replay_count_string = replay_string;
   replay_count_string += "_count";
+  std::string replay_prioritized_string = replay_string;
+  replay_prioritized_string += "_prioritized";
 
   auto er = scoped_calloc_or_throw<expreplay>();
   if (arg.new_options("Experience Replay")
       .critical(replay_string.c_str(), er->N, "use experience replay at a specified level [b=classification/regression, m=multiclass, c=cost sensitive] with specified buffer size")
-      (replay_count_string.c_str(), er->replay_count, (size_t)1, "how many times (in expectation) should each example be played (default: 1 = permuting)").missing() || er->N==0)
+      (replay_count_string.c_str(), er->replay_count, (size_t)1, "how many times (in expectation) should each example be played (default: 1 = permuting)")
+      (er->prioritized, replay_prioritized_string.c_str(), "draw the extra replays in proportion to each example's last loss").missing() || er->N==0)
     return nullptr;
 
   er->all = arg.all;
-  er->buf = VW::alloc_examples(1, er->N);
+  er->slots = calloc_or_throw<replay_slot>(er->N);
+  er->filled = calloc_or_throw<bool>(er->N);
+  er->names = arg.all->audit || arg.all->hash_inv;
+  er->replayed = VW::alloc_examples(1, 1);
+  er->replayed->in_use = true;
 
   if (er_level == 'c')
-    for (size_t n=0; n<er->N; n++)
-      er->buf[n].l.cs.costs = v_init<COST_SENSITIVE::wclass>();
+  { for (size_t n=0; n<er->N; n++)
+      er->slots[n].l.cs.costs = v_init<COST_SENSITIVE::wclass>();
+    er->replayed->l.cs.costs = v_init<COST_SENSITIVE::wclass>();
+  }
 
-  er->filled = calloc_or_throw<bool>(er->N);
+  if (er->prioritized)
+  { priority_tree& t = er->priorities;
+    for (t.size = 1; t.size < er->N; t.size *= 2);
+    t.sum.resize(2*t.size);
+    t.sum.end() = t.sum.begin() + 2*t.size;
+    t.min.resize(2*t.size);
+    t.min.end() = t.min.begin() + 2*t.size;
+    for (size_t i = 0; i < 2*t.size; i++)
+      t.min[i] = FLT_MAX;
+  }
 
   if (! arg.all->quiet)
-    std::cerr << "experience replay level=" << er_level << ", buffer=" << er->N << ", replay count=" << er->replay_count << std::endl;
+    std::cerr << "experience replay level=" << er_level << ", buffer=" << er->N << ", replay count=" << er->replay_count
+              << (er->prioritized ? ", prioritized" : "") << std::endl;
 
   er->base = LEARNER::as_singleline(setup_base(arg));
-  LEARNER::learner<expreplay,example>* l = &init_learner(er, er->base, predict_or_learn<true,lp>, predict_or_learn<false,lp>);
+  LEARNER::learner<expreplay,example>* l = &init_learner(er, er->base, predict_or_learn<true,er_level,lp>, predict_or_learn<false,er_level,lp>);
   l->set_finish(finish<lp>);
-  l->set_end_pass(end_pass);
+  l->set_end_pass(end_pass<lp>);
 
   return make_base(*l);
 }
@@ -29,6 +29,8 @@ license as described in the file LICENSE.
 #include "reductions.h"
 #include "vw.h"
 #include "floatbits.h"
+#include "dense_model.h"
+#include "weight_snapshot.h"
 
 #define VERSION_SAVE_RESUME_FIX "7.10.1"
 #define VERSION_PASS_UINT64 "8.3.3"
@@ -55,11 +57,16 @@ struct gd
   void (*update)(gd&, base_learner&, example&);
   float (*sensitivity)(gd&, base_learner&, example&);
   void (*multipredict)(gd&, base_learner&, example&, size_t, size_t, polyprediction*, bool);
+  void (*multiupdate)(gd&, base_learner&, example&, size_t, size_t, polyprediction*, float*, float*);
   bool normalized;
   bool adaptive;
   bool adax;
 
   vw* all; //parallel, features, parameters
+
+  // scratch for multiupdate, one entry per learner
+  v_array<struct norm_data> multi_nd;
+  v_array<float> multi_update;
 };
 
 void sync_weights(vw& all);
@@ -176,6 +183,16 @@ void end_pass(gd& g)
          ((all.current_pass % all.check_holdout_every_n_passes) == 0)))
       set_done(all);
   }
+
+  // after the holdout reductions, so a node resuming from here starts with
+  // the first all_reduce of the next pass like everybody else
+  if (all.all_reduce != nullptr && all.span_checkpoint.length() > 0)
+  {
+    if (all.early_terminate || all.current_pass >= all.numpasses)
+      remove_span_checkpoint(all);
+    else
+      save_span_checkpoint(all);
+  }
 }
 
 #include <algorithm>
@@ -647,6 +664,154 @@ void update(gd& g, base_learner&, example& ec)
     sync_weights(*g.all);
 }
 
+template<class T> struct multiupdate_info { size_t count; size_t step; T& weights; norm_data* nd; float* update; };
+
+template<class T, bool sqrt_rate, bool feature_mask_off, size_t adaptive, size_t normalized, size_t spare>
+inline void pred_per_update_multi(multiupdate_info<T>& mu, float x, uint64_t fi)
+{
+  for (size_t c=0; c<mu.count; c++, fi += mu.step)
+    if (mu.nd[c].grad_squared != 0.f)
+      pred_per_update_feature<sqrt_rate, feature_mask_off, adaptive, normalized, spare, false>(mu.nd[c], x, mu.weights[fi]);
+}
+
+template<class T, bool sqrt_rate, bool feature_mask_off, size_t adaptive, size_t normalized, size_t spare>
+inline void update_feature_multi(multiupdate_info<T>& mu, float x, uint64_t fi)
+{
+  for (size_t c=0; c<mu.count; c++, fi += mu.step)
+    if (mu.update[c] != 0.f)
+      update_feature<sqrt_rate, feature_mask_off, adaptive, normalized, spare>(mu.update[c], x, mu.weights[fi]);
+}
+
+template<class T, bool sqrt_rate, bool feature_mask_off, size_t adaptive, size_t normalized, size_t spare>
+void multiupdate_sensitivity(gd& g, example& ec, T& weights, size_t count, size_t step)
+{
+  multiupdate_info<T> mu = { count, step, weights, g.multi_nd.begin(), g.multi_update.begin() };
+  foreach_feature<multiupdate_info<T>, uint64_t, pred_per_update_multi<T, sqrt_rate, feature_mask_off, adaptive, normalized, spare> >(*g.all, ec, mu);
+}
+
+template<class T, bool sqrt_rate, bool feature_mask_off, size_t adaptive, size_t normalized, size_t spare>
+void multiupdate_train(gd& g, example& ec, T& weights, size_t count, size_t step)
+{
+  multiupdate_info<T> mu = { count, step, weights, g.multi_nd.begin(), g.multi_update.begin() };
+  foreach_feature<multiupdate_info<T>, uint64_t, update_feature_multi<T, sqrt_rate, feature_mask_off, adaptive, normalized, spare> >(*g.all, ec, mu);
+}
+
+// the updates of several learners on one example, with one pass over the
+// features for the sensitivities and one for the weights, rather than two
+// per learner.  the learners' weights are adjacent, so each feature touches
+// one short run of the table.  gives the same result as update() on each
+// learner in turn: they share no weights, and the normalizer statistics
+// they do share are still advanced in learner order.
+template<bool sparse_l2, bool invariant, bool sqrt_rate, bool feature_mask_off, bool adax, size_t adaptive, size_t normalized, size_t spare>
+void multiupdate(gd& g, base_learner& base, example& ec, size_t count, size_t step, polyprediction* pred, float* label, float* weight)
+{
+  vw& all = *g.all;
+  float ec_weight = ec.weight;
+  if (all.reg_mode) // truncation and contraction make each update depend on the one before
+  {
+    polyprediction save_pred = ec.pred;
+    float save_label = ec.l.simple.label;
+    for (size_t c=0; c<count; c++, ec.ft_offset += step)
+      if (label[c] != FLT_MAX)
+      {
+        ec.pred.scalar = pred[c].scalar;
+        ec.l.simple.label = label[c];
+        ec.weight = weight ? weight[c] : ec_weight;
+        update<sparse_l2, invariant, sqrt_rate, feature_mask_off, adax, adaptive, normalized, spare>(g, base, ec);
+      }
+    ec.ft_offset -= step*count;
+    ec.pred = save_pred;
+    ec.l.simple.label = save_label;
+    ec.weight = ec_weight;
+    return;
+  }
+
+  if (g.multi_nd.size() < count)
+  {
+    g.multi_nd.resize(count);
+    g.multi_nd.end() = g.multi_nd.begin() + count;
+    g.multi_update.resize(count);
+    g.multi_update.end() = g.multi_update.begin() + count;
+  }
+  norm_data* nd = g.multi_nd.begin();
+  float* upd = g.multi_update.begin();
+
+  bool sensitivity_pass = false;
+  for (size_t c=0; c<count; c++)
+  {
+    nd[c] = {0., 0., 0., {g.neg_power_t, g.neg_norm_power}, {0., 0., 0., 0.}};
+    if ((adaptive || normalized) && (label[c] != FLT_MAX) && (all.loss->getLoss(all.sd, pred[c].scalar, label[c]) > 0.))
+    {
+      nd[c].grad_squared = weight ? weight[c] : ec_weight;
+      if (!adax)
+        nd[c].grad_squared *= all.loss->getSquareGrad(pred[c].scalar, label[c]);
+      sensitivity_pass |= nd[c].grad_squared != 0.f;
+    }
+  }
+  if (sensitivity_pass)
+  {
+    if (all.weights.sparse)
+      multiupdate_sensitivity<sparse_parameters, sqrt_rate, feature_mask_off, adaptive, normalized, spare>(g, ec, all.weights.sparse_weights, count, step);
+    else
+      multiupdate_sensitivity<dense_parameters, sqrt_rate, feature_mask_off, adaptive, normalized, spare>(g, ec, all.weights.dense_weights, count, step);
+  }
+
+  float update_scale = get_scale<adaptive>(g, ec, ec_weight);
+  bool train_pass = false;
+  for (size_t c=0; c<count; c++)
+  {
+    upd[c] = 0.;
+    if (label[c] == FLT_MAX) continue;
+
+    float w = ec_weight;
+    float scale = update_scale;
+    if (weight && weight[c] != ec_weight)
+    {
+      w = weight[c];
+      scale = get_scale<adaptive>(g, ec, w);
+    }
+    float update = 0.;
+    if (all.loss->getLoss(all.sd, pred[c].scalar, label[c]) > 0.)
+    {
+      float pred_per_update;
+      if (!adaptive && !normalized)
+        pred_per_update = ec.total_sum_feat_sq;
+      else if (nd[c].grad_squared == 0.f)
+        pred_per_update = 1.;
+      else
+      {
+        pred_per_update = nd[c].pred_per_update;
+        if (normalized)
+        {
+          g.all->normalized_sum_norm_x += ((double)w) * nd[c].norm_x;
+          g.total_weight += w;
+          g.update_multiplier = average_update<sqrt_rate, adaptive, normalized>((float)g.total_weight, (float)g.all->normalized_sum_norm_x, g.neg_norm_power);
+          pred_per_update *= g.update_multiplier;
+        }
+      }
+      if (invariant)
+        update = all.loss->getUpdate(pred[c].scalar, label[c], scale, pred_per_update);
+      else
+        update = all.loss->getUnsafeUpdate(pred[c].scalar, label[c], scale);
+    }
+    if (sparse_l2)
+      update -= g.sparse_l2 * pred[c].scalar;
+
+    if (update != 0.)
+    {
+      upd[c] = normalized ? update * g.update_multiplier : update;
+      train_pass = true;
+    }
+  }
+  if (train_pass)
+  {
+    if (all.weights.sparse)
+      multiupdate_train<sparse_parameters, sqrt_rate, feature_mask_off, adaptive, normalized, spare>(g, ec, all.weights.sparse_weights, count, step);
+    else
+      multiupdate_train<dense_parameters, sqrt_rate, feature_mask_off, adaptive, normalized, spare>(g, ec, all.weights.dense_weights, count, step);
+  }
+}
+
 template<bool sparse_l2, bool invariant, bool sqrt_rate, bool feature_mask_off, bool adax, size_t adaptive, size_t normalized, size_t spare>
 void learn(gd& g, base_learner& base, example& ec)
 {
@@ -658,6 +823,12 @@ void learn(gd& g, base_learner& base, example& ec)
   update<sparse_l2, invariant, sqrt_rate, feature_mask_off, adax, adaptive, normalized, spare>(g,base,ec);
 }
 
+void finish(gd& g)
+{
+  g.multi_nd.delete_v();
+  g.multi_update.delete_v();
+}
+
 void sync_weights(vw& all)
 {
   //todo, fix length dependence
@@ -675,6 +846,31 @@ void sync_weights(vw& all)
   all.sd->contraction = 1.;
 }
 
+template<class T>
+void write_regressor(vw& all, io_buf& model_file, bool text, T& weights)
+{
+  uint64_t i = 0;
+  uint32_t old_i = 0;
+  for (typename T::iterator v = weights.begin(); v != weights.end(); ++v)
+    if (*v != 0.)
+    {
+      i = v.index() >> weights.stride_shift();
+      stringstream msg;
+      msg << i;
+
+      if (all.num_bits < 31)
+      {
+        old_i = (uint32_t)i;
+        bin_text_write_fixed(model_file, (char *)&old_i, sizeof(old_i), msg, text);
+      }
+      else
+        bin_text_write_fixed(model_file, (char *)&i, sizeof(i), msg, text);
+
+      msg << ":" << *v << "\n";
+      bin_text_write_fixed(model_file, (char *)&(*v), sizeof(*v), msg, text);
+    }
+}
+
 template<class T>
 void save_load_regressor(vw& all, io_buf& model_file, bool read, bool text, T& weights)
 {
@@ -717,6 +913,11 @@ void save_load_regressor(vw& all, io_buf& model_file, bool read, bool text, T& w
         brw = bin_read_fixed(model_file, (char*)&i, sizeof(i), "");
       if (brw > 0)
       {
+        if (all.num_bits < 31 ? old_i == (uint32_t)-1 : i == (uint64_t)-1)
+        {
+          DENSE_MODEL::load(all, model_file, weights);
+          return;
+        }
         if (i >= length)
           THROW("Model content is corrupted, weight vector index " << i << " must be less than total vector length " << length);
         weight* v = &weights.strided_index(i);
@@ -724,36 +925,74 @@ void save_load_regressor(vw& all, io_buf& model_file, bool read, bool text, T& w
       }
     }
     while (brw >0);
-  else // write
-    for (typename T::iterator v = weights.begin(); v != weights.end(); ++v)
-      if (*v != 0.)
-      {
-        i = v.index() >> weights.stride_shift();
-        stringstream msg;
-        msg << i;
-
-        if (all.num_bits < 31)
-        {
-          old_i = (uint32_t)i;
-          brw = bin_text_write_fixed(model_file, (char *)&old_i, sizeof(old_i), msg, text);
-        }
-        else
-          brw = bin_text_write_fixed(model_file, (char *)&i, sizeof(i), msg, text);
-
-        msg << ":" << *v << "\n";
-        brw += bin_text_write_fixed(model_file, (char *)&(*v), sizeof(*v), msg, text);
-      }
+  else
+    write_regressor(all, model_file, text, weights);
 }
 
 
 void save_load_regressor(vw& all, io_buf& model_file, bool read, bool text)
 {
-  if (all.weights.sparse)
+  // a background save streams the table later, from a snapshot
+  bool dense_table = all.dense_model;
+  if (!read && !text && !all.print_invert &&
+      defer_weights(all, model_file, [&all, dense_table](io_buf& file, weight_snapshot& weights)
+  {
+    if (dense_table)
+      DENSE_MODEL::save(all, file, weights);
+    else
+      write_regressor(all, file, false, weights);
+  }))
+    return;
+
+  if (!read && !text && all.dense_model && !all.print_invert && !all.weights.sparse)
+    DENSE_MODEL::save(all, model_file, all.weights.dense_weights);
+  else if (all.weights.sparse)
     save_load_regressor(all, model_file, read, text, all.weights.sparse_weights);
   else
     save_load_regressor(all, model_file, read, text, all.weights.dense_weights);
 }
 
+template<class T>
+void write_online_state(vw& all, io_buf& model_file, bool text, gd* g, stringstream& msg, T& weights)
+{
+  uint64_t i = 0;
+  uint32_t old_i = 0;
+  for (typename T::iterator v = weights.begin(); v != weights.end(); ++v)
+    if (*v != 0.)
+    {
+      i = v.index() >> weights.stride_shift();
+      msg << i;
+      if (all.num_bits < 31)
+      {
+        old_i = (uint32_t)i;
+        bin_text_write_fixed(model_file, (char *)&old_i, sizeof(old_i), msg, text);
+      }
+      else
+        bin_text_write_fixed(model_file, (char *)&i, sizeof(i), msg, text);
+
+      if (g == nullptr || (!g->adaptive && !g->normalized))
+      {
+        msg << ":" << *v << "\n";
+        bin_text_write_fixed(model_file, (char *)&(*v), sizeof(*v),
+                             msg, text);
+      }
+      else if ((g->adaptive && !g->normalized) || (!g->adaptive && g->normalized))
+      {
+        //either adaptive or normalized
+        msg << ":" << *v << " " << (&(*v))[1] << "\n";
+        bin_text_write_fixed(model_file, (char *)&(*v), 2 * sizeof(*v),
+                             msg, text);
+      }
+      else
+      {
+        //adaptive and normalized
+        msg << ":" << *v << " " << (&(*v))[1] << " " << (&(*v))[2] << "\n";
+        bin_text_write_fixed(model_file, (char *)&(*v), 3 * sizeof(*v),
+                             msg, text);
+      }
+    }
+}
+
 template<class T>
 void save_load_online_state(vw& all, io_buf& model_file, bool read, bool text, gd* g, stringstream& msg, T& weights)
 {
@@ -793,40 +1032,7 @@ void save_load_online_state(vw& all, io_buf& model_file, bool read, bool text, g
     }
     while (brw >0);
   else // write binary or text
-    for (typename T::iterator v = weights.begin(); v != weights.end(); ++v)
-      if (*v != 0.)
-      {
-        i = v.index() >> weights.stride_shift();
-        msg << i;
-        if (all.num_bits < 31)
-        {
-          old_i = (uint32_t)i;
-          brw = bin_text_write_fixed(model_file, (char *)&old_i, sizeof(old_i), msg, text);
-        }
-        else
-          brw = bin_text_write_fixed(model_file, (char *)&i, sizeof(i), msg, text);
-
-        if (g == nullptr || (!g->adaptive && !g->normalized))
-        {
-          msg << ":" << *v << "\n";
-          brw += bin_text_write_fixed(model_file, (char *)&(*v), sizeof(*v),
-                                      msg, text);
-        }
-        else if ((g->adaptive && !g->normalized) || (!g->adaptive && g->normalized))
-        {
-          //either adaptive or normalized
-          msg << ":" << *v << " " << (&(*v))[1] << "\n";
-          brw += bin_text_write_fixed(model_file, (char *)&(*v), 2 * sizeof(*v),
-                                      msg, text);
-        }
-        else
-        {
-          //adaptive and normalized
-          msg << ":" << *v << " " << (&(*v))[1] << " " << (&(*v))[2] << "\n";
-          brw += bin_text_write_fixed(model_file, (char *)&(*v), 3 * sizeof(*v),
-                                      msg, text);
-        }
-      }
+    write_online_state(all, model_file, text, g, msg, weights);
 }
 
 void save_load_online_state(vw& all, io_buf& model_file, bool read, bool text, gd* g)
@@ -933,6 +1139,14 @@ void save_load_online_state(vw& all, io_buf& model_file, bool read, bool text, g
     all.sd->total_features = 0;
     all.current_pass = 0;
   }
+  if (!read && !text &&
+      defer_weights(all, model_file, [&all, g](io_buf& file, weight_snapshot& weights)
+  {
+    stringstream msg;
+    write_online_state(all, file, false, g, msg, weights);
+  }))
+    return;
+
   if (all.weights.sparse)
     save_load_online_state(all, model_file, read, text, g, msg, all.weights.sparse_weights);
   else
@@ -1003,6 +1217,7 @@ uint64_t set_learn(vw& all, gd& g)
   {
     g.learn = learn<sparse_l2, invariant, sqrt_rate, feature_mask_off, true, adaptive, normalized, spare>;
     g.update = update<sparse_l2, invariant, sqrt_rate, feature_mask_off, true, adaptive, normalized, spare>;
+    g.multiupdate = multiupdate<sparse_l2, invariant, sqrt_rate, feature_mask_off, true, adaptive, normalized, spare>;
     g.sensitivity = sensitivity<sqrt_rate, feature_mask_off, true, adaptive, normalized, spare>;
     return next;
   }
@@ -1010,6 +1225,7 @@ uint64_t set_learn(vw& all, gd& g)
   {
     g.learn = learn<sparse_l2, invariant, sqrt_rate, feature_mask_off, false, adaptive, normalized, spare>;
     g.update = update<sparse_l2, invariant, sqrt_rate, feature_mask_off, false, adaptive, normalized, spare>;
+    g.multiupdate = multiupdate<sparse_l2, invariant, sqrt_rate, feature_mask_off, false, adaptive, normalized, spare>;
     g.sensitivity = sensitivity<sqrt_rate, feature_mask_off, false, adaptive, normalized, spare>;
     return next;
   }
@@ -1181,8 +1397,10 @@ base_learner* setup(arguments& arg)
   ret.set_sensitivity(bare->sensitivity);
   ret.set_multipredict(bare->multipredict);
   ret.set_update(bare->update);
+  ret.set_multiupdate(bare->multiupdate);
   ret.set_save_load(save_load);
   ret.set_end_pass(end_pass);
+  ret.set_finish(finish);
   return make_base(ret);
 }
 
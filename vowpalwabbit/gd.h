@@ -85,6 +85,51 @@ inline float inline_predict(vw& all, example& ec)
     inline_predict<dense_parameters>(all.weights.dense_weights, all.ignore_some_linear, all.ignore_linear, all.interactions, all.permutations, ec, ec.l.simple.initial);
 }
 
+inline void vec_store(features& fs, const float fx, uint64_t fi) { fs.push_back(fx, fi); }
+
+// resolve an example's features, quadratic and cubic ones included, to (value, index) pairs once so
+// that predictors at many offsets can be scored without regenerating interactions.  Indices are
+// stored without ec.ft_offset; the linear features come first and their count is returned.
+inline size_t cache_features(vw& all, example& ec, features& fs)
+{
+  fs.clear();
+  uint64_t save_offset = ec.ft_offset;
+  ec.ft_offset = 0;
+  for (example_predict::iterator i = ec.begin(); i != ec.end(); ++i)
+    if (!all.ignore_some_linear || !all.ignore_linear[i.index()])
+      for (features::iterator& f : *i)
+        fs.push_back(f.value(), f.index());
+  size_t num_linear = fs.size();
+  if (all.weights.sparse)
+    generate_interactions<features, uint64_t, vec_store, sparse_parameters>(all.interactions, all.permutations, ec, fs, all.weights.sparse_weights);
+  else
+    generate_interactions<features, uint64_t, vec_store, dense_parameters>(all.interactions, all.permutations, ec, fs, all.weights.dense_weights);
+  ec.ft_offset = save_offset;
+  return num_linear;
+}
+
+// add the contribution of cached features [begin, end) to count predictors at the given offsets,
+// in the same order inline_predict would
+template <class W>
+inline void cached_multipredict(W& weights, features& fs, size_t begin, size_t end, const uint64_t* offset, size_t count, float* pred)
+{
+  for (size_t i = begin; i < end; i++)
+  {
+    float x = fs.values[i];
+    uint64_t index = fs.indicies[i];
+    for (size_t c = 0; c < count; c++)
+      pred[c] += weights[index + offset[c]] * x;
+  }
+}
+
+inline void cached_multipredict(vw& all, features& fs, size_t begin, size_t end, const uint64_t* offset, size_t count, float* pred)
+{
+  if (all.weights.sparse)
+    cached_multipredict(all.weights.sparse_weights, fs, begin, end, offset, count, pred);
+  else
+    cached_multipredict(all.weights.dense_weights, fs, begin, end, offset, count, pred);
+}
+
 inline float sign(float w) { if (w < 0.) return -1.; else  return 1.; }
 
 inline float trunc_weight(const float w, const float gravity)
@@ -19,6 +19,10 @@ license as described in the file LICENSE.
 #include "vw_exception.h"
 #include "array_parameters.h"
 
+#if !defined(VW_NO_INLINE_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SIMD_LATENT
+#endif
 
 using namespace std;
 
@@ -31,8 +35,86 @@ struct gdmf
   uint32_t rank;
   size_t no_win_counter;
   uint64_t early_stop_thres;
+
+  v_array<float> latent; // rank latent sums per side of each pair, for the current example
+  v_array<float> scaled_update; // update * (r^k . x_r) for k = 1..rank, then update * (l^k . x_l)
+  uint64_t generation; // bumped by every weight update, and wherever weights may change outside mf_train
+
+  // latent sums of the last right (item) namespace, valid while generation is unchanged
+  bool item_valid;
+  unsigned char item_ns;
+  uint64_t item_generation;
+  v_array<float> item_values;
+  v_array<feature_index> item_indices;
+  v_array<float> item_sums;
 };
 
+// Kernels over the rank latent weights of one feature, doing per lane the
+// same arithmetic as the scalar loops.
+
+// sums[k] += w[k] * x
+inline void latent_add(float* sums, const float* w, float x, size_t rank)
+{
+  size_t k = 0;
+#ifdef HAVE_SIMD_LATENT
+  __m128 vx = _mm_set1_ps(x);
+  for (; k + 4 <= rank; k += 4)
+    _mm_storeu_ps(sums + k, _mm_add_ps(_mm_loadu_ps(sums + k), _mm_mul_ps(_mm_loadu_ps(w + k), vx)));
+#endif
+  for (; k < rank; k++)
+    sums[k] += w[k] * x;
+}
+
+// w[k] += update[k] * x - regularization * w[k]
+inline void latent_update(float* w, const float* update, float x, float regularization, size_t rank)
+{
+  size_t k = 0;
+#ifdef HAVE_SIMD_LATENT
+  __m128 vx = _mm_set1_ps(x);
+  __m128 vr = _mm_set1_ps(regularization);
+  for (; k + 4 <= rank; k += 4)
+  {
+    __m128 vw = _mm_loadu_ps(w + k);
+    _mm_storeu_ps(w + k, _mm_add_ps(vw, _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(update + k), vx), _mm_mul_ps(vr, vw))));
+  }
+#endif
+  for (; k < rank; k++)
+    w[k] += update[k] * x - regularization * w[k];
+}
+
+// sums[0..rank) = the latent weights at offset+1..offset+rank dotted with fs
+template<class T>
+void latent_sums(T& weights, features& fs, uint64_t offset, float* sums, size_t rank)
+{
+  for (size_t k = 0; k < rank; k++)
+    sums[k] = 0.;
+  for (size_t i = 0; i < fs.size(); i++)
+    latent_add(sums, &weights[fs.indicies[i]] + offset + 1, fs.values[i], rank);
+}
+
+// latent sums of a right namespace, reused from the previous example when its
+// features are identical and the weights have not been updated since
+template<class T>
+void item_sums(gdmf& d, T& weights, unsigned char ns, features& fs, float* sums)
+{
+  size_t n = fs.size();
+  if (d.item_valid && d.item_ns == ns && d.item_generation == d.generation && d.item_values.size() == n &&
+      memcmp(d.item_values.begin(), fs.values.begin(), n * sizeof(float)) == 0 &&
+      memcmp(d.item_indices.begin(), fs.indicies.begin(), n * sizeof(feature_index)) == 0)
+  {
+    memcpy(sums, d.item_sums.begin(), d.rank * sizeof(float));
+    return;
+  }
+  latent_sums(weights, fs, d.rank, sums, d.rank);
+  d.item_valid = true;
+  d.item_ns = ns;
+  d.item_generation = d.generation;
+  copy_array(d.item_values, fs.values);
+  copy_array(d.item_indices, fs.indicies);
+  d.item_sums.clear();
+  push_many(d.item_sums, sums, d.rank);
+}
+
 void mf_print_offset_features(gdmf& d, example& ec, size_t offset)
 {
   vw& all = *d.all;
@@ -82,13 +164,8 @@ void mf_print_audit_features(gdmf& d, example& ec, size_t offset)
   mf_print_offset_features(d, ec, offset);
 }
 
-struct pred_offset
-{
-  float p;
-  uint64_t offset;
-};
-
-void offset_add(pred_offset& res, const float fx, float& fw) { res.p += (&fw)[res.offset] * fx; }
+inline bool both_sides(example& ec, string& i)
+{ return ec.feature_space[(int)i[0]].size() > 0 && ec.feature_space[(int)i[1]].size() > 0; }
 
 template<class T> float mf_predict(gdmf& d, example& ec, T& weights)
 {
@@ -118,28 +195,42 @@ template<class T> float mf_predict(gdmf& d, example& ec, T& weights)
 
   prediction += linear_prediction;
   // interaction terms
-  for (string& i : d.all->pairs)
+  // the rank sums x_l * l^k (l^k is from index+1 to index+d.rank) and x_r * r^k (r^k is from
+  // index+d.rank+1 to index+2*d.rank) of each side are accumulated in one pass over its features,
+  // and shared by the pairs that have the same namespace on that side
+  size_t rank = d.rank;
+  size_t num_pairs = d.all->pairs.size();
+  d.latent.resize(2 * rank * num_pairs);
+  // an example that is about to update the weights can't reuse its item sums
+  bool reuse_items = !(all.training && ld.label != FLT_MAX);
+  for (size_t p = 0; p < num_pairs; p++)
   {
-    if (ec.feature_space[(int)i[0]].size() > 0 && ec.feature_space[(int)i[1]].size() > 0)
+    string& i = d.all->pairs[p];
+    if (both_sides(ec, i))
     {
-      for (uint64_t k = 1; k <= d.rank; k++)
+      float* x_dot_l = d.latent.begin() + 2 * rank * p;
+      float* x_dot_r = x_dot_l + rank;
+      size_t q = 0;
+      for (; q < p && (d.all->pairs[q][0] != i[0] || !both_sides(ec, d.all->pairs[q])); q++);
+      if (q < p)
+        memcpy(x_dot_l, d.latent.begin() + 2 * rank * q, rank * sizeof(float));
+      else
+        latent_sums(weights, ec.feature_space[(int)i[0]], 0, x_dot_l, rank);
+      for (q = 0; q < p && (d.all->pairs[q][1] != i[1] || !both_sides(ec, d.all->pairs[q])); q++);
+      if (q < p)
+        memcpy(x_dot_r, d.latent.begin() + 2 * rank * q + rank, rank * sizeof(float));
+      else if (reuse_items)
+        item_sums(d, weights, (unsigned char)i[1], ec.feature_space[(int)i[1]], x_dot_r);
+      else
+        latent_sums(weights, ec.feature_space[(int)i[1]], rank, x_dot_r, rank);
+
+      for (size_t k = 0; k < rank; k++)
       {
-        // x_l * l^k
-        // l^k is from index+1 to index+d.rank
-        //float x_dot_l = sd_offset_add(weights, ec.atomics[(int)(*i)[0]].begin(), ec.atomics[(int)(*i)[0]].end(), k);
-        pred_offset x_dot_l = {0.,k};
-        GD::foreach_feature<pred_offset, offset_add, T>(weights, ec.feature_space[(int)i[0]], x_dot_l);
-        // x_r * r^k
-        // r^k is from index+d.rank+1 to index+2*d.rank
-        //float x_dot_r = sd_offset_add(weights, ec.atomics[(int)(*i)[1]].begin(), ec.atomics[(int)(*i)[1]].end(), k+d.rank);
-        pred_offset x_dot_r = {0.,k+d.rank};
-        GD::foreach_feature<pred_offset,offset_add, T>(weights, ec.feature_space[(int)i[1]], x_dot_r);
-
-        prediction += x_dot_l.p * x_dot_r.p;
+        prediction += x_dot_l[k] * x_dot_r[k];
 
         // store prediction from interaction terms
-        d.scalars.push_back(x_dot_l.p);
-        d.scalars.push_back(x_dot_r.p);
+        d.scalars.push_back(x_dot_l[k]);
+        d.scalars.push_back(x_dot_r[k]);
       }
     }
   }
@@ -180,6 +271,15 @@ void sd_offset_update(T& weights, features& fs, uint64_t offset, float update, f
     (&weights[fs.indicies[i]])[offset] += update * fs.values[i] - regularization * (&weights[fs.indicies[i]])[offset];
 }
 
+// the rank latent weights at offset+1..offset+rank of each feature in fs, with update[k - 1] for l^k
+// or r^k; every weight sees the same operations in the same order as rank separate passes would give
+template<class T>
+void latent_offset_update(T& weights, features& fs, uint64_t offset, const float* update, float regularization, size_t rank)
+{
+  for (size_t i = 0; i < fs.size(); i++)
+    latent_update(&weights[fs.indicies[i]] + offset + 1, update, fs.values[i], regularization, rank);
+}
+
 template<class T>
 void mf_train(gdmf& d, example& ec, T& weights)
 {
@@ -198,30 +298,29 @@ void mf_train(gdmf& d, example& ec, T& weights)
     sd_offset_update<T>(weights, fs, 0, update, regularization);
 
   // quadratic update
+  size_t rank = d.rank;
+  d.scaled_update.resize(2 * rank);
+  float* l_update = d.scaled_update.begin();
+  float* r_update = l_update + rank;
+  // like the per pair updates, these read the sums of the first pair with both sides present
+  for (size_t k = 1; k <= rank && 2*k < d.scalars.size(); k++)
+  {
+    // update * (r^k \cdot x_r)
+    l_update[k-1] = update * d.scalars[2*k];
+    // update * (l^k \cdot x_l)
+    r_update[k-1] = update * d.scalars[2*k-1];
+  }
   for (string& i : all.pairs)
   {
     if (ec.feature_space[(int)i[0]].size() > 0 && ec.feature_space[(int)i[1]].size() > 0)
     {
-
-      // update l^k weights
-      for (size_t k = 1; k <= d.rank; k++)
-      {
-        // r^k \cdot x_r
-        float r_dot_x = d.scalars[2*k];
-        // l^k <- l^k + update * (r^k \cdot x_r) * x_l
-        sd_offset_update<T>(weights, ec.feature_space[(int)i[0]], k, update*r_dot_x, regularization);
-      }
-      // update r^k weights
-      for (size_t k = 1; k <= d.rank; k++)
-      {
-        // l^k \cdot x_l
-        float l_dot_x = d.scalars[2*k-1];
-        // r^k <- r^k + update * (l^k \cdot x_l) * x_r
-        sd_offset_update<T>(weights, ec.feature_space[(int)i[1]], k+d.rank, update*l_dot_x, regularization);
-      }
-
+      // l^k <- l^k + update * (r^k \cdot x_r) * x_l
+      latent_offset_update<T>(weights, ec.feature_space[(int)i[0]], 0, l_update, regularization, rank);
+      // r^k <- r^k + update * (l^k \cdot x_l) * x_r
+      latent_offset_update<T>(weights, ec.feature_space[(int)i[1]], rank, r_update, regularization, rank);
     }
   }
+  d.generation++;
   if (all.triples.begin() != all.triples.end())
     THROW("cannot use triples in matrix factorization");
 }
@@ -252,6 +351,7 @@ void save_load(gdmf& d, io_buf& model_file, bool read, bool text)
   uint64_t length = (uint64_t)1 << all.num_bits;
   if(read)
   {
+    d.generation++;
     initialize_regressor(all);
     if (all.random_weights)
     {
@@ -304,6 +404,10 @@ void end_pass(gdmf& d)
 {
   vw* all = d.all;
 
+  // whatever runs between passes (a sync across nodes, a library caller)
+  // may rewrite the weights, so the item sums are recomputed after it
+  d.generation++;
+
   all->eta *= all->eta_decay_rate;
   if (all->save_per_pass)
     save_predictor(*all, all->final_regressor_name, all->current_pass);
@@ -330,7 +434,15 @@ void learn(gdmf& d, single_learner&, example& ec)
     mf_train(d, ec);
 }
 
-void finish(gdmf& d) { d.scalars.delete_v();}
+void finish(gdmf& d)
+{
+  d.scalars.delete_v();
+  d.latent.delete_v();
+  d.scaled_update.delete_v();
+  d.item_values.delete_v();
+  d.item_indices.delete_v();
+  d.item_sums.delete_v();
+}
 
 base_learner* gd_mf_setup(arguments& arg)
 {
@@ -131,9 +131,11 @@ void print_raw_text(int f, string s, v_array<char> tag)
 
 void set_mm(shared_data* sd, float label)
 {
-  sd->min_label = min(sd->min_label, label);
-  if (label != FLT_MAX)
-    sd->max_label = max(sd->max_label, label);
+  // only store on change: concurrent scoring calls this for unlabeled examples
+  if (label < sd->min_label)
+    sd->min_label = label;
+  if (label != FLT_MAX && label > sd->max_label)
+    sd->max_label = label;
 }
 
 void noop_mm(shared_data*, float) {}
@@ -281,6 +283,10 @@ vw::vw()
 
   l = nullptr;
   scorer = nullptr;
+  linear_scorer = false;
+  linear_cost_sensitive = false;
+  rank_top = 0;
+  all_action_scores = false;
   cost_sensitive = nullptr;
   loss = nullptr;
 
@@ -302,6 +308,15 @@ vw::vw()
   daemon = false;
   num_children = 10;
   save_resume = false;
+  dense_model = false;
+  save_threads = 1;
+  verify_dense_model = false;
+  background_save = false;
+  save_job = nullptr;
+  span_resume_pass = 0;
+  delta_checkpoint = false;
+  snapshot_state = 0;
+  snapshot_base = 0;
   preserve_performance_counters = false;
 
   random_positive_weights = false;
@@ -417,6 +417,7 @@ enum AllReduceType
 };
 
 class AllReduce;
+struct snapshot_writer;
 
 // avoid name clash
 namespace label_type
@@ -444,6 +445,10 @@ struct vw
 
   LEARNER::base_learner* l;//the top level learner
   LEARNER::single_learner* scorer;//a scoring function
+  bool linear_scorer; // the scorer sits directly on gd, so scores are dot products with the weights
+  bool linear_cost_sensitive; // csoaa sits directly on that scorer, so its predictions only read the weights
+  size_t rank_top; // ranking returns only this many of the best actions, 0 for all
+  bool all_action_scores; // a reduction reads the score of every action, so rank_top has to stay 0
   LEARNER::base_learner* cost_sensitive;//a cost sensitive learning algorithm.  can be single or multi line learner
 
   void learn(example&);
@@ -475,6 +480,16 @@ struct vw
   bool hessian_on;
 
   bool save_resume;
+  bool dense_model; // save the regressor as an aligned, mappable dense table
+  size_t save_threads; // threads used to write and read a dense table
+  bool verify_dense_model; // check a dense table's checksums when loading it
+  bool background_save; // write per pass/tagged snapshots from a background thread
+  snapshot_writer* save_job; // the outstanding background save, or nullptr
+  bool delta_checkpoint; // snapshots after the first only hold changed pages
+  std::vector<uint64_t> page_digests; // per page of weights, as of the last snapshot
+  uint64_t snapshot_state; // digest of the model besides its weights, as of the last snapshot
+  uint64_t snapshot_base; // digest of the weights the dirty pages are relative to
+  std::vector<uint64_t> dirty_pages; // pages changed since the snapshot before it
   bool preserve_performance_counters;
   std::string id;
 
@@ -583,6 +598,8 @@ struct vw
   time_t init_time;
 
   std::string final_regressor_name;
+  std::string span_checkpoint; // weights after the last cluster synchronization, for rejoining nodes
+  size_t span_resume_pass; // passes done by the --span_checkpoint this node rejoins from, 0 when not rejoining
 
   parameters weights;
 
@@ -196,6 +196,45 @@ public:
 
   virtual bool compressed() { return false; }
 
+  // Offset within the current file of the next byte to be read, or -1 when
+  // the input is not a seekable plain file (compressed, socket, pipe, memory).
+  int64_t read_offset()
+  { if (compressed() || current >= files.size())
+      return -1;
+    int64_t pos = file_position(files[current]);
+    return pos < 0 ? -1 : pos - (space.end() - head);
+  }
+
+  // Offset the next written byte will land at once the buffer is flushed.
+  virtual int64_t write_offset()
+  { if (compressed() || files.size() == 0)
+      return -1;
+    int64_t pos = file_position(files[0]);
+    return pos < 0 ? -1 : pos + (head - space.begin());
+  }
+
+  // Continue reading the current file at offset, dropping anything buffered.
+  void seek(int64_t offset)
+  {
+#ifdef _WIN32
+    if (_lseeki64(files[current], offset, SEEK_SET) < 0)
+#else
+    if (lseek(files[current], offset, SEEK_SET) < 0)
+#endif
+      THROWERRNO("seek in input file");
+    space.end() = space.begin();
+    head = space.begin();
+  }
+
+  static int64_t file_position(int f)
+  {
+#ifdef _WIN32
+    return _lseeki64(f, 0, SEEK_CUR);
+#else
+    return lseek(f, 0, SEEK_CUR);
+#endif
+  }
+
   static void close_file_or_socket(int f);
 
   void close_files()
@@ -28,6 +28,7 @@ license as described in the file LICENSE.
 #include "rand48.h"
 #include "floatbits.h"
 #include "reductions.h"
+#include "thread_pool.h"
 
 #define SVM_KER_LIN 0
 #define SVM_KER_RBF 1
@@ -43,6 +44,7 @@ struct svm_example
 {
   v_array<float> krow;
   flat_example ex;
+  uint64_t last_used; // params.clock when krow was last read, for evicting cold rows
 
   ~svm_example();
   void init_svm_example(flat_example *fec);
@@ -72,8 +74,13 @@ struct svm_params
   size_t reprocess;
 
   svm_model* model;
-  size_t maxcache;
+  size_t maxcache; // kernel values kept over all krow caches, from --kernel_cache
   //size_t curcache;
+  uint64_t clock;
+  size_t num_kernel_evals; // kernel values computed
+  size_t num_cache_evals;  // kernel values served from a krow cache
+
+  thread_pool* kernel_pool; // fills new krow entries, with --ksvm_threads
 
   svm_example** pool;
   float lambda;
@@ -89,8 +96,8 @@ struct svm_params
   vw* all;//flatten, parallel
 };
 
-static size_t num_kernel_evals = 0;
-static size_t num_cache_evals = 0;
+// Fewer new kernel values than this in one row are not worth waking the pool for.
+const size_t parallel_min_kernels = 64;
 
 void svm_example::init_svm_example(flat_example *fec)
 {
@@ -118,26 +125,35 @@ svm_example::compute_kernels(svm_params& params)
   int alloc = 0;
   svm_model *model = params.model;
   size_t n = model->num_support;
+  last_used = ++params.clock;
 
   if (krow.size() < n)
   {
     //computing new kernel values and caching them
-    //if(params->curcache + n > params->maxcache)
-    //trim_cache(params);
-    num_kernel_evals += krow.size();
-    //cerr<<"Kernels ";
-    for (size_t i=krow.size(); i<n; i++)
+    size_t cached = krow.size();
+    params.num_cache_evals += cached;
+    params.num_kernel_evals += n - cached;
+    if ((size_t)(krow.end_array - krow.begin()) < n)
+      krow.resize(max(n, 2 * (size_t)(krow.end_array - krow.begin()) + 3));
+    krow.end() = krow.begin() + n;
+    float* row = krow.begin();
+    auto fill = [this, &params, model, row](size_t begin, size_t end)
     {
-      svm_example *sec = model->support_vec[i];
-      float kv = kernel_function(&ex, &(sec->ex), params.kernel_params, params.kernel_type);
-      krow.push_back(kv);
-      alloc += 1;
-      //cerr<<kv<<" ";
+      for (size_t i = begin; i < end; i++)
+        row[i] = kernel_function(&ex, &(model->support_vec[i]->ex), params.kernel_params, params.kernel_type);
+    };
+    if (params.kernel_pool == nullptr || n - cached < parallel_min_kernels)
+      fill(cached, n);
+    else
+    {
+      size_t chunks = params.kernel_pool->size();
+      params.kernel_pool->parallel_for(chunks, [&fill, cached, n, chunks](size_t c)
+      { fill(cached + c * (n - cached) / chunks, cached + (c + 1) * (n - cached) / chunks); });
     }
-    //cerr<<endl;
+    alloc += (int)(n - cached);
   }
   else
-    num_cache_evals += n;
+    params.num_cache_evals += n;
   return alloc;
 }
 
@@ -197,19 +213,34 @@ make_hot_sv(svm_params& params, size_t svi)
   return alloc;
 }
 
+// Once the krow caches hold more than maxcache values, keep the most recently
+// read rows that fit and drop the rest; they are recomputed on the next read.
 static int
 trim_cache(svm_params& params)
 {
-  int sz = (int)params.maxcache;
   svm_model *model = params.model;
   size_t n = model->num_support;
-  int alloc = 0;
+  size_t cached = 0;
   for (size_t i=0; i<n; i++)
+    cached += model->support_vec[i]->krow.size();
+  if (cached <= params.maxcache)
+    return 0;
+
+  vector<svm_example*> by_use(model->support_vec.begin(), model->support_vec.begin() + n);
+  sort(by_use.begin(), by_use.end(), [](const svm_example* a, const svm_example* b)
+  { return a->last_used > b->last_used; });
+
+  size_t sz = params.maxcache;
+  int alloc = 0;
+  for (svm_example* e : by_use)
   {
-    svm_example *e = model->support_vec[i];
-    sz -= (int)e->krow.size();
-    if (sz < 0)
+    if (e->krow.size() <= sz)
+      sz -= e->krow.size();
+    else
+    {
+      sz = 0;
       alloc += e->clear_kernels();
+    }
   }
   return alloc;
 }
@@ -329,17 +360,74 @@ void save_load(svm_params& params, io_buf& model_file, bool read, bool text)
 
 }
 
-float linear_kernel(const flat_example* fec1, const flat_example* fec2)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_AVX2_SPARSE_DOT
+
+// Intersect the sorted index lists four entries at a time: every index of a
+// block of fec1 is compared against each rotation of a block of fec2, and the
+// block with the smaller last index moves on.  Matches come out in index order
+// and are added one at a time, so the sum is the one the scalar merge gives.
+// Stops where fewer than four entries are left on one side, or at a block
+// pair where an index repeats, which is left to merge_sparse_dot.
+__attribute__((target("avx2")))
+void avx2_sparse_dot(features& fs_1, features& fs_2, size_t& idx1, size_t& idx2, float& dotprod)
 {
-  float dotprod = 0;
+  const feature_index* i1 = fs_1.indicies.begin();
+  const feature_index* i2 = fs_2.indicies.begin();
+  const feature_value* v1 = fs_1.values.begin();
+  const feature_value* v2 = fs_2.values.begin();
+  size_t n1 = fs_1.size(), n2 = fs_2.size();
 
-  features& fs_1 = (features&)fec1->fs;
-  features& fs_2 = (features&)fec2->fs;
-  if (fs_2.indicies.size() == 0)
-    return 0.f;
+  while (idx1 + 4 <= n1 && idx2 + 4 <= n2)
+  {
+    __m256i a = _mm256_loadu_si256((const __m256i*)(i1 + idx1));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(i2 + idx2));
+    __m128 b_values = _mm_loadu_ps(v2 + idx2);
+    __m128 matched = _mm_setzero_ps();
+    __m128 found = _mm_setzero_ps();
+    __m128 repeated = _mm_setzero_ps();
+    for (int r = 0; r < 4; r++)
+    {
+      __m256i eq = _mm256_cmpeq_epi64(a, b);
+      // One 32 bit mask per 64 bit index lane.
+      __m128 mask = _mm_shuffle_ps(_mm_castsi128_ps(_mm256_castsi256_si128(eq)),
+                                   _mm_castsi128_ps(_mm256_extracti128_si256(eq, 1)), _MM_SHUFFLE(2, 0, 2, 0));
+      matched = _mm_or_ps(matched, _mm_and_ps(mask, b_values));
+      repeated = _mm_or_ps(repeated, _mm_and_ps(found, mask));
+      found = _mm_or_ps(found, mask);
+      b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(0, 3, 2, 1));
+      b_values = _mm_shuffle_ps(b_values, b_values, _MM_SHUFFLE(0, 3, 2, 1));
+    }
 
-  int numint = 0;
-  for (size_t idx1 = 0, idx2 = 0; idx1 < fs_1.size() && idx2 < fs_2.size() ; idx1++)
+    if (_mm_movemask_ps(repeated) != 0)
+      return;
+    int hits = _mm_movemask_ps(found);
+    if (hits != 0)
+    {
+      float products[4];
+      _mm_storeu_ps(products, _mm_mul_ps(_mm_loadu_ps(v1 + idx1), matched));
+      for (int k = 0; k < 4; k++)
+        if (hits & (1 << k))
+          dotprod += products[k];
+    }
+
+    feature_index last1 = i1[idx1 + 3], last2 = i2[idx2 + 3];
+    if (last1 <= last2)
+      idx1 += 4;
+    if (last2 <= last1)
+      idx2 += 4;
+  }
+}
+
+static const bool have_avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+#endif
+
+// Merges the sorted index lists from idx1/idx2 until idx1 reaches stop1,
+// adding the products of matching entries to dotprod.
+void merge_sparse_dot(features& fs_1, features& fs_2, size_t& idx1, size_t& idx2, size_t stop1, float& dotprod)
+{
+  for (; idx1 < stop1 && idx2 < fs_2.size() ; idx1++)
   {
     uint64_t ec1pos = fs_1.indicies[idx1];
     uint64_t ec2pos = fs_2.indicies[idx2];
@@ -352,13 +440,32 @@ float linear_kernel(const flat_example* fec1, const flat_example* fec2)
     if(ec1pos == ec2pos)
     {
       //params.all->opts_n_args.trace_message<<ec1pos<<" "<<ec2pos<<" "<<idx1<<" "<<idx2<<" "<<f->x<<" "<<ec2f->x<<endl;
-      numint++;
       dotprod += fs_1.values[idx1] * fs_2.values[idx2];
       ++idx2;
     }
   }
-  //params.all->opts_n_args.trace_message<<endl;
-  //params.all->opts_n_args.trace_message<<"numint = "<<numint<<" dotprod = "<<dotprod<<endl;
+}
+
+float linear_kernel(const flat_example* fec1, const flat_example* fec2)
+{
+  float dotprod = 0;
+
+  features& fs_1 = (features&)fec1->fs;
+  features& fs_2 = (features&)fec2->fs;
+  if (fs_2.indicies.size() == 0)
+    return 0.f;
+
+  size_t idx1 = 0, idx2 = 0;
+#ifdef HAVE_AVX2_SPARSE_DOT
+  if (have_avx2)
+  {
+    // collision_cleanup can leave the first index repeated, which the blocks
+    // cannot pair up, so the head always goes through the merge.
+    merge_sparse_dot(fs_1, fs_2, idx1, idx2, min(fs_1.size(), (size_t)2), dotprod);
+    avx2_sparse_dot(fs_1, fs_2, idx1, idx2, dotprod);
+  }
+#endif
+  merge_sparse_dot(fs_1, fs_2, idx1, idx2, fs_1.size(), dotprod);
   return dotprod;
 }
 
@@ -804,7 +911,7 @@ void learn(svm_params& params, single_learner&, example& ec)
     if(params.all->training && ec.example_counter % 1000 == 0 && ec.example_counter >= 2)
     {
       params.all->trace_message<<"Number of support vectors = "<<params.model->num_support<<endl;
-      params.all->trace_message<<"Number of kernel evaluations = "<<num_kernel_evals<<" "<<"Number of cache queries = "<<num_cache_evals<<" loss sum = "<<params.loss_sum<<" "<<params.model->alpha[params.model->num_support-1]<<" "<<params.model->alpha[params.model->num_support-2]<<endl;
+      params.all->trace_message<<"Number of kernel evaluations = "<<params.num_kernel_evals<<" "<<"Number of cache queries = "<<params.num_cache_evals<<" loss sum = "<<params.loss_sum<<" "<<params.model->alpha[params.model->num_support-1]<<" "<<params.model->alpha[params.model->num_support-2]<<endl;
     }
     params.pool[params.pool_pos] = sec;
     params.pool_pos++;
@@ -845,10 +952,11 @@ void finish(svm_params& params)
   free(params.pool);
 
   params.all->trace_message<<"Num support = "<<params.model->num_support<<endl;
-  params.all->trace_message<<"Number of kernel evaluations = "<<num_kernel_evals<<" "<<"Number of cache queries = "<<num_cache_evals<<endl;
+  params.all->trace_message<<"Number of kernel evaluations = "<<params.num_kernel_evals<<" "<<"Number of cache queries = "<<params.num_cache_evals<<endl;
   params.all->trace_message<<"Total loss = "<<params.loss_sum<<endl;
 
   free_svm_model(params.model);
+  delete params.kernel_pool;
   params.all->trace_message<<"Done freeing model"<<endl;
   if(params.kernel_params) free(params.kernel_params);
   params.all->trace_message<<"Done freeing kernel params"<<endl;
@@ -861,6 +969,8 @@ LEARNER::base_learner* kernel_svm_setup(arguments& arg)
   std::string kernel_type;
   float bandwidth=1.f;
   int degree = 2;
+  size_t cache_mb;
+  size_t threads;
   if (arg.new_options("Kernel SVM").critical("ksvm", "kernel svm")
       ("reprocess", params->reprocess, (size_t)1, "number of reprocess steps for LASVM")
       (params->active_pool_greedy, "pool_greedy", "use greedy selection on mini pools")
@@ -869,7 +979,9 @@ LEARNER::base_learner* kernel_svm_setup(arguments& arg)
       ("subsample", params->subsample, (size_t)1, "number of items to subsample from the pool")
       .keep("kernel", kernel_type, (string)"linear", "type of kernel (rbf or linear (default))")
       .keep("bandwidth", bandwidth, 1.f, "bandwidth of rbf kernel")
-      .keep("degree", degree, 2, "degree of poly kernel").missing())
+      .keep("degree", degree, 2, "degree of poly kernel")
+      ("kernel_cache", cache_mb, (size_t)4096, "megabytes of kernel values cached across support vectors")
+      ("ksvm_threads", threads, (size_t)1, "compute new kernel values on this many threads").missing())
       //.keep("lambda", params->lambda, "saving regularization for test time").missing())
     return nullptr;
 
@@ -880,7 +992,9 @@ LEARNER::base_learner* kernel_svm_setup(arguments& arg)
 
   params->model = &calloc_or_throw<svm_model>();
   params->model->num_support = 0;
-  params->maxcache = 1024*1024*1024;
+  params->maxcache = cache_mb*1024*1024/sizeof(float);
+  if (threads > 1)
+    params->kernel_pool = new thread_pool(threads);
   params->loss_sum = 0.;
   params->all = arg.all;
 
@@ -3,6 +3,7 @@ namespace LabelDict
 {
 typedef v_hashmap< size_t, features > label_feature_map;
 inline bool size_t_eq(const size_t &a, const size_t &b) { return (a==b); }
+size_t hash_lab(size_t lab);
 
 void add_example_namespace(example& ec, char ns, features& fs);
 void del_example_namespace(example& ec, char ns, features& fs);
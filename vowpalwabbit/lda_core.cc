@@ -33,6 +33,7 @@ license as described in the file LICENSE.
 #include "rand48.h"
 #include "reductions.h"
 #include "array_parameters.h"
+#include "thread_pool.h"
 #include <boost/version.hpp>
 
 #if BOOST_VERSION >= 105600
@@ -50,6 +51,14 @@ public:
   bool operator<(const index_feature b) const { return f.weight_index < b.f.weight_index; }
 };
 
+// Working space for the per-document loop, one per thread.
+struct lda_scratch
+{
+  v_array<float> new_gamma;
+  v_array<float> old_gamma;
+  v_array<float> Elogtheta;
+};
+
 struct lda
 {
   size_t topics;
@@ -60,7 +69,7 @@ struct lda
   size_t minibatch;
   lda_math_mode mmode;
 
-  v_array<float> Elogtheta;
+  v_array<lda_scratch> scratch;
   v_array<float> decay_levels;
   v_array<float> total_new;
   v_array<example *> examples;
@@ -69,6 +78,9 @@ struct lda
   v_array<float> digammas;
   v_array<float> v;
   std::vector<index_feature> sorted_features;
+  v_array<float> scores;
+  v_array<float> partial_new; // per chunk total_new when the minibatch is split across threads
+  thread_pool* pool;          // with --lda_threads
 
   bool compute_coherence_metrics;
 
@@ -292,6 +304,197 @@ inline v4sf vfastdigamma(v4sf x)
          logterm;
 }
 
+
+// Wider AVX2 and AVX-512 versions of the kernels above.  The binary is built
+// for SSE2 only, so these are compiled with per-function target attributes
+// and picked at runtime from what the CPU supports.  Each lane does exactly
+// the arithmetic of the 4-wide kernels; AVX-512 would otherwise let the
+// compiler fuse multiply-adds, so contraction is turned off there.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(VW_NO_WIDE_SIMD)
+
+#include <immintrin.h>
+
+#define HAVE_WIDE_SIMD_MATHMODE
+#define VW_TARGET_AVX2 __attribute__((target("avx2")))
+#define VW_TARGET_AVX512 __attribute__((target("avx512f"), optimize("fp-contract=off")))
+
+typedef __m256 v8sf;
+typedef __m512 v16sf;
+
+VW_TARGET_AVX2 inline v8sf v8sfl(const float x) { return _mm256_set1_ps(x); }
+
+VW_TARGET_AVX2 inline v8sf vfastpow2(const v8sf p)
+{
+  v8sf ltzero = _mm256_cmp_ps(p, v8sfl(0.0f), _CMP_LT_OQ);
+  v8sf offset = _mm256_and_ps(ltzero, v8sfl(1.0f));
+  v8sf lt126 = _mm256_cmp_ps(p, v8sfl(-126.0f), _CMP_LT_OQ);
+  v8sf clipp = _mm256_andnot_ps(lt126, p) + _mm256_and_ps(lt126, v8sfl(-126.0f));
+  __m256i w = _mm256_cvttps_epi32(clipp);
+  v8sf z = clipp - _mm256_cvtepi32_ps(w) + offset;
+
+  v8sf v = v8sfl(1 << 23) * (clipp + v8sfl(121.2740838f) + v8sfl(27.7280233f) / (v8sfl(4.84252568f) - z) -
+                            v8sfl(1.49012907f) * z);
+
+  return _mm256_castsi256_ps(_mm256_cvttps_epi32(v));
+}
+
+VW_TARGET_AVX2 inline v8sf vfastexp(const v8sf p) { return vfastpow2(v8sfl(1.442695040f) * p); }
+
+VW_TARGET_AVX2 inline v8sf vfastlog(v8sf x)
+{
+  __m256i vx_i = _mm256_castps_si256(x);
+  v8sf mx_f = _mm256_castsi256_ps(
+      _mm256_or_si256(_mm256_and_si256(vx_i, _mm256_set1_epi32(0x007FFFFF)), _mm256_set1_epi32(0x3f000000)));
+  v8sf y = _mm256_cvtepi32_ps(vx_i) * v8sfl(1.1920928955078125e-7f);
+
+  return v8sfl(0.69314718f) *
+         (y - v8sfl(124.22551499f) - v8sfl(1.498030302f) * mx_f - v8sfl(1.72587999f) / (v8sfl(0.3520887068f) + mx_f));
+}
+
+VW_TARGET_AVX2 inline v8sf vfastdigamma(v8sf x)
+{
+  v8sf twopx = v8sfl(2.0f) + x;
+  v8sf logterm = vfastlog(twopx);
+
+  return (v8sfl(-48.0f) + x * (v8sfl(-157.0f) + x * (v8sfl(-127.0f) - v8sfl(30.0f) * x))) /
+         (v8sfl(12.0f) * x * (v8sfl(1.0f) + x) * twopx * twopx) +
+         logterm;
+}
+
+VW_TARGET_AVX512 inline v16sf v16sfl(const float x) { return _mm512_set1_ps(x); }
+
+VW_TARGET_AVX512 inline v16sf vfastpow2(const v16sf p)
+{
+  __mmask16 ltzero = _mm512_cmp_ps_mask(p, v16sfl(0.0f), _CMP_LT_OQ);
+  v16sf offset = _mm512_maskz_mov_ps(ltzero, v16sfl(1.0f));
+  __mmask16 lt126 = _mm512_cmp_ps_mask(p, v16sfl(-126.0f), _CMP_LT_OQ);
+  v16sf clipp = _mm512_mask_blend_ps(lt126, p, v16sfl(-126.0f));
+  __m512i w = _mm512_cvttps_epi32(clipp);
+  v16sf z = clipp - _mm512_cvtepi32_ps(w) + offset;
+
+  v16sf v = v16sfl(1 << 23) * (clipp + v16sfl(121.2740838f) + v16sfl(27.7280233f) / (v16sfl(4.84252568f) - z) -
+                              v16sfl(1.49012907f) * z);
+
+  return _mm512_castsi512_ps(_mm512_cvttps_epi32(v));
+}
+
+VW_TARGET_AVX512 inline v16sf vfastexp(const v16sf p) { return vfastpow2(v16sfl(1.442695040f) * p); }
+
+VW_TARGET_AVX512 inline v16sf vfastlog(v16sf x)
+{
+  __m512i vx_i = _mm512_castps_si512(x);
+  v16sf mx_f = _mm512_castsi512_ps(
+      _mm512_or_si512(_mm512_and_si512(vx_i, _mm512_set1_epi32(0x007FFFFF)), _mm512_set1_epi32(0x3f000000)));
+  v16sf y = _mm512_cvtepi32_ps(vx_i) * v16sfl(1.1920928955078125e-7f);
+
+  return v16sfl(0.69314718f) * (y - v16sfl(124.22551499f) - v16sfl(1.498030302f) * mx_f -
+                                v16sfl(1.72587999f) / (v16sfl(0.3520887068f) + mx_f));
+}
+
+VW_TARGET_AVX512 inline v16sf vfastdigamma(v16sf x)
+{
+  v16sf twopx = v16sfl(2.0f) + x;
+  v16sf logterm = vfastlog(twopx);
+
+  return (v16sfl(-48.0f) + x * (v16sfl(-157.0f) + x * (v16sfl(-127.0f) - v16sfl(30.0f) * x))) /
+         (v16sfl(12.0f) * x * (v16sfl(1.0f) + x) * twopx * twopx) +
+         logterm;
+}
+
+// Each kernel runs from fp while a whole vector still fits strictly before
+// fpend, the same stopping rule as the SSE loops, and returns where it stopped
+// so that the caller finishes with the 4-wide and scalar loops.  Sums are
+// folded into the 4-wide accumulator in the order the SSE loop would add
+// them, so the results do not depend on which kernel ran.
+struct wide_kernels
+{
+  float* (*digamma_sum)(float* fp, const float* fpend, v4sf& sum);
+  float* (*exp_shifted)(float* fp, const float* fpend, float shift, float threshold);
+  float* (*expdigamma_norm)(float* fp, const float*& np, const float* fpend, float threshold);
+};
+
+VW_TARGET_AVX2 float* avx2_digamma_sum(float* fp, const float* fpend, v4sf& sum)
+{
+  for (; fp + 8 < fpend; fp += 8)
+  {
+    v8sf arg = _mm256_loadu_ps(fp);
+    sum = _mm_add_ps(_mm_add_ps(sum, _mm256_castps256_ps128(arg)), _mm256_extractf128_ps(arg, 1));
+    _mm256_storeu_ps(fp, vfastdigamma(arg));
+  }
+  return fp;
+}
+
+VW_TARGET_AVX2 float* avx2_exp_shifted(float* fp, const float* fpend, float shift, float threshold)
+{
+  for (; fp + 8 < fpend; fp += 8)
+  {
+    v8sf arg = vfastexp(_mm256_loadu_ps(fp) - v8sfl(shift));
+    _mm256_storeu_ps(fp, _mm256_max_ps(v8sfl(threshold), arg));
+  }
+  return fp;
+}
+
+VW_TARGET_AVX2 float* avx2_expdigamma_norm(float* fp, const float*& np, const float* fpend, float threshold)
+{
+  for (; fp + 8 < fpend; fp += 8, np += 8)
+  {
+    v8sf arg = vfastexp(vfastdigamma(_mm256_loadu_ps(fp)) - _mm256_loadu_ps(np));
+    _mm256_storeu_ps(fp, _mm256_max_ps(v8sfl(threshold), arg));
+  }
+  return fp;
+}
+
+VW_TARGET_AVX512 float* avx512_digamma_sum(float* fp, const float* fpend, v4sf& sum)
+{
+  for (; fp + 16 < fpend; fp += 16)
+  {
+    v16sf arg = _mm512_loadu_ps(fp);
+    sum = _mm_add_ps(sum, _mm512_extractf32x4_ps(arg, 0));
+    sum = _mm_add_ps(sum, _mm512_extractf32x4_ps(arg, 1));
+    sum = _mm_add_ps(sum, _mm512_extractf32x4_ps(arg, 2));
+    sum = _mm_add_ps(sum, _mm512_extractf32x4_ps(arg, 3));
+    _mm512_storeu_ps(fp, vfastdigamma(arg));
+  }
+  return fp;
+}
+
+VW_TARGET_AVX512 float* avx512_exp_shifted(float* fp, const float* fpend, float shift, float threshold)
+{
+  for (; fp + 16 < fpend; fp += 16)
+  {
+    v16sf arg = vfastexp(_mm512_loadu_ps(fp) - v16sfl(shift));
+    _mm512_storeu_ps(fp, _mm512_max_ps(v16sfl(threshold), arg));
+  }
+  return fp;
+}
+
+VW_TARGET_AVX512 float* avx512_expdigamma_norm(float* fp, const float*& np, const float* fpend, float threshold)
+{
+  for (; fp + 16 < fpend; fp += 16, np += 16)
+  {
+    v16sf arg = vfastexp(vfastdigamma(_mm512_loadu_ps(fp)) - _mm512_loadu_ps(np));
+    _mm512_storeu_ps(fp, _mm512_max_ps(v16sfl(threshold), arg));
+  }
+  return fp;
+}
+
+const wide_kernels* pick_wide_kernels()
+{
+  static const wide_kernels avx512 = {avx512_digamma_sum, avx512_exp_shifted, avx512_expdigamma_norm};
+  static const wide_kernels avx2 = {avx2_digamma_sum, avx2_exp_shifted, avx2_expdigamma_norm};
+
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return &avx512;
+  if (__builtin_cpu_supports("avx2"))
+    return &avx2;
+  return nullptr;
+}
+
+// nullptr when the CPU has neither, which leaves the SSE loops to do all the work.
+const wide_kernels* const wide_simd = pick_wide_kernels();
+
+#endif
 void vexpdigammify(vw &all, float *gamma, const float underflow_threshold)
 {
   float extra_sum = 0.0f;
@@ -307,6 +510,11 @@ void vexpdigammify(vw &all, float *gamma, const float underflow_threshold)
     *fp = fastdigamma(*fp);
   }
 
+#if defined(HAVE_WIDE_SIMD_MATHMODE)
+  if (wide_simd != nullptr && is_aligned16(fp))
+    fp = wide_simd->digamma_sum(fp, fpend, sum);
+#endif
+
   // Rip through the aligned portion...
   for (; is_aligned16(fp) && fp + 4 < fpend; fp += 4)
   {
@@ -339,6 +547,11 @@ void vexpdigammify(vw &all, float *gamma, const float underflow_threshold)
     *fp = fmax(underflow_threshold, fastexp(*fp - extra_sum));
   }
 
+#if defined(HAVE_WIDE_SIMD_MATHMODE)
+  if (wide_simd != nullptr && is_aligned16(fp))
+    fp = wide_simd->exp_shifted(fp, fpend, extra_sum, underflow_threshold);
+#endif
+
   for (; is_aligned16(fp) && fp + 4 < fpend; fp += 4)
   {
     v4sf arg = _mm_load_ps(fp);
@@ -363,6 +576,11 @@ void vexpdigammify_2(vw &all, float* gamma, const float *norm, const float under
   for (np = norm; fp < fpend && !is_aligned16(fp); ++fp, ++np)
     *fp = fmax(underflow_threshold, fastexp(fastdigamma(*fp) - *np));
 
+#if defined(HAVE_WIDE_SIMD_MATHMODE)
+  if (wide_simd != nullptr && is_aligned16(fp))
+    fp = wide_simd->expdigamma_norm(fp, np, fpend, underflow_threshold);
+#endif
+
   for (; is_aligned16(fp) && fp + 4 < fpend; fp += 4, np += 4)
   {
     v4sf arg = _mm_load_ps(fp);
@@ -622,21 +840,16 @@ float theta_kl(lda &l, v_array<float> &Elogtheta, float *gamma)
 static inline float find_cw(lda &l, float* u_for_w, float *v)
 { return 1.0f / std::inner_product(u_for_w, u_for_w + l.topics, v, 0.0f); }
 
-namespace
-{
-// Effectively, these are static and not visible outside the compilation unit.
-v_array<float> new_gamma = v_init<float>();
-v_array<float> old_gamma = v_init<float>();
-}
-
 // Returns an estimate of the part of the variational bound that
 // doesn't have to do with beta for the entire corpus for the current
 // setting of lambda based on the document passed in. The value is
 // divided by the total number of words in the document This can be
 // used as a (possibly very noisy) estimate of held-out likelihood.
-float lda_loop(lda &l, v_array<float> &Elogtheta, float *v, example *ec, float)
+float lda_loop(lda &l, lda_scratch &scratch, float *v, example *ec)
 {
   parameters& weights = l.all->weights;
+  v_array<float>& new_gamma = scratch.new_gamma;
+  v_array<float>& old_gamma = scratch.old_gamma;
   new_gamma.clear();
   old_gamma.clear();
 
@@ -688,7 +901,7 @@ float lda_loop(lda &l, v_array<float> &Elogtheta, float *v, example *ec, float)
   memcpy(ec->pred.scalars.begin(), new_gamma.begin(), l.topics * sizeof(float));
   ec->pred.scalars.end() = ec->pred.scalars.begin() + l.topics;
 
-  score += theta_kl(l, Elogtheta, new_gamma.begin());
+  score += theta_kl(l, scratch.Elogtheta, new_gamma.begin());
 
   return score / doc_length;
 }
@@ -733,6 +946,9 @@ public:
   }
 };
 
+// Scale of the random initial topic weights.
+inline float initial_scale(lda &l) { return (float)(l.lda_D / l.all->lda / l.all->length() * 200); }
+
 void save_load(lda &l, io_buf &model_file, bool read, bool text)
 {
   vw& all = *(l.all);
@@ -740,7 +956,7 @@ void save_load(lda &l, io_buf &model_file, bool read, bool text)
   if (read)
   {
     initialize_regressor(all);
-    initial_weights init(all.initial_t, (float)(l.lda_D / all.lda / all.length() * 200), all.random_weights, all.lda, all.weights.stride());
+    initial_weights init(all.initial_t, initial_scale(l), all.random_weights, all.lda, all.weights.stride());
     if (all.weights.sparse)
       all.weights.sparse_weights.set_default<initial_weights, set_initial_lda_wrapper<sparse_parameters> >(init);
     else
@@ -756,6 +972,15 @@ void save_load(lda &l, io_buf &model_file, bool read, bool text)
     {
       brw = 0;
       size_t K = all.lda;
+      // Words a sparse table never saw still hold their initial weights, which
+      // a load recreates, so they are left out.
+      if (!read && all.weights.sparse)
+      {
+        while (i < length && !all.weights.sparse_weights.exists(i << all.weights.stride_shift()))
+          i++;
+        if (i == length)
+          break;
+      }
       if (!read && text)
         msg << i << " ";
 
@@ -805,6 +1030,109 @@ void return_example(vw& all, example& ec)
   VW::finish_example(all,ec);
 }
 
+// Sum the topic weights over the vocabulary.  A sparse table only holds the
+// words seen so far; every other word still has its random initial weight,
+// so it is counted at the expected value of that weight instead of being
+// created just to be read.
+template <class T>
+void init_total_lambda(lda &l, T &weights)
+{
+  for (size_t k = 0; k < l.all->lda; k++)
+    l.total_lambda.push_back(0.f);
+
+  uint64_t rows = 0;
+  for (typename T::iterator iter = weights.begin(); iter != weights.end(); ++iter, ++rows)
+  {
+    weight* w = &(*iter);
+    for (size_t k = 0; k < l.all->lda; k++)
+      l.total_lambda[k] += w[k];
+  }
+
+  if (rows < l.all->length() && l.all->random_weights)
+  {
+    // E[-log(U) + 1] = 2 for U uniform on [0, 1).
+    float unseen = (float)(l.all->length() - rows) * 2.f * initial_scale(l);
+    for (size_t k = 0; k < l.all->lda; k++)
+      l.total_lambda[k] += unseen;
+  }
+}
+
+// Start of the c'th of n ranges of sorted_features, moved forward so that
+// all occurrences of a word fall in one range and ranges can be updated
+// concurrently.
+size_t word_boundary(lda &l, size_t c, size_t n)
+{
+  size_t size = l.sorted_features.size();
+  size_t i = c * size / n;
+  while (i > 0 && i < size && l.sorted_features[i].f.weight_index == l.sorted_features[i - 1].f.weight_index)
+    i++;
+  return i;
+}
+
+// Bring the words in sorted_features[begin, end) up to date with the decay of
+// the skipped minibatches and compute their expected topic weights.
+void decay_words(lda &l, size_t begin, size_t end)
+{
+  parameters& weights = l.all->weights;
+  uint64_t last_weight_index = -1;
+  for (index_feature *s = l.sorted_features.data() + begin; s < l.sorted_features.data() + end; s++)
+  {
+    if (last_weight_index == s->f.weight_index)
+      continue;
+    last_weight_index = s->f.weight_index;
+    //float *weights_for_w = &(weights[s->f.weight_index]);
+    float* weights_for_w = &(weights[s->f.weight_index & weights.mask()]);
+    float decay_component =
+      l.decay_levels.end()[-2] - l.decay_levels.end()[(int)(-1 - l.example_t + *(weights_for_w + l.all->lda))];
+    float decay = fmin(1.0f, correctedExp(decay_component));
+    float* u_for_w = weights_for_w + l.all->lda + 1;
+
+    *(weights_for_w + l.all->lda) = (float)l.example_t;
+    for (size_t k = 0; k < l.all->lda; k++)
+    {
+      weights_for_w[k] *= decay;
+      u_for_w[k] = weights_for_w[k] + l.lda_rho;
+    }
+
+    l.expdigammify_2(*l.all, u_for_w, l.digammas.begin());
+  }
+}
+
+// Update lambda for the words in sorted_features[begin, end), adding the
+// new sufficient statistics to total_new.
+void update_words(lda &l, size_t begin, size_t end, float eta, float minuseta, float *total_new)
+{
+  parameters& weights = l.all->weights;
+  index_feature *last = l.sorted_features.data() + end;
+  for (index_feature *s = l.sorted_features.data() + begin; s < last;)
+  {
+    index_feature *next = s + 1;
+    while (next < last && next->f.weight_index == s->f.weight_index)
+      next++;
+
+    float* word_weights = &(weights[s->f.weight_index]);
+    for (size_t k = 0; k < l.all->lda; k++, ++word_weights)
+    {
+      float new_value = minuseta * *word_weights;
+      *word_weights = new_value;
+    }
+
+    for (; s != next; s++)
+    {
+      float *v_s = &(l.v[s->document * l.all->lda]);
+      float* u_for_w = &(weights[s->f.weight_index]) + l.all->lda + 1;
+      float c_w = eta * find_cw(l, u_for_w, v_s) * s->f.x;
+      word_weights = &(weights[s->f.weight_index]);
+      for (size_t k = 0; k < l.all->lda; k++, ++u_for_w, ++word_weights)
+      {
+        float new_value = *u_for_w * v_s[k] * c_w;
+        total_new[k] += new_value;
+        *word_weights += new_value;
+      }
+    }
+  }
+}
+
 void learn_batch(lda &l)
 {
   parameters& weights = l.all->weights;
@@ -834,16 +1162,10 @@ void learn_batch(lda &l)
 
   if (l.total_lambda.size() == 0)
   {
-    for (size_t k = 0; k < l.all->lda; k++)
-      l.total_lambda.push_back(0.f);
-    //This part does not work with sparse parameters
-    size_t stride = weights.stride();
-    for (size_t i = 0; i <= weights.mask(); i += stride)
-    {
-      weight* w = &(weights[i]);
-      for (size_t k = 0; k < l.all->lda; k++)
-        l.total_lambda[k] += w[k];
-    }
+    if (weights.sparse)
+      init_total_lambda(l, weights.sparse_weights);
+    else
+      init_total_lambda(l, weights.dense_weights);
   }
 
   l.example_t++;
@@ -865,32 +1187,32 @@ void learn_batch(lda &l)
   for (size_t i = 0; i < l.all->lda; i++)
     l.digammas.push_back(l.digamma(l.total_lambda[i] + additional));
 
-  uint64_t last_weight_index = -1;
-  for (index_feature *s = &l.sorted_features[0]; s <= &l.sorted_features.back(); s++)
-  {
-    if (last_weight_index == s->f.weight_index)
-      continue;
-    last_weight_index = s->f.weight_index;
-    //float *weights_for_w = &(weights[s->f.weight_index]);
-    float* weights_for_w = &(weights[s->f.weight_index & weights.mask()]);
-    float decay_component =
-      l.decay_levels.end()[-2] - l.decay_levels.end()[(int)(-1 - l.example_t + *(weights_for_w + l.all->lda))];
-    float decay = fmin(1.0f, correctedExp(decay_component));
-    float* u_for_w = weights_for_w + l.all->lda + 1;
+  size_t chunks = 1;
+  if (l.pool != nullptr && !weights.sparse)
+    chunks = min(l.pool->size(), batch_size);
 
-    *(weights_for_w + l.all->lda) = (float)l.example_t;
-    for (size_t k = 0; k < l.all->lda; k++)
+  if (chunks == 1)
+    decay_words(l, 0, l.sorted_features.size());
+  else
+    l.pool->parallel_for(chunks, [&l, chunks](size_t c)
+    { decay_words(l, word_boundary(l, c, chunks), word_boundary(l, c + 1, chunks)); });
+
+  l.scores.clear();
+  l.scores.resize(batch_size);
+  l.scores.end() = l.scores.begin() + batch_size;
+  if (chunks == 1)
+    for (size_t d = 0; d < batch_size; d++)
+      l.scores[d] = lda_loop(l, l.scratch[0], &(l.v[d * l.all->lda]), l.examples[d]);
+  else
+    l.pool->parallel_for(chunks, [&l, batch_size, chunks](size_t c)
     {
-      weights_for_w[k] *= decay;
-      u_for_w[k] = weights_for_w[k] + l.lda_rho;
-    }
-
-    l.expdigammify_2(*l.all, u_for_w, l.digammas.begin());
-  }
+      for (size_t d = c * batch_size / chunks; d < (c + 1) * batch_size / chunks; d++)
+        l.scores[d] = lda_loop(l, l.scratch[c], &(l.v[d * l.all->lda]), l.examples[d]);
+    });
 
   for (size_t d = 0; d < batch_size; d++)
   {
-    float score = lda_loop(l, l.Elogtheta, &(l.v[d * l.all->lda]), l.examples[d], l.all->power_t);
+    float score = l.scores[d];
     if (l.all->audit)
       GD::print_audit_features(*l.all, *l.examples[d]);
     // If the doc is empty, give it loss of 0.
@@ -905,32 +1227,23 @@ void learn_batch(lda &l)
   // -t there's no need to update weights (especially since it's a noop)
   if (eta != 0)
   {
-    for (index_feature *s = &l.sorted_features[0]; s <= &l.sorted_features.back();)
+    if (chunks == 1)
+      update_words(l, 0, l.sorted_features.size(), eta, minuseta, l.total_new.begin());
+    else
     {
-      index_feature *next = s + 1;
-      while (next <= &l.sorted_features.back() && next->f.weight_index == s->f.weight_index)
-        next++;
-
-      float* word_weights = &(weights[s->f.weight_index]);
-      for (size_t k = 0; k < l.all->lda; k++, ++word_weights)
-      {
-        float new_value = minuseta * *word_weights;
-        *word_weights = new_value;
-      }
-
-      for (; s != next; s++)
+      // Each chunk collects its own sufficient statistics, merged in chunk order.
+      l.partial_new.clear();
+      l.partial_new.resize(chunks * l.all->lda);
+      l.partial_new.end() = l.partial_new.begin() + chunks * l.all->lda;
+      memset(l.partial_new.begin(), 0, chunks * l.all->lda * sizeof(float));
+      l.pool->parallel_for(chunks, [&l, chunks, eta, minuseta](size_t c)
       {
-        float *v_s = &(l.v[s->document * l.all->lda]);
-        float* u_for_w = &(weights[s->f.weight_index]) + l.all->lda + 1;
-        float c_w = eta * find_cw(l, u_for_w, v_s) * s->f.x;
-        word_weights = &(weights[s->f.weight_index]);
-        for (size_t k = 0; k < l.all->lda; k++, ++u_for_w, ++word_weights)
-        {
-          float new_value = *u_for_w * v_s[k] * c_w;
-          l.total_new[k] += new_value;
-          *word_weights += new_value;
-        }
-      }
+        update_words(l, word_boundary(l, c, chunks), word_boundary(l, c + 1, chunks), eta, minuseta,
+                     &l.partial_new[c * l.all->lda]);
+      });
+      for (size_t c = 0; c < chunks; c++)
+        for (size_t k = 0; k < l.all->lda; k++)
+          l.total_new[k] += l.partial_new[c * l.all->lda + k];
     }
 
     for (size_t k = 0; k < l.all->lda; k++)
@@ -1232,7 +1545,16 @@ void finish_example(vw&, lda&, example &) {}
 void finish(lda &ld)
 {
   ld.sorted_features.~vector<index_feature>();
-  ld.Elogtheta.delete_v();
+  for (lda_scratch& s : ld.scratch)
+  {
+    s.new_gamma.delete_v();
+    s.old_gamma.delete_v();
+    s.Elogtheta.delete_v();
+  }
+  ld.scratch.delete_v();
+  ld.scores.delete_v();
+  ld.partial_new.delete_v();
+  delete ld.pool;
   ld.decay_levels.delete_v();
   ld.total_new.delete_v();
   ld.examples.delete_v();
@@ -1262,6 +1584,7 @@ std::istream &operator>>(std::istream &in, lda_math_mode &mmode)
 LEARNER::base_learner *lda_setup(arguments& arg)
 {
   auto ld = scoped_calloc_or_throw<lda>();
+  size_t threads;
   if (arg.new_options("Latent Dirichlet Allocation")
       .critical("lda", ld->topics, "Run lda with <int> topics")
       .keep("lda_alpha", ld->lda_alpha, 0.1f,"Prior on sparsity of per-document topic weights")
@@ -1269,6 +1592,7 @@ LEARNER::base_learner *lda_setup(arguments& arg)
       ("lda_D", ld->lda_D, 10000.f, "Number of documents")
       ("lda_epsilon", ld->lda_epsilon, 0.001f, "Loop convergence threshold")
       ("minibatch", ld->minibatch, (size_t)1, "Minibatch size, for LDA")
+      ("lda_threads", threads, (size_t)1, "Update the documents of a --minibatch on this many threads")
       ("math-mode", ld->mmode, USE_SIMD, "Math mode: simd, accuracy, fast-approx")
       ("metrics", ld->compute_coherence_metrics, false, "Compute metrics").missing())
     return nullptr;
@@ -1302,6 +1626,11 @@ LEARNER::base_learner *lda_setup(arguments& arg)
 
   ld->v.resize(arg.all->lda * ld->minibatch);
 
+  if (threads > 1)
+    ld->pool = new thread_pool(threads);
+  ld->scratch.resize(threads > 1 ? threads : 1);
+  ld->scratch.end() = ld->scratch.begin() + (threads > 1 ? threads : 1);
+
   ld->decay_levels.push_back(0.f);
 
   arg.all->p->lp = no_label::no_label_parser;
@@ -6,6 +6,7 @@ license as described in the file LICENSE.
 #pragma once
 // This is the interface for a learning algorithm
 #include<iostream>
+#include<float.h>
 #include "memory.h"
 #include "multiclass.h"
 #include "simple_label.h"
@@ -53,6 +54,7 @@ inline func_data tuple_dbf(void* data, base_learner* base, void (*func)(void*))
 struct learn_data
 { using fn = void(*)(void* data, base_learner& base, void* ex);
   using multi_fn = void(*)(void* data, base_learner& base, void* ex, size_t count, size_t step, polyprediction*pred, bool finalize_predictions);
+  using multi_update_fn = void(*)(void* data, base_learner& base, void* ex, size_t count, size_t step, polyprediction*pred, float* label, float* weight);
 
   void* data;
   base_learner* base;
@@ -60,6 +62,7 @@ struct learn_data
   fn predict_f;
   fn update_f;
   multi_fn multipredict_f;
+  multi_update_fn multiupdate_f;
 };
 
 struct sensitivity_data
@@ -189,6 +192,42 @@ public:
   template<class L>
   inline void set_update(void (*u)(T& data, L& base, E&)) { learn_fd.update_f = (learn_data::fn)u; }
 
+  // update learners lo..lo+count-1 as update() would, one after the other,
+  // learner c with prediction pred[c], label label[c] and, when weight is
+  // given, importance weight weight[c].  learners whose label is FLT_MAX
+  // are left alone, and so are ec.pred, ec.l and ec.weight.
+  inline void multiupdate(E& ec, size_t lo, size_t count, polyprediction* pred, float* label, float* weight = nullptr)
+  { assert((is_multiline && std::is_same<multi_ex, E>::value) ||
+      (!is_multiline && std::is_same<example, E>::value));  // sanity check under debug compile
+    if (learn_fd.multiupdate_f == NULL)
+    { polyprediction save_pred = ec.pred;
+      float save_label = ec.l.simple.label;
+      float save_weight = ec.weight;
+      increment_offset(ec, increment, lo);
+      for (size_t c=0; c<count; c++)
+      { if (label[c] != FLT_MAX)
+        { ec.pred.scalar = pred[c].scalar;
+          ec.l.simple.label = label[c];
+          if (weight)
+            ec.weight = weight[c];
+          learn_fd.update_f(learn_fd.data, *learn_fd.base, (void*)&ec);
+        }
+        increment_offset(ec, increment, 1);
+      }
+      decrement_offset(ec, increment, lo+count);
+      ec.pred = save_pred;
+      ec.l.simple.label = save_label;
+      ec.weight = save_weight;
+    }
+    else
+    { increment_offset(ec, increment, lo);
+      learn_fd.multiupdate_f(learn_fd.data, *learn_fd.base, (void*)&ec, count, increment, pred, label, weight);
+      decrement_offset(ec, increment, lo);
+    }
+  }
+  template<class L>
+  inline void set_multiupdate(void (*u)(T&, L&, E&, size_t, size_t, polyprediction*, float*, float*)) { learn_fd.multiupdate_f = (learn_data::multi_update_fn)u; }
+
   //used for active learning and confidence to determine how easily predictions are changed
   inline void set_sensitivity(float (*u)(T& data, base_learner& base, example&))
   {
@@ -291,6 +330,7 @@ public:
       ret.learn_fd.update_f = (learn_data::fn)learn;
       ret.learn_fd.predict_f = (learn_data::fn)predict;
       ret.learn_fd.multipredict_f = nullptr;
+      ret.learn_fd.multiupdate_f = nullptr;
       ret.pred_type = pred_type;
       ret.is_multiline = std::is_same<multi_ex, E>::value;
 
@@ -3,12 +3,14 @@ Copyright (c) by respective owners including Yahoo!, Microsoft, and
 individual contributors. All rights reserved. Released under a BSD (revised)
 license as described in the file LICENSE.node
 */
+#include <algorithm>
 #include <float.h>
 #include <math.h>
 #include <stdio.h>
 #include <sstream>
 
 #include "reductions.h"
+#include "gd.h"
 
 using namespace std;
 using namespace LEARNER;
@@ -72,8 +74,15 @@ typedef struct
   uint32_t max_count_label;//the most common label
 } node;
 
+struct beam_entry
+{
+  uint32_t node;
+  float score;//the weakest router margin along the path to node
+};
+
 struct log_multi
 {
+  vw* all;
   uint32_t k;
 
   v_array<node> nodes;
@@ -85,6 +94,16 @@ struct log_multi
   uint32_t swap_resist;
 
   uint32_t nbofswaps;
+
+  bool fused;//routers are linear scores that can be read off the weights
+  features cache;//the example's resolved features, shared by every router it passes
+
+  uint32_t beam;//number of labels the beam search reports, 0 for none
+  v_array<beam_entry> frontier;
+  v_array<beam_entry> next;
+  uint32_t* route_nodes;//scratch for routing up to beam nodes at once
+  uint64_t* offsets;
+  float* scores;
 };
 
 inline void init_leaf(node& n)
@@ -296,20 +315,106 @@ inline uint32_t descend(node& n, float prediction)
     return n.right;
 }
 
+//scores of the routers at nodes[0..count), as base.predict would leave them in ec.pred.scalar
+void route(log_multi& b, single_learner& base, example& ec, const uint32_t* nodes, size_t count, float* scores)
+{
+  vw& all = *b.all;
+  if (b.fused && !all.reg_mode)
+  {
+    for (size_t c = 0; c < count; c++)
+    {
+      b.offsets[c] = ec.ft_offset + (uint32_t)(base.increment * b.nodes[nodes[c]].base_predictor);
+      scores[c] = ec.l.simple.initial;
+    }
+    GD::cached_multipredict(all, b.cache, 0, b.cache.size(), b.offsets, count, scores);
+    for (size_t c = 0; c < count; c++)
+    {
+      ec.partial_prediction = scores[c] * (float)all.sd->contraction;
+      scores[c] = GD::finalize_prediction(all.sd, ec.partial_prediction);
+    }
+  }
+  else
+    for (size_t c = 0; c < count; c++)
+    {
+      base.predict(ec, b.nodes[nodes[c]].base_predictor);
+      scores[c] = ec.pred.scalar;
+    }
+}
+
+//beam search for the labels reached with the most confidence.  A path scores its weakest
+//decision (the router margin signed towards the branch taken), so the greedy path comes first.
+void predict_beam(log_multi& b, single_learner& base, example& ec)
+{
+  b.frontier.clear();
+  b.frontier.push_back({0, (float)b.all->sd->max_label});
+  while (true)
+  {
+    size_t internal = 0;
+    for (beam_entry& e : b.frontier)
+      if (b.nodes[e.node].internal)
+        b.route_nodes[internal++] = e.node;
+    if (internal == 0)
+      break;
+    route(b, base, ec, b.route_nodes, internal, b.scores);
+
+    b.next.clear();
+    size_t c = 0;
+    for (beam_entry& e : b.frontier)
+      if (b.nodes[e.node].internal)
+      {
+        float s = b.scores[c++];
+        b.next.push_back({b.nodes[e.node].right, min(e.score, s)});
+        b.next.push_back({b.nodes[e.node].left, min(e.score, -s)});
+      }
+      else
+        b.next.push_back(e);
+    stable_sort(b.next.begin(), b.next.end(),
+                [](const beam_entry& x, const beam_entry& y) { return x.score > y.score; });
+    if (b.next.size() > b.beam)
+      b.next.end() = b.next.begin() + b.beam;
+    swap(b.frontier, b.next);
+  }
+
+  stringstream ss;
+  for (size_t i = 0; i < b.frontier.size(); i++)
+  {
+    uint32_t label = b.nodes[b.frontier[i].node].max_count_label;
+    bool seen = false;
+    for (size_t j = 0; j < i; j++)
+      seen |= b.nodes[b.frontier[j].node].max_count_label == label;
+    if (seen)
+      continue;
+    if (i > 0)
+      ss << ' ';
+    ss << label << ':' << b.frontier[i].score;
+  }
+  b.all->print_text(b.all->raw_prediction, ss.str(), ec.tag);
+}
+
 void predict(log_multi& b,  single_learner& base, example& ec)
 {
   MULTICLASS::label_t mc = ec.l.multi;
 
   ec.l.simple = {FLT_MAX, 0.f, 0.f};
+  if (b.fused && !b.all->reg_mode)
+    GD::cache_features(*b.all, ec, b.cache);
   uint32_t cn = 0;
   uint32_t depth = 0;
   while(b.nodes[cn].internal)
   {
-    base.predict(ec, b.nodes[cn].base_predictor); // depth
-    cn = descend(b.nodes[cn], ec.pred.scalar);
+    float score;
+    route(b, base, ec, &cn, 1, &score); // depth
+    cn = descend(b.nodes[cn], score);
     depth ++;
   }
   ec.pred.multiclass = b.nodes[cn].max_count_label;
+
+  if (b.beam > 0 && b.all->raw_prediction > 0)
+  {
+    uint32_t greedy = ec.pred.multiclass;
+    predict_beam(b, base, ec);
+    ec.pred.multiclass = greedy;
+  }
   ec.l.multi = mc;
 }
 
@@ -393,6 +498,12 @@ void finish(log_multi& b)
   for (size_t i = 0; i < b.nodes.size(); i++)
     b.nodes[i].preds.delete_v();
   b.nodes.delete_v();
+  b.cache.delete_v();
+  b.frontier.delete_v();
+  b.next.delete_v();
+  free(b.route_nodes);
+  free(b.offsets);
+  free(b.scores);
 }
 
 void save_load_tree(log_multi& b, io_buf& model_file, bool read, bool text)
@@ -501,7 +612,8 @@ base_learner* log_multi_setup(arguments& arg)	//learner setup
   if (arg.new_options("Logarithmic Time Multiclass Tree")
       .critical("log_multi", data->k, "Use online tree for multiclass")
       (data->progress, "no_progress", "disable progressive validation")
-      ("swap_resistance", data->swap_resist, (uint32_t)4, "higher = more resistance to swap, default=4").missing())
+      ("swap_resistance", data->swap_resist, (uint32_t)4, "higher = more resistance to swap, default=4")
+      ("log_multi_beam", data->beam, (uint32_t)0, "beam search the tree and write the <arg> best labels, with path margins, as raw predictions").missing())
     return nullptr;
 
   data->progress = !data->progress;
@@ -511,10 +623,19 @@ base_learner* log_multi_setup(arguments& arg)	//learner setup
   delete(arg.all->loss);
   arg.all->loss = getLossFunction(*arg.all, loss_function, loss_parameter);
 
+  data->all = arg.all;
   data->max_predictors = data->k - 1;
   init_tree(*data.get());
 
-  learner<log_multi,example>& l = init_multiclass_learner(data, as_singleline(setup_base(arg)), learn, predict, arg.all->p, data->max_predictors);
+  size_t width = max(data->beam, (uint32_t)1);
+  data->route_nodes = calloc_or_throw<uint32_t>(width);
+  data->offsets = calloc_or_throw<uint64_t>(width);
+  data->scores = calloc_or_throw<float>(width);
+
+  single_learner* base = as_singleline(setup_base(arg));
+  data->fused = base == arg.all->scorer && arg.all->linear_scorer && !arg.all->audit &&
+                (!arg.vm.count("link") || arg.vm["link"].as<string>() == "identity");
+  learner<log_multi,example>& l = init_multiclass_learner(data, base, learn, predict, arg.all->p, data->max_predictors);
   l.set_save_load(save_load_tree);
   l.set_finish(finish);
 
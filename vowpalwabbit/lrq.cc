@@ -17,6 +17,10 @@ struct LRQstate
   bool dropout;
   uint64_t seed;
   uint64_t initial_seed;
+  bool project; // one pass over projections rather than two over all the pairs
+  float orig_sum_feat_sq[256];
+  v_array<float> left_proj; // rank-k projections of the two sides of a pair,
+  v_array<float> right_proj; // [n] full and [k+n] with dropout, n = 1..k
 };
 
 bool valid_int (const char* s)
@@ -170,14 +174,149 @@ void predict_or_learn(LRQstate& lrq, single_learner& base, example& ec)
   }
 }
 
-void finish(LRQstate& lrq) { lrq.lrpairs.~set<string>(); }
+// sum_f w_f^n x_f over the original features of namespace ns, n = 1..k,
+// into proj[n], and into proj[k+n] over the ones kept by dropout.
+// perturbs zero weights away from the saddle point when learning.
+void project(LRQstate& lrq, example& ec, unsigned char ns, unsigned int k, bool perturb, bool do_dropout, float* proj)
+{
+  vw& all = *lrq.all;
+  uint32_t stride_shift = all.weights.stride_shift();
+  for (unsigned int n = 0; n <= 2*k; ++n)
+    proj[n] = 0.f;
+
+  features& fs = ec.feature_space[ns];
+  for (size_t f = 0; f < lrq.orig_size[ns]; ++f)
+  {
+    float x = fs.values[f];
+    uint64_t index = fs.indicies[f] + ec.ft_offset;
+    for (unsigned int n = 1; n <= k; ++n)
+    {
+      uint64_t windex = index + ((uint64_t)n << stride_shift);
+      weight* w = &all.weights[windex];
+      if (perturb && *w == 0)
+        *w = cheesyrand (windex);
+      proj[n] += *w * x;
+      if (do_dropout && cheesyrbit (lrq.seed))
+        proj[k+n] += *w * x;
+    }
+  }
+  if (!do_dropout)
+    for (unsigned int n = 1; n <= k; ++n)
+      proj[k+n] = proj[n];
+}
+
+// for each original feature f of ns and n = 1..k, a feature worth
+// scale * proj[n] * x_f on weight w_f^n: the gradient of the pair's
+// interaction with respect to that weight
+void push_projected(LRQstate& lrq, example& ec, unsigned char ns, unsigned int k, float scale, float* proj)
+{
+  vw& all = *lrq.all;
+  uint32_t stride_shift = all.weights.stride_shift();
+  features& fs = ec.feature_space[ns];
+  for (size_t f = 0; f < lrq.orig_size[ns]; ++f)
+  {
+    float x = fs.values[f];
+    uint64_t index = fs.indicies[f]; // NB: ec.ft_offset added by base learner
+    for (unsigned int n = 1; n <= k; ++n)
+    {
+      fs.push_back(scale * proj[n] * x, index + ((uint64_t)n << stride_shift));
+
+      if (all.audit || all.hash_inv)
+      {
+        std::stringstream new_feature_buffer;
+        new_feature_buffer << ns << '^' << fs.space_names[f].get()->second << '^' << n;
+#ifdef _WIN32
+        char* new_space = _strdup("lrq");
+        char* new_feature = _strdup(new_feature_buffer.str().c_str());
+#else
+        char* new_space = strdup("lrq");
+        char* new_feature = strdup(new_feature_buffer.str().c_str());
+#endif
+        fs.space_names.push_back(audit_strings_ptr(new audit_strings(new_space,new_feature)));
+      }
+    }
+  }
+}
+
+// the interaction of a pair is sum_n L^n R^n with L, R the rank-k
+// projections of its two namespaces, so it costs O((|L|+|R|) k) rather than
+// O(|L| |R| k).  predicting pushes one side's gradient features, whose dot
+// with the weights is the interaction.  learning pushes both sides' and
+// takes the extra copy of the interaction out of the initial prediction, so
+// one update moves both factors along their exact gradients.
+template <bool is_learn>
+void predict_or_learn_projected(LRQstate& lrq, single_learner& base, example& ec)
+{
+  memset (lrq.orig_size, 0, sizeof (lrq.orig_size));
+  for (namespace_index i : ec.indices)
+    if (lrq.lrindices[i])
+    {
+      lrq.orig_size[i] = ec.feature_space[i].size ();
+      lrq.orig_sum_feat_sq[i] = ec.feature_space[i].sum_feat_sq;
+    }
+
+  bool train = is_learn && ! example_is_test (ec);
+  bool do_dropout = lrq.dropout && train;
+  float scale = (! lrq.dropout || do_dropout) ? 1.f : 0.5f;
+  float save_initial = ec.l.simple.initial;
+
+  for (string const& i : lrq.lrpairs)
+  {
+    unsigned char left = i[0];
+    unsigned char right = i[1];
+    unsigned int k = atoi (i.c_str () + 2);
+    if (lrq.orig_size[left] == 0 || lrq.orig_size[right] == 0)
+      continue;
+    float* lp = lrq.left_proj.begin();
+    float* rp = lrq.right_proj.begin();
+
+    project(lrq, ec, left, k, train, do_dropout, lp);
+    if (!train)
+    {
+      push_projected(lrq, ec, right, k, scale, lp);
+      continue;
+    }
+    project(lrq, ec, right, k, train, do_dropout, rp);
+
+    // each side learns against the other side's dropped out projection;
+    // the pushed features then score both cross terms, counted half each
+    float pushed = 0.f;
+    for (unsigned int n = 1; n <= k; ++n)
+      pushed += lp[k+n] * rp[n] + rp[k+n] * lp[n];
+    ec.l.simple.initial -= 0.5f * pushed;
+
+    push_projected(lrq, ec, right, k, 1.f, lp + k);
+    push_projected(lrq, ec, left, k, 1.f, rp + k);
+  }
+
+  if (is_learn)
+    base.learn(ec);
+  else
+    base.predict(ec);
+
+  ec.l.simple.initial = save_initial;
+  for (namespace_index i : ec.indices)
+    if (lrq.lrindices[i])
+    {
+      ec.feature_space[i].truncate_to(lrq.orig_size[i]);
+      ec.feature_space[i].sum_feat_sq = lrq.orig_sum_feat_sq[i];
+    }
+}
+
+void finish(LRQstate& lrq)
+{
+  lrq.lrpairs.~set<string>();
+  lrq.left_proj.delete_v();
+  lrq.right_proj.delete_v();
+}
 
 base_learner* lrq_setup(arguments& arg)
 {
   auto lrq = scoped_calloc_or_throw<LRQstate>();
   if (arg.new_options("Low Rank Quadratics")
       .critical_vector<string>("lrq", po::value<vector<string> >(), "use low rank quadratic features")
-      .keep(lrq->dropout, "lrqdropout", "use dropout training for low rank quadratic features").missing())
+      .keep(lrq->dropout, "lrqdropout", "use dropout training for low rank quadratic features")
+      .keep(lrq->project, "lrqproject", "score pairs through per-namespace projections and learn both factors in one pass").missing())
     return nullptr;
 
   uint32_t maxk = 0;
@@ -195,6 +334,8 @@ base_learner* lrq_setup(arguments& arg)
     arg.all->trace_message << "creating low rank quadratic features for pairs: ";
     if (lrq->dropout)
       arg.all->trace_message << "(using dropout) ";
+    if (lrq->project)
+      arg.all->trace_message << "(using projections) ";
   }
 
   for (string const& i : lrq->lrpairs)
@@ -220,11 +361,21 @@ base_learner* lrq_setup(arguments& arg)
     arg.all->trace_message<<endl;
 
   arg.all->wpp = arg.all->wpp * (uint64_t)(1 + maxk);
-  learner<LRQstate,example>& l = init_learner(lrq, as_singleline(setup_base(arg)), predict_or_learn<true>,
-                                      predict_or_learn<false>, 1 + maxk);
-  l.set_end_pass(reset_seed);
-  l.set_finish(finish);
+  if (lrq->project)
+  {
+    lrq->left_proj.resize(2*maxk+1);
+    lrq->right_proj.resize(2*maxk+1);
+  }
+  learner<LRQstate,example>* l;
+  if (lrq->project)
+    l = &init_learner(lrq, as_singleline(setup_base(arg)), predict_or_learn_projected<true>,
+                      predict_or_learn_projected<false>, 1 + maxk);
+  else
+    l = &init_learner(lrq, as_singleline(setup_base(arg)), predict_or_learn<true>,
+                      predict_or_learn<false>, 1 + maxk);
+  l->set_end_pass(reset_seed);
+  l->set_finish(finish);
 
   // TODO: leaks memory ?
-  return make_base(l);
+  return make_base(*l);
 }
@@ -36,6 +36,9 @@ struct mf
   // array for temp storage of features
   features temp_features;
 
+  // l^k * x_l and r^k * x_r for k = 1..rank, scored in one multipredict per side
+  polyprediction* latent;
+
   vw* all; // for pairs? and finalize
 };
 
@@ -67,7 +70,29 @@ void predict(mf& data, single_learner& base, example& ec)
     int left_ns = (int) i[0];
     int right_ns = (int) i[1];
 
-    if (ec.feature_space[left_ns].size() > 0 && ec.feature_space[right_ns].size() > 0)
+    if (ec.feature_space[left_ns].size() > 0 && ec.feature_space[right_ns].size() > 0 && !data.all->audit)
+    {
+      // all rank latent sums of a side in a single pass over its features
+      polyprediction* left = data.latent;
+      polyprediction* right = data.latent + data.rank;
+      ec.indices[0] = left_ns;
+      base.multipredict(ec, 1, data.rank, left, false);
+      ec.indices[0] = right_ns;
+      base.multipredict(ec, data.rank + 1, data.rank, right, false);
+
+      for (size_t k = 1; k <= data.rank; k++)
+      {
+        float x_dot_l = left[k-1].scalar;
+        float x_dot_r = right[k-1].scalar;
+        if (cache_sub_predictions)
+        {
+          data.sub_predictions[2*k-1] = x_dot_l;
+          data.sub_predictions[2*k] = x_dot_r;
+        }
+        prediction += (x_dot_l * x_dot_r);
+      }
+    }
+    else if (ec.feature_space[left_ns].size() > 0 && ec.feature_space[right_ns].size() > 0)
     {
       for (size_t k = 1; k <= data.rank; k++)
       {
@@ -135,24 +160,23 @@ void learn(mf& data, single_learner& base, example& ec)
       // store feature values in left namespace
       data.temp_features.deep_copy_from(ec.feature_space[left_ns]);
 
+      features& left_fs = ec.feature_space[left_ns];
       for (size_t k = 1; k <= data.rank; k++)
       {
-        features& fs = ec.feature_space[left_ns];
-        // multiply features in left namespace by r^k * x_r
-        for (size_t i= 0; i < fs.size(); ++i)
-          fs.values[i] *= data.sub_predictions[2*k];
+        // scale the stored feature values of the left namespace by r^k * x_r
+        for (size_t i= 0; i < left_fs.size(); ++i)
+          left_fs.values[i] = data.temp_features.values[i] * data.sub_predictions[2*k];
 
         // update l^k using base learner
         base.update(ec, k);
 
-        // restore left namespace features (undoing multiply)
-        fs.deep_copy_from(data.temp_features);
-
         // compute new l_k * x_l scaling factors
         // base.predict(ec, k);
         // data.sub_predictions[2*k-1] = ec.partial_prediction;
         // ec.pred.scalar = ec.updated_prediction;
       }
+      // restore left namespace features (undoing multiply)
+      left_fs.deep_copy_from(data.temp_features);
 
       // set example to right namespace only
       ec.indices[0] = right_ns;
@@ -160,20 +184,19 @@ void learn(mf& data, single_learner& base, example& ec)
       // store feature values for right namespace
       data.temp_features.deep_copy_from(ec.feature_space[right_ns]);
 
+      features& right_fs = ec.feature_space[right_ns];
       for (size_t k = 1; k <= data.rank; k++)
       {
-        features& fs = ec.feature_space[right_ns];
-        // multiply features in right namespace by l^k * x_l
-        for (size_t i = 0; i < fs.size(); ++i)
-          fs.values[i] *= data.sub_predictions[2*k-1];
+        // scale the stored feature values of the right namespace by l^k * x_l
+        for (size_t i = 0; i < right_fs.size(); ++i)
+          right_fs.values[i] = data.temp_features.values[i] * data.sub_predictions[2*k-1];
 
         // update r^k using base learner
         base.update(ec, k + data.rank);
         ec.pred.scalar = ec.updated_prediction;
-
-        // restore right namespace features
-        fs.deep_copy_from(data.temp_features);
       }
+      // restore right namespace features
+      right_fs.deep_copy_from(data.temp_features);
     }
   }
   // restore namespace indices
@@ -191,6 +214,7 @@ void finish(mf& o)
   // clean up local v_arrays
   o.indices.delete_v();
   o.sub_predictions.delete_v();
+  free(o.latent);
 }
 
 base_learner* mf_setup(arguments& arg)
@@ -207,6 +231,7 @@ base_learner* mf_setup(arguments& arg)
   arg.all->pairs.clear();
 
   arg.all->random_positive_weights = true;
+  data->latent = calloc_or_throw<polyprediction>(2*data->rank);
 
   learner<mf,example>& l = init_learner(data, as_singleline(setup_base(arg)), learn, predict<false>, 2*data->rank+1);
   l.set_finish(finish);
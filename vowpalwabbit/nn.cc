@@ -41,6 +41,8 @@ struct nn
 
   polyprediction* hidden_units_pred;
   polyprediction* hiddenbias_pred;
+  polyprediction* outputweight_pred;
+  float* hidden_targets;               // FLT_MAX for hidden units left alone
 
   vw* all;//many things
 };
@@ -228,19 +230,34 @@ CONVERSE: // That's right, I'm using goto.  So sue me.
   save_max_label = n.all->sd->max_label;
   n.all->sd->max_label = 1;
 
+  // the output weight of hidden unit i sits i learners past that of unit
+  // 0, so one multipredict from learner k reads all of them.  l1/l2
+  // truncation moves with every update, so there each unit is read after
+  // the previous one has been touched, as before.
+  bool batched = !n.all->reg_mode;
+  features& out_fs = n.output_layer.feature_space[nn_output_namespace];
+  if (batched)
+  {
+    n.outputweight.feature_space[nn_output_namespace].indicies[0] = out_fs.indicies[0];
+    base.multipredict(n.outputweight, n.k, n.k, n.outputweight_pred, true);
+  }
+
   for (unsigned int i = 0; i < n.k; ++i)
   {
     float sigmah =
       (dropped_out[i]) ? 0.0f : dropscale * fasttanh (hidden_units[i].scalar);
-    features& out_fs = n.output_layer.feature_space[nn_output_namespace];
     out_fs.values[i] = sigmah;
 
     n.output_layer.total_sum_feat_sq += sigmah * sigmah;
     out_fs.sum_feat_sq += sigmah * sigmah;
 
     n.outputweight.feature_space[nn_output_namespace].indicies[0] = out_fs.indicies[i];
-    base.predict(n.outputweight, n.k);
-    float wf = n.outputweight.pred.scalar;
+    if (!batched)
+    {
+      base.predict(n.outputweight, n.k);
+      n.outputweight_pred[i].scalar = n.outputweight.pred.scalar;
+    }
+    float wf = n.outputweight_pred[i].scalar;
 
     // avoid saddle point at 0
     if (wf == 0)
@@ -317,26 +334,50 @@ CONVERSE: // That's right, I'm using goto.  So sue me.
       if (n.multitask)
         ec.ft_offset = 0;
 
+      if (batched)
+      {
+        n.outputweight.feature_space[nn_output_namespace].indicies[0] =
+          n.output_layer.feature_space[nn_output_namespace].indicies[0];
+        base.multipredict(n.outputweight, n.k, n.k, n.outputweight_pred, true);
+      }
+
       for (unsigned int i = 0; i < n.k; ++i)
       {
+        n.hidden_targets[i] = FLT_MAX;
         if (! dropped_out[i])
         {
           float sigmah =
             n.output_layer.feature_space[nn_output_namespace].values[i] / dropscale;
           float sigmahprime = dropscale * (1.0f - sigmah * sigmah);
-          n.outputweight.feature_space[nn_output_namespace].indicies[0] =
-            n.output_layer.feature_space[nn_output_namespace].indicies[i];
-          base.predict(n.outputweight, n.k);
-          float nu = n.outputweight.pred.scalar;
+          if (!batched)
+          {
+            n.outputweight.feature_space[nn_output_namespace].indicies[0] =
+              n.output_layer.feature_space[nn_output_namespace].indicies[i];
+            base.predict(n.outputweight, n.k);
+            n.outputweight_pred[i].scalar = n.outputweight.pred.scalar;
+          }
+          float nu = n.outputweight_pred[i].scalar;
           float gradhw = 0.5f * nu * gradient * sigmahprime;
 
-          ec.l.simple.label = GD::finalize_prediction (n.all->sd, hidden_units[i].scalar - gradhw);
-          ec.pred.scalar = hidden_units[i].scalar;
-          if (ec.l.simple.label != hidden_units[i].scalar)
-            base.update(ec, i);
+          float target = GD::finalize_prediction (n.all->sd, hidden_units[i].scalar - gradhw);
+          if (target != hidden_units[i].scalar)
+          {
+            if (batched)
+              n.hidden_targets[i] = target;
+            else
+            {
+              ec.l.simple.label = target;
+              ec.pred.scalar = hidden_units[i].scalar;
+              base.update(ec, i);
+            }
+          }
         }
       }
 
+      // all hidden units in one pass over the input features
+      if (batched)
+        base.multiupdate(ec, 0, n.k, hidden_units, n.hidden_targets);
+
       n.all->loss = save_loss;
       n.all->set_minmax = save_set_minmax;
       n.all->sd->min_label = save_min_label;
@@ -404,6 +445,8 @@ void finish(nn& n)
   free(n.dropped_out);
   free(n.hidden_units_pred);
   free(n.hiddenbias_pred);
+  free(n.outputweight_pred);
+  free(n.hidden_targets);
   VW::dealloc_example(nullptr, n.output_layer);
   VW::dealloc_example(nullptr, n.hiddenbias);
   VW::dealloc_example(nullptr, n.outputweight);
@@ -457,6 +500,8 @@ base_learner* nn_setup(arguments& arg)
   n->dropped_out = calloc_or_throw<bool>(n->k);
   n->hidden_units_pred = calloc_or_throw<polyprediction>(n->k);
   n->hiddenbias_pred = calloc_or_throw<polyprediction>(n->k);
+  n->outputweight_pred = calloc_or_throw<polyprediction>(n->k);
+  n->hidden_targets = calloc_or_throw<float>(n->k);
 
   auto base = as_singleline(setup_base(arg));
   n->increment = base->increment;//Indexing of output layer is odd.
@@ -17,11 +17,58 @@ struct oaa
   uint64_t k;
   vw* all; // for raw
   polyprediction* pred;  // for multipredict
+  float* label;           // for multiupdate
   uint64_t num_subsample; // for randomized subsampling, how many negatives to draw?
   uint32_t* subsample_order; // for randomized subsampling, in what order should we touch classes
   size_t subsample_id; // for randomized subsampling, where do we live in the list
+  uint64_t* class_count; // for frequency subsampling, how often has each class been the label (plus one)
+  uint64_t* count_tree;  // for frequency subsampling, Fenwick tree over class_count
+  uint64_t total_count;
+  uint64_t random_state; // for frequency subsampling, our own so the draws are reproducible
 };
 
+// count_tree[i] holds the counts of classes (i - (i & -i), i], 1-based
+void add_count(oaa& o, uint32_t l, int64_t delta)
+{
+  o.class_count[l] += delta;
+  o.total_count += delta;
+  for (uint64_t i = l+1; i <= o.k; i += i & (~i + 1))
+    o.count_tree[i] += delta;
+}
+
+// the class l whose counts cover r in [0, total_count), in O(log k)
+uint32_t find_count(oaa& o, uint64_t r)
+{
+  uint64_t pos = 0;
+  uint64_t step = 1;
+  while (step * 2 <= o.k) step *= 2;
+  for (; step > 0; step /= 2)
+    if (pos + step <= o.k && o.count_tree[pos + step] <= r)
+    {
+      pos += step;
+      r -= o.count_tree[pos];
+    }
+  return (uint32_t)pos;
+}
+
+// uniform in [0, n) for n up to 2^46: two 23 bit draws make one 46 bit
+// draw, and draws past the last whole multiple of n are redrawn so that no
+// class is favoured
+uint64_t draw_below(uint64_t& random_state, uint64_t n)
+{
+  const uint64_t range = (uint64_t)1 << 46;
+  uint64_t limit = range - range % n;
+  uint64_t r;
+  do
+  {
+    uint64_t high = (uint64_t)(merand48(random_state) * (float)(1 << 23));
+    uint64_t low = (uint64_t)(merand48(random_state) * (float)(1 << 23));
+    r = (high << 23) | low;
+  }
+  while (r >= limit);
+  return r % n;
+}
+
 void learn_randomized(oaa& o, LEARNER::single_learner& base, example& ec)
 {
   MULTICLASS::label_t ld = ec.l.multi;
@@ -84,12 +131,10 @@ void predict_or_learn(oaa& o, LEARNER::single_learner& base, example& ec)
 
   if (is_learn)
   {
+    // all k binary updates in one pass over the features
     for (uint32_t i=1; i<=o.k; i++)
-    {
-      ec.l.simple = { (mc_label_data.label == i) ? 1.f : -1.f, 0.f, 0.f };
-      ec.pred.scalar = o.pred[i-1].scalar;
-      base.update(ec, i-1);
-    }
+      o.label[i-1] = (mc_label_data.label == i) ? 1.f : -1.f;
+    base.multiupdate(ec, 0, o.k, o.pred, o.label);
   }
 
   if (print_all)
@@ -125,10 +170,85 @@ void predict_or_learn(oaa& o, LEARNER::single_learner& base, example& ec)
   ec.l.multi = mc_label_data;
 }
 
+// negatives are drawn with replacement in proportion to how often each class
+// has been the label, and weighted so each negative still sees the example's
+// weight in expectation.  so only num_subsample+1 of the k problems are
+// touched per example, and frequent (hard) negatives are touched most.  the
+// weight of a rare class is clipped at what a uniform draw would give it, so
+// a class seen once in a long stream cannot take a huge step.
+void learn_by_frequency(oaa& o, LEARNER::single_learner& base, example& ec)
+{
+  MULTICLASS::label_t ld = ec.l.multi;
+  if (ld.label == 0 || ld.label > o.k)
+  {
+    // nothing to sample against, so just predict (which also complains)
+    predict_or_learn<false, false, false, false>(o, base, ec);
+    return;
+  }
+  uint32_t truth = ld.label-1;
+
+  ec.l.simple = { 1., 0.f, 0.f };
+  base.learn(ec, truth);
+
+  size_t prediction = ld.label;
+  float best_partial_prediction = ec.partial_prediction;
+
+  // take the true class out of the draw while sampling
+  uint64_t truth_count = o.class_count[truth];
+  add_count(o, truth, -(int64_t)truth_count);
+  uint64_t rest = o.total_count;
+
+  ec.l.simple.label = -1.;
+  float weight_temp = ec.weight;
+  float max_ratio = (float)(o.k-1) / (float)o.num_subsample;
+  for (size_t count = 0; count < o.num_subsample; count++)
+  {
+    uint32_t l = find_count(o, draw_below(o.random_state, rest));
+    float ratio = (float)rest / ((float)o.num_subsample * (float)o.class_count[l]);
+    ec.weight = weight_temp * min(ratio, max_ratio);
+    base.learn(ec, l);
+    if (ec.partial_prediction > best_partial_prediction)
+    {
+      best_partial_prediction = ec.partial_prediction;
+      prediction = l+1;
+    }
+  }
+
+  add_count(o, truth, (int64_t)truth_count + 1);
+
+  ec.pred.multiclass = (uint32_t)prediction;
+  ec.l.multi = ld;
+  ec.weight = weight_temp;
+}
+
 void finish(oaa&o)
 {
   free(o.pred);
+  free(o.label);
   free(o.subsample_order);
+  free(o.class_count);
+  free(o.count_tree);
+}
+
+// with --oaa_subsample_by_frequency (kept in the model) the class counts and
+// the draw state are part of the model, so a run resumed from it draws
+// negatives as this one would
+void save_load(oaa& o, io_buf& model_file, bool read, bool text)
+{
+  if (model_file.files.size() == 0 || o.class_count == nullptr)
+    return;
+  for (uint32_t i=0; i<o.k; i++)
+  {
+    uint64_t count = o.class_count[i];
+    stringstream msg;
+    msg << "class_count " << i << " " << count << "\n";
+    bin_text_read_write_fixed(model_file, (char*)&count, sizeof(count), "", read, msg, text);
+    if (read)
+      add_count(o, i, (int64_t)count - (int64_t)o.class_count[i]);
+  }
+  stringstream msg;
+  msg << "random_state " << o.random_state << "\n";
+  bin_text_read_write_fixed(model_file, (char*)&o.random_state, sizeof(o.random_state), "", read, msg, text);
 }
 
 // TODO: partial code duplication with multiclass.cc:finish_example
@@ -207,9 +327,11 @@ LEARNER::base_learner* oaa_setup(arguments& arg)
   auto data = scoped_calloc_or_throw<oaa>();
   bool probabilities = false;
   bool scores = false;
+  bool by_frequency = false;
   if (arg.new_options("One Against All Options")
       .critical<uint64_t>("oaa", po::value(&data->k), "One-against-all multiclass with <k> labels")
       ("oaa_subsample", data->num_subsample, "subsample this number of negative examples when learning")
+      .keep(by_frequency, "oaa_subsample_by_frequency", "draw the subsampled negatives in proportion to how often each class was the label")
       (probabilities, "probabilities", "predict probabilites of all classes")
       (scores, "scores", "output raw scores per class").missing())
     return nullptr;
@@ -219,8 +341,21 @@ LEARNER::base_learner* oaa_setup(arguments& arg)
 
   data->all = arg.all;
   data->pred = calloc_or_throw<polyprediction>(data->k);
+  data->label = calloc_or_throw<float>(data->k);
   data->subsample_order = nullptr;
   data->subsample_id = 0;
+  if (by_frequency)
+  {
+    // counted whenever the model says so, even when this run does not
+    // subsample, so that save_load always finds the counts it expects.
+    // every class starts at one, so unseen classes still get drawn
+    data->class_count = calloc_or_throw<uint64_t>(data->k);
+    data->count_tree = calloc_or_throw<uint64_t>(data->k+1);
+    data->total_count = 0;
+    for (uint32_t i=0; i<data->k; i++)
+      add_count(*data, i, 1);
+    data->random_state = arg.all->random_seed;
+  }
   if (data->num_subsample > 0)
   {
     if (data->num_subsample >= data->k)
@@ -228,7 +363,7 @@ LEARNER::base_learner* oaa_setup(arguments& arg)
       data->num_subsample = 0;
       arg.all->trace_message << "oaa is turning off subsampling because your parameter >= K" << endl;
     }
-    else
+    else if (!by_frequency)
     {
       data->subsample_order = calloc_or_throw<uint32_t>(data->k);
       for (size_t i=0; i<data->k; i++) data->subsample_order[i] = (uint32_t) i;
@@ -273,8 +408,16 @@ LEARNER::base_learner* oaa_setup(arguments& arg)
                                           predict_or_learn<false, false, false, false>, arg.all->p, data->k, prediction_type::multiclass);
 
   if (data_ptr->num_subsample > 0)
-    l->set_learn(learn_randomized);
+  {
+    if (by_frequency)
+      l->set_learn(learn_by_frequency);
+    else
+      l->set_learn(learn_randomized);
+  }
+  else if (by_frequency && arg.all->training)
+    arg.all->trace_message << "oaa_subsample_by_frequency has no effect without oaa_subsample" << endl;
   l->set_finish(finish);
+  l->set_save_load(save_load);
 
   return make_base(*l);
 }
@@ -1041,6 +1041,10 @@ void parse_output_model(arguments& arg)
       (arg.all->save_resume, "save_resume", "save extra state so learning can be resumed later with new data")
       (arg.all->preserve_performance_counters, "preserve_performance_counters", "reset performance counters when warmstarting")
       (arg.all->save_per_pass, "save_per_pass", "Save the model after every pass over data")
+      (arg.all->dense_model, "dense_model", "Save weights as a page-aligned dense table that is memory mapped when loaded")
+      ("save_threads", arg.all->save_threads, "Number of threads writing and reading a --dense_model table")
+      (arg.all->background_save, "background_save", "Write per pass and tagged snapshots from a background thread while learning continues")
+      (arg.all->delta_checkpoint, "delta_checkpoint", "After the first, per pass and tagged snapshots only hold the weight pages that changed. Load them with -i base --delta_regressor delta...")
       ("output_feature_regularizer_binary", arg.all->per_feature_regularizer_output, "Per feature regularization output file")
       ("output_feature_regularizer_text", arg.all->per_feature_regularizer_text, "Per feature regularization output file, in text")
       ("id", arg.all->id, "User supplied ID embedded into the final regressor").missing())
@@ -1052,6 +1056,9 @@ void parse_output_model(arguments& arg)
   if (arg.vm.count("invert_hash"))
     arg.all->hash_inv = true;
 
+  if (arg.all->delta_checkpoint && arg.all->save_resume)
+    THROW("--delta_checkpoint cannot be used with --save_resume: a delta only restores weights, not the learning state --save_resume keeps");
+
   if (arg.vm.count("id") && find(arg.args.begin(), arg.args.end(), "--id") == arg.args.end())
   {
     arg.args.push_back("--id");
@@ -1083,15 +1090,22 @@ void load_input_model(vw& all, io_buf& io_temp)
   }
 }
 
-LEARNER::base_learner* setup_base(arguments& args)
+LEARNER::base_learner* setup_base(arguments& args, LEARNER::base_learner* (*&chosen)(arguments&))
 {
-  LEARNER::base_learner* ret = args.all->reduction_stack.pop()(args);
+  chosen = args.all->reduction_stack.pop();
+  LEARNER::base_learner* ret = chosen(args);
   if (ret == nullptr)
-    return setup_base(args);
+    return setup_base(args, chosen);
   else
     return ret;
 }
 
+LEARNER::base_learner* setup_base(arguments& args)
+{
+  LEARNER::base_learner* (*chosen)(arguments&);
+  return setup_base(args, chosen);
+}
+
 void parse_reductions(arguments& arg)
 {
   vw& all = *arg.all;
@@ -1153,6 +1167,11 @@ void parse_reductions(arguments& arg)
   all.reduction_stack.push_back(audit_regressor_setup);
 
   all.l = setup_base(arg);
+
+  // base learners are tried last to first and gd, which writes the span
+  // checkpoint, is the final fallback, so it was picked iff the stack is empty
+  if (all.span_checkpoint.length() > 0 && all.reduction_stack.size() != 0)
+    THROW("--span_checkpoint is only supported with the default gd base learner");
 }
 
 void add_to_args(vw& all, int argc, char* argv[], int excl_param_count = 0, const char* excl_params[] = NULL)
@@ -1213,6 +1232,8 @@ vw& parse_args(int argc, char *argv[], trace_message_t trace_listener, void* tra
 
     all.opts_n_args.new_options("Weight options")
       ("initial_regressor,i", po::value< vector<string> >(), "Initial regressor(s)")
+      ("delta_regressor", po::value< vector<string> >(), "Delta checkpoint(s) applied in order on top of the initial regressor. They only restore weights")
+      (all.verify_dense_model, "verify_dense_model", "Check the checksums of a --dense_model table when loading it")
       ("initial_weight", all.initial_weight, "Set all weights to an initial value of arg.")
       ("random_weights", all.random_weights, "make initial weights random")
       ("normal_weights", all.normal_weights, "make initial weights normal")
@@ -1225,7 +1246,10 @@ vw& parse_args(int argc, char *argv[], trace_message_t trace_listener, void* tra
       ("threads", "Enable multi-threading")
       ("unique_id", po::value<size_t>()->default_value(0), "unique id used for cluster parallel jobs")
       ("total", po::value<size_t>()->default_value(1), "total number of nodes used in cluster parallel job")
-      ("node", po::value<size_t>()->default_value(0), "node number in cluster parallel job").missing();
+      ("node", po::value<size_t>()->default_value(0), "node number in cluster parallel job")
+      ("span_retries", po::value<size_t>()->default_value(0), "number of times to rebuild the spanning tree and retry an allreduce after a node fails")
+      ("span_timeout", po::value<size_t>()->default_value(0), "seconds without progress from a tree neighbour before it is considered dead (0 = wait forever)")
+      ("span_checkpoint", all.span_checkpoint, "save weights here after every pass and resume from them when this node is restarted").missing();
 
     po::variables_map& vm = all.opts_n_args.vm;
 
@@ -1233,7 +1257,8 @@ vw& parse_args(int argc, char *argv[], trace_message_t trace_listener, void* tra
     {
       all.all_reduce_type = AllReduceType::Socket;
       all.all_reduce = new AllReduceSockets(vm["span_server"].as<string>(),
-        vm["unique_id"].as<size_t>(), vm["total"].as<size_t>(), vm["node"].as<size_t>());
+        vm["unique_id"].as<size_t>(), vm["total"].as<size_t>(), vm["node"].as<size_t>(),
+        vm["span_retries"].as<size_t>(), vm["span_timeout"].as<size_t>());
     }
     parse_diagnostics(all.opts_n_args);
 
@@ -1324,7 +1349,10 @@ void parse_modules(vw& all, io_buf& model)
 void parse_sources(vw& all, io_buf& model, bool skipModelLoad)
 {
   if (!skipModelLoad)
+  {
     load_input_model(all, model);
+    apply_delta_regressors(all);
+  }
   else
     model.close_file();
 
@@ -12,6 +12,8 @@ void parse_modules(vw& all, io_buf& model);
 void parse_sources(vw& all, io_buf& model, bool skipModelLoad = false);
 
 LEARNER::base_learner* setup_base(arguments&);
+// Same, also reporting which setup function produced the learner.
+LEARNER::base_learner* setup_base(arguments&, LEARNER::base_learner* (*&chosen)(arguments&));
 
 std::string spoof_hex_encoded_namespaces(const std::string& arg);
 // char** get_argv_from_string(string s, int& argc);
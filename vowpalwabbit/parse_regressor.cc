@@ -19,11 +19,15 @@ using namespace std;
 #include <algorithm>
 #include <stdarg.h>
 #include <numeric>
+#include <thread>
+#include <functional>
 #include "rand48.h"
 #include "global_data.h"
 #include "vw_exception.h"
 #include "vw_validate.h"
 #include "vw_versions.h"
+#include "delta_model.h"
+#include "weight_snapshot.h"
 
 template <class T> class set_initial_wrapper
 {
@@ -542,17 +546,268 @@ void dump_regressor(vw& all, string reg_name, bool as_text)
     THROW("WARN: dump_regressor(vw& all, string reg_name, bool as_text): cannot rename: " << start_name.c_str() << " to " << reg_name.c_str());
 }
 
+// The model of a background save, serialized into memory on the learning
+// thread except for a dense weight table, which the writer streams from a
+// copy-on-write snapshot.
+class snapshot_buf : public io_buf
+{
+public:
+  vector<char> data;
+  size_t weights_at; // where the deferred table goes in data
+  function<void(io_buf&, weight_snapshot&)> write_weights;
+
+  snapshot_buf() : weights_at(0)
+  {
+    files.push_back(-1); // io_buf only flushes when it has a file
+  }
+
+  virtual ssize_t write_file(int, const void* buf, size_t nbytes)
+  {
+    data.insert(data.end(), (const char*)buf, (const char*)buf + nbytes);
+    return nbytes;
+  }
+
+  // the snapshot is written to the start of a plain file, so a dense table
+  // gets the same padding as when it is saved directly
+  virtual int64_t write_offset()
+  {
+    return (int64_t)(data.size() + (head - space.begin()));
+  }
+
+  virtual bool close_file()
+  {
+    if (files.size() == 0)
+      return false;
+    files.pop();
+    return true;
+  }
+};
+
+// The file a background save streams to; a short write fails the save.
+class snapshot_file : public io_buf
+{
+public:
+  virtual ssize_t write_file(int f, const void* buf, size_t nbytes)
+  {
+    ssize_t done = io_buf::write_file(f, buf, nbytes);
+    if (done != (ssize_t)nbytes)
+      THROWERRNO("writing background snapshot");
+    return done;
+  }
+};
+
+struct snapshot_writer
+{
+  thread writer;
+  bool failed;
+  snapshot_buf model;
+  weight_snapshot weights;
+};
+
+// Copy serialized bytes straight to the file, past io_buf's buffer.
+static void write_bytes(snapshot_file& out, const char* data, size_t n)
+{
+  const size_t step = 1 << 20;
+  out.flush();
+  for (size_t done = 0; done < n; done += min(n - done, step))
+    out.write_file(out.files[0], data + done, min(n - done, step));
+}
+
+static void write_snapshot(const string& reg_name, snapshot_writer& job)
+{
+  string start_name = reg_name + string(".writing");
+  snapshot_buf& model = job.model;
+  size_t at = model.write_weights ? model.weights_at : model.data.size();
+  {
+    snapshot_file out;
+    out.open_file(start_name.c_str(), false, io_buf::WRITE);
+    write_bytes(out, model.data.data(), at);
+    if (model.write_weights)
+    {
+      model.write_weights(out, job.weights);
+      write_bytes(out, model.data.data() + at, model.data.size() - at);
+    }
+    out.flush();
+    out.close_file();
+  }
+  remove(reg_name.c_str());
+  if (0 != rename(start_name.c_str(), reg_name.c_str()))
+    THROW("cannot rename: " << start_name << " to " << reg_name);
+}
+
+// Hashes what a model file holds besides the weight table, with two
+// differently seeded 32 bit hashes.
+class state_digest_buf : public io_buf
+{
+public:
+  uint32_t low, high;
+
+  state_digest_buf() : low(0), high(0x5bd1e995)
+  {
+    files.push_back(-1); // io_buf only flushes when it has a file
+  }
+
+  virtual ssize_t write_file(int, const void* buf, size_t nbytes)
+  {
+    low = (uint32_t)uniform_hash(buf, nbytes, low);
+    high = (uint32_t)uniform_hash(buf, nbytes, high);
+    return nbytes;
+  }
+
+  virtual bool close_file()
+  {
+    if (files.size() == 0)
+      return false;
+    files.pop();
+    return true;
+  }
+};
+
+uint64_t model_state_digest(vw& all)
+{
+  state_digest_buf state;
+  bin_write_fixed(state, (char*)&all.sd->min_label, sizeof(all.sd->min_label));
+  bin_write_fixed(state, (char*)&all.sd->max_label, sizeof(all.sd->max_label));
+  if (all.l != nullptr)
+    all.l->save_load(state, false, false);
+  state.flush();
+  return ((uint64_t)state.high << 32) | state.low;
+}
+
+bool defer_weights(vw& all, io_buf& model_file, function<void(io_buf&, weight_snapshot&)> write_weights)
+{
+  if (dynamic_cast<state_digest_buf*>(&model_file) != nullptr)
+    return true; // the table is left out of the digest
+
+  snapshot_writer* job = all.save_job;
+  if (job == nullptr || &model_file != &job->model || job->model.write_weights || all.weights.sparse)
+    return false;
+  if (!job->weights.start(all.weights.dense_weights))
+    return false;
+  model_file.flush();
+  job->model.weights_at = job->model.data.size();
+  job->model.write_weights = write_weights;
+  return true;
+}
+
+void wait_for_background_save(vw& all)
+{
+  snapshot_writer* job = all.save_job;
+  if (job == nullptr)
+    return;
+  if (job->writer.joinable())
+    job->writer.join();
+  job->weights.finish();
+  if (job->failed)
+    all.trace_message << "warning: background save of the regressor failed" << endl;
+  delete job;
+  all.save_job = nullptr;
+}
+
 void save_predictor(vw& all, string reg_name, size_t current_pass)
 {
   stringstream filename;
   filename << reg_name;
   if (all.save_per_pass)
     filename << "." << current_pass;
-  dump_regressor(all, filename.str(), false);
+  bool delta = all.delta_checkpoint && reg_name != "" && DELTA_MODEL::track(all);
+  if (all.background_save && reg_name != "")
+  {
+    // Everything but a dense weight table is serialized into memory on this
+    // thread, where nothing else touches the model.  The table is write
+    // protected instead and streamed to the file from a thread of its own,
+    // which sees it as it is now while learning goes on.  Only one save is in
+    // flight so snapshots land in order.
+    wait_for_background_save(all);
+    snapshot_writer* job = new snapshot_writer;
+    job->failed = false;
+    all.save_job = job;
+    if (delta)
+      DELTA_MODEL::save(all, job->model);
+    else
+      dump_regressor(all, job->model, false);
+
+    string name = filename.str();
+    job->writer = thread([job, name]()
+    {
+      try
+      {
+        write_snapshot(name, *job);
+      }
+      catch (exception& e)
+      {
+        cerr << "background save: " << e.what() << endl;
+        job->failed = true;
+      }
+      job->weights.finish(); // give the table back as soon as possible
+    });
+    return;
+  }
+  if (delta)
+    DELTA_MODEL::save(all, filename.str());
+  else
+    dump_regressor(all, filename.str(), false);
+}
+
+// A span checkpoint is the model plus a small state file naming the job,
+// the node and the passes it covers.  The state file is written last, so a
+// node that dies in between resumes from the previous pass and the span
+// server refuses its tree instead of mixing up calls.
+static string span_state_name(vw& all)
+{
+  return all.span_checkpoint + ".state";
+}
+
+void save_span_checkpoint(vw& all)
+{
+  dump_regressor(all, all.span_checkpoint, false);
+
+  string state_name = span_state_name(all);
+  string start_name = state_name + string(".writing");
+  {
+    ofstream state(start_name.c_str());
+    po::variables_map& vm = all.opts_n_args.vm;
+    state << vm["unique_id"].as<size_t>() << " " << vm["total"].as<size_t>() << " "
+          << vm["node"].as<size_t>() << " " << all.current_pass << endl;
+    if (!state)
+      THROW("cannot write span checkpoint state " << start_name);
+  }
+  remove(state_name.c_str());
+  if (0 != rename(start_name.c_str(), state_name.c_str()))
+    THROW("cannot rename: " << start_name << " to " << state_name);
+}
+
+void remove_span_checkpoint(vw& all)
+{
+  remove(span_state_name(all).c_str());
+  remove(all.span_checkpoint.c_str());
+}
+
+// Returns the passes covered by the checkpoint when it was written by this
+// very node of this job, 0 otherwise.
+static size_t rejoin_pass(vw& all)
+{
+  ifstream state(span_state_name(all).c_str());
+  if (!state.good() || all.all_reduce == nullptr)
+    return 0;
+
+  size_t unique_id, total, node, pass;
+  if (!(state >> unique_id >> total >> node >> pass))
+    THROW("span checkpoint state " << span_state_name(all) << " is corrupted");
+  po::variables_map& vm = all.opts_n_args.vm;
+  if (unique_id != vm["unique_id"].as<size_t>() || total != vm["total"].as<size_t>() || node != vm["node"].as<size_t>())
+  {
+    if (!all.quiet)
+      all.trace_message << "ignoring span checkpoint " << all.span_checkpoint << " of node " << node << " of " << total
+                        << " in job " << unique_id << endl;
+    return 0;
+  }
+  return pass;
 }
 
 void finalize_regressor(vw& all, string reg_name)
 {
+  wait_for_background_save(all);
   if (!all.early_terminate)
   {
     if (all.per_feature_regularizer_output.length() > 0)
@@ -581,6 +836,16 @@ void parse_regressor_args(vw& all, io_buf& io_temp)
   if (vm.count("input_feature_regularizer"))
     regs.push_back(vm["input_feature_regularizer"].as<string>());
 
+  // a node restarted after a failure resumes from the weights the cluster
+  // last agreed on, which supersede whatever the job started from
+  if (all.span_checkpoint.length() > 0 && (all.span_resume_pass = rejoin_pass(all)) > 0)
+  {
+    if (!all.quiet)
+      all.trace_message << "rejoining after pass " << all.span_resume_pass << " from span checkpoint " << all.span_checkpoint << endl;
+    regs.clear();
+    regs.push_back(all.span_checkpoint);
+  }
+
   if (regs.size() > 0)
   {
     io_temp.open_file(regs[0].c_str(), all.stdin_off, io_buf::READ);
@@ -595,6 +860,28 @@ void parse_regressor_args(vw& all, io_buf& io_temp)
   }
 }
 
+// Delta checkpoints are applied in order on top of the initial regressor.
+// A rejoining node loaded its span checkpoint instead and only needs its
+// pass counters back.
+void apply_delta_regressors(vw& all)
+{
+  if (all.span_resume_pass > 0)
+  {
+    // loading the model reset the pass counters
+    all.current_pass = all.span_resume_pass;
+    all.passes_complete = all.span_resume_pass;
+    return;
+  }
+  po::variables_map& vm = all.opts_n_args.vm;
+  if (!vm.count("delta_regressor"))
+    return;
+  if (!vm.count("initial_regressor"))
+    THROW("--delta_regressor needs the model the deltas were taken from as initial regressor");
+  uint64_t weights = DELTA_MODEL::weights_digest(all);
+  for (const string& delta : vm["delta_regressor"].as< vector<string> >())
+    DELTA_MODEL::apply(all, delta, weights);
+}
+
 void parse_mask_regressor_args(vw& all)
 {
   po::variables_map& vm = all.opts_n_args.vm;
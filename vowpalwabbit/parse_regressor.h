@@ -4,18 +4,33 @@ individual contributors. All rights reserved.  Released under a BSD
 license as described in the file LICENSE.
  */
 #pragma once
+#include <functional>
 #include <string>
 #include "boost/program_options.hpp"
 #include "global_data.h"
 
+class weight_snapshot;
+
 namespace po = boost::program_options;
 
 void parse_regressor_args(vw& all, io_buf& io_temp);
+void apply_delta_regressors(vw& all);
 
 void finalize_regressor(vw& all, std::string reg_name);
 void initialize_regressor(vw& all);
 
 void save_predictor(vw& all, std::string reg_name, size_t current_pass);
+void wait_for_background_save(vw& all);
+// While a background save serializes the model, has the dense weight table
+// written by write_weights on the save's thread, from a copy-on-write
+// snapshot, instead of in place.  While model_state_digest serializes it,
+// the table is skipped.  Returns false if the caller has to write the table
+// itself.
+bool defer_weights(vw& all, io_buf& model_file, std::function<void(io_buf&, weight_snapshot&)> write_weights);
+// A digest of what a saved model would hold besides its weight table.
+uint64_t model_state_digest(vw& all);
+void save_span_checkpoint(vw& all);
+void remove_span_checkpoint(vw& all);
 void save_load_header(vw& all, io_buf& model_file, bool read, bool text);
 
 void parse_mask_regressor_args(vw& all);
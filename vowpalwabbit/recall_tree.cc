@@ -11,6 +11,7 @@ license as described in the file LICENSE.node
 
 #include "reductions.h"
 #include "rand48.h"
+#include "gd.h"
 
 using namespace std;
 using namespace LEARNER;
@@ -58,6 +59,13 @@ struct node
   }
 };
 
+struct beam_entry
+{
+  uint32_t node; // or the label, when ranking the candidates of a node
+  float score; // the weakest router margin along the path to node
+  bool stopped; // the path ends at node although it is internal
+};
+
 struct recall_tree
 {
   vw* all;
@@ -72,6 +80,19 @@ struct recall_tree
   float bern_hyper;
 
   bool randomized_routing;
+
+  bool fused; // routers and candidates are linear scores that can be read off the weights
+  features cache; // the example's resolved features, shared by every router and candidate
+  size_t num_linear; // cache entries before the first interaction feature
+  uint64_t* offsets; // scratch for scoring up to max(max_candidates, beam) learners at once
+  float* scores;
+
+  uint32_t beam; // number of labels the beam search reports, 0 for none
+  v_array<beam_entry> frontier;
+  v_array<beam_entry> next;
+  v_array<uint32_t> labels; // the labels the beam search has written
+  uint32_t* route_nodes;
+  float* route_scores;
 };
 
 float to_prob (float x)
@@ -257,31 +278,69 @@ void remove_node_id_feature (recall_tree& b, uint32_t cn, example& ec)
   ec.indices.pop ();
 }
 
-uint32_t oas_predict (recall_tree& b,
-                      single_learner& base,
-                      uint32_t cn,
-                      example& ec)
+// the raw score (ec.partial_prediction) base.predict would give learner i, from the cached features
+float cached_predict (recall_tree& b, single_learner& base, example& ec, uint32_t i)
+{
+  b.offsets[0] = ec.ft_offset + (uint32_t)(base.increment * i);
+  float score = 0.f;
+  GD::cached_multipredict (*b.all, b.cache, 0, b.cache.size (), b.offsets, 1, &score);
+  return score * (float)b.all->sd->contraction;
+}
+
+// all candidates of a leaf in one pass over the cached features.  The node id features
+// sit after the linear ones and before the interactions, as gd would visit them.
+void cached_candidate_scores (recall_tree& b,
+                              single_learner& base,
+                              uint32_t cn,
+                              example& ec,
+                              size_t count)
 {
+  vw& all = *b.all;
+  node_pred* ls = b.nodes[cn].preds.begin ();
+  for (size_t c = 0; c < count; c++)
+  {
+    b.offsets[c] = ec.ft_offset + (uint32_t)(base.increment * (b.max_routers + ls[c].label - 1));
+    b.scores[c] = 0.f;
+  }
+
+  GD::cached_multipredict (all, b.cache, 0, b.num_linear, b.offsets, count, b.scores);
+  if (!all.ignore_some_linear || !all.ignore_linear[node_id_namespace])
+  {
+    add_node_id_feature (b, cn, ec);
+    GD::cached_multipredict (all, ec.feature_space[node_id_namespace], 0,
+                             ec.feature_space[node_id_namespace].size (), b.offsets, count, b.scores);
+    remove_node_id_feature (b, cn, ec);
+  }
+  GD::cached_multipredict (all, b.cache, b.num_linear, b.cache.size (), b.offsets, count, b.scores);
+
+  for (size_t c = 0; c < count; c++)
+    b.scores[c] *= (float)all.sd->contraction;
+}
+
+// the raw scores of the candidates of node cn, in b.scores; returns how many there are
+size_t candidate_scores (recall_tree& b,
+                         single_learner& base,
+                         uint32_t cn,
+                         example& ec)
+{
+  size_t count = (std::min) (b.nodes[cn].preds.size (), b.max_candidates);
+  if (b.fused && !b.all->reg_mode)
+  {
+    cached_candidate_scores (b, base, cn, ec, count);
+    return count;
+  }
+
   MULTICLASS::label_t mc = ec.l.multi;
   uint32_t save_pred = ec.pred.multiclass;
 
-  uint32_t amaxscore = 0;
-
   add_node_id_feature (b, cn, ec);
   ec.l.simple = {FLT_MAX, 0.f, 0.f};
 
-  float maxscore = std::numeric_limits<float>::lowest ();
-  for (node_pred* ls = b.nodes[cn].preds.begin ();
-       ls != b.nodes[cn].preds.end () &&
-       ls < b.nodes[cn].preds.begin () + b.max_candidates;
-       ++ls)
+  node_pred* ls = b.nodes[cn].preds.begin ();
+  for (size_t c = 0; c < count; c++)
   {
-    base.predict (ec, b.max_routers + ls->label - 1);
-    if (amaxscore == 0 || ec.partial_prediction > maxscore)
-    {
-      maxscore = ec.partial_prediction;
-      amaxscore = ls->label;
-    }
+    base.predict (ec, b.max_routers + ls[c].label - 1);
+    b.scores[c] = ec.partial_prediction;
   }
 
   remove_node_id_feature (b, cn, ec);
@@ -289,6 +348,28 @@ uint32_t oas_predict (recall_tree& b,
   ec.l.multi = mc;
   ec.pred.multiclass = save_pred;
 
+  return count;
+}
+
+uint32_t oas_predict (recall_tree& b,
+                      single_learner& base,
+                      uint32_t cn,
+                      example& ec)
+{
+  size_t count = candidate_scores (b, base, cn, ec);
+
+  uint32_t amaxscore = 0;
+  float maxscore = std::numeric_limits<float>::lowest ();
+  node_pred* ls = b.nodes[cn].preds.begin ();
+  for (size_t c = 0; c < count; c++)
+  {
+    if (amaxscore == 0 || b.scores[c] > maxscore)
+    {
+      maxscore = b.scores[c];
+      amaxscore = ls[c].label;
+    }
+  }
+
   return amaxscore;
 }
 
@@ -335,11 +416,22 @@ predict_type predict_from (recall_tree& b,
   MULTICLASS::label_t mc = ec.l.multi;
   uint32_t save_pred = ec.pred.multiclass;
 
+  bool cached = b.fused && !b.all->reg_mode;
+  if (cached)
+    b.num_linear = GD::cache_features (*b.all, ec, b.cache);
+
   ec.l.simple = {FLT_MAX, 0.f, 0.f};
   while (b.nodes[cn].internal)
   {
-    base.predict (ec, b.nodes[cn].base_router);
-    uint32_t newcn = descend (b.nodes[cn], ec.partial_prediction);
+    float score;
+    if (cached)
+      score = cached_predict (b, base, ec, b.nodes[cn].base_router);
+    else
+    {
+      base.predict (ec, b.nodes[cn].base_router);
+      score = ec.partial_prediction;
+    }
+    uint32_t newcn = descend (b.nodes[cn], score);
     bool cond = stop_recurse_check (b, cn, newcn);
 
     if (cond)
@@ -354,11 +446,121 @@ predict_type predict_from (recall_tree& b,
   return predict_type (cn, oas_predict (b, base, cn, ec));
 }
 
+// the raw scores of the routers of nodes[0..count), in scores
+void route (recall_tree& b, single_learner& base, example& ec, uint32_t* nodes, size_t count, float* scores)
+{
+  if (b.fused && !b.all->reg_mode)
+  {
+    for (size_t c = 0; c < count; c++)
+    {
+      b.offsets[c] = ec.ft_offset + (uint32_t)(base.increment * b.nodes[nodes[c]].base_router);
+      scores[c] = 0.f;
+    }
+    GD::cached_multipredict (*b.all, b.cache, 0, b.cache.size (), b.offsets, count, scores);
+    for (size_t c = 0; c < count; c++)
+      scores[c] *= (float)b.all->sd->contraction;
+    return;
+  }
+
+  MULTICLASS::label_t mc = ec.l.multi;
+  uint32_t save_pred = ec.pred.multiclass;
+  ec.l.simple = {FLT_MAX, 0.f, 0.f};
+  for (size_t c = 0; c < count; c++)
+  {
+    base.predict (ec, b.nodes[nodes[c]].base_router);
+    scores[c] = ec.partial_prediction;
+  }
+  ec.l.multi = mc;
+  ec.pred.multiclass = save_pred;
+}
+
+// beam search for the nodes reached with the most confidence.  A path scores its weakest
+// router margin, signed towards the branch taken, and ends where predict_from would stop,
+// so the greedy path comes first.  The labels are reported by path, and by their
+// candidate score within a node.
+void predict_beam (recall_tree& b, single_learner& base, example& ec)
+{
+  b.frontier.clear ();
+  b.frontier.push_back ({0, (float)b.all->sd->max_label, false});
+  while (true)
+  {
+    size_t internal = 0;
+    for (beam_entry& e : b.frontier)
+      if (b.nodes[e.node].internal && !e.stopped)
+        b.route_nodes[internal++] = e.node;
+    if (internal == 0)
+      break;
+    route (b, base, ec, b.route_nodes, internal, b.route_scores);
+
+    b.next.clear ();
+    size_t c = 0;
+    for (beam_entry& e : b.frontier)
+      if (b.nodes[e.node].internal && !e.stopped)
+      {
+        float s = b.route_scores[c++];
+        uint32_t right = b.nodes[e.node].right, left = b.nodes[e.node].left;
+        if (stop_recurse_check (b, e.node, right))
+          b.next.push_back ({e.node, (std::min) (e.score, s), true});
+        else
+          b.next.push_back ({right, (std::min) (e.score, s), false});
+        if (stop_recurse_check (b, e.node, left))
+          b.next.push_back ({e.node, (std::min) (e.score, -s), true});
+        else
+          b.next.push_back ({left, (std::min) (e.score, -s), false});
+      }
+      else
+        b.next.push_back (e);
+    stable_sort (b.next.begin (), b.next.end (),
+                 [](const beam_entry& x, const beam_entry& y) { return x.score > y.score; });
+    if (b.next.size () > b.beam)
+      b.next.end () = b.next.begin () + b.beam;
+    swap (b.frontier, b.next);
+  }
+
+  stringstream ss;
+  b.labels.clear ();
+  for (size_t i = 0; i < b.frontier.size () && b.labels.size () < b.beam; i++)
+  {
+    uint32_t cn = b.frontier[i].node;
+    bool seen = false;
+    for (size_t j = 0; j < i; j++)
+      seen |= b.frontier[j].node == cn;
+    if (seen)
+      continue;
+
+    size_t count = candidate_scores (b, base, cn, ec);
+    b.next.clear ();
+    for (size_t c = 0; c < count; c++)
+      b.next.push_back ({b.nodes[cn].preds[c].label, b.scores[c], false});
+    stable_sort (b.next.begin (), b.next.end (),
+                 [](const beam_entry& x, const beam_entry& y) { return x.score > y.score; });
+
+    for (beam_entry& l : b.next)
+    {
+      if (b.labels.size () >= b.beam)
+        break;
+      bool written = false;
+      for (uint32_t w : b.labels)
+        written |= w == l.node;
+      if (written)
+        continue;
+      if (b.labels.size () > 0)
+        ss << ' ';
+      ss << l.node << ':' << l.score;
+      b.labels.push_back (l.node);
+    }
+  }
+  b.all->print_text (b.all->raw_prediction, ss.str (), ec.tag);
+}
+
 void predict (recall_tree& b,  single_learner& base, example& ec)
 {
   predict_type pred = predict_from (b, base, ec, 0);
 
   ec.pred.multiclass = pred.class_prediction;
+
+  if (b.beam > 0 && b.all->raw_prediction > 0)
+    predict_beam (b, base, ec);
 }
 
 float train_node (recall_tree& b,
@@ -464,6 +666,14 @@ void finish (recall_tree& b)
   for (size_t i = 0; i < b.nodes.size (); ++i)
     b.nodes[i].preds.delete_v ();
   b.nodes.delete_v ();
+  b.cache.delete_v ();
+  b.frontier.delete_v ();
+  b.next.delete_v ();
+  b.labels.delete_v ();
+  free (b.offsets);
+  free (b.scores);
+  free (b.route_nodes);
+  free (b.route_scores);
 }
 
 #define writeit(what,str)                               \
@@ -572,7 +782,8 @@ base_learner* recall_tree_setup(arguments& arg)
       ("bern_hyper", tree->bern_hyper, 1.f, "recall tree depth penalty")
       .keep("max_depth", tree->max_depth, "maximum depth of the tree, default log_2 (#classes)")
       .keep("node_only", tree->node_only, false, "only use node features, not full path features")
-      .keep("randomized_routing", tree->randomized_routing, false, "randomized routing").missing())
+      .keep("randomized_routing", tree->randomized_routing, false, "randomized routing")
+      ("recall_tree_beam", tree->beam, (uint32_t)0, "beam search the tree and write the <arg> best labels, with their scores, as raw predictions").missing())
     return nullptr;
 
   tree->all = arg.all;
@@ -585,6 +796,12 @@ base_learner* recall_tree_setup(arguments& arg)
 
   init_tree (*tree.get());
 
+  size_t width = (std::max) (tree->max_candidates, (size_t)tree->beam);
+  tree->offsets = calloc_or_throw<uint64_t> (width);
+  tree->scores = calloc_or_throw<float> (width);
+  tree->route_nodes = calloc_or_throw<uint32_t> (width);
+  tree->route_scores = calloc_or_throw<float> (width);
+
   if (!arg.all->quiet)
     arg.all->trace_message << "recall_tree:"
                       << " node_only = " << tree->node_only
@@ -594,8 +811,15 @@ base_learner* recall_tree_setup(arguments& arg)
                       << (arg.all->training ? (tree->randomized_routing ? "randomized" : "deterministic") : "n/a testonly")
                       << std::endl;
 
+  single_learner* base = as_singleline (setup_base (arg));
+  tree->fused = base == arg.all->scorer && arg.all->linear_scorer && !arg.all->audit &&
+                (!arg.vm.count ("link") || arg.vm["link"].as<string> () == "identity");
+  for (string& inter : arg.all->interactions)
+    if (inter.find ((char)node_id_namespace) != string::npos)
+      tree->fused = false;
+
   learner<recall_tree,example>& l =
-    init_multiclass_learner (tree, as_singleline(setup_base (arg)), learn, predict,
+    init_multiclass_learner (tree, base, learn, predict,
                              arg.all->p, tree->max_routers + tree->k);
   l.set_save_load(save_load_tree);
   l.set_finish (finish);
@@ -2,6 +2,7 @@
 #include "correctedMath.h"
 #include "reductions.h"
 #include "vw_exception.h"
+#include "gd.h"
 
 using namespace std;
 struct scorer { vw* all; }; // for set_minmax, loss
@@ -35,6 +36,41 @@ void update(scorer& s, LEARNER::single_learner& base, example& ec)
   base.update(ec);
 }
 
+// a label that widens the label range changes the loss seen by the updates
+// after it, so that (rare) case goes one learner at a time
+void multiupdate(scorer& s, LEARNER::single_learner& base, example& ec, size_t count, size_t, polyprediction* pred, float* label, float* weight)
+{
+  shared_data* sd = s.all->sd;
+  bool widens = false;
+  if (s.all->set_minmax != noop_mm)
+    for (size_t c=0; c<count; c++)
+      if (label[c] != FLT_MAX && (label[c] < sd->min_label || label[c] > sd->max_label))
+        widens = true;
+
+  if (!widens)
+  {
+    base.multiupdate(ec, 0, count, pred, label, weight);
+    return;
+  }
+
+  polyprediction save_pred = ec.pred;
+  float save_label = ec.l.simple.label;
+  float save_weight = ec.weight;
+  for (size_t c=0; c<count; c++)
+    if (label[c] != FLT_MAX)
+    {
+      ec.pred.scalar = pred[c].scalar;
+      ec.l.simple.label = label[c];
+      if (weight)
+        ec.weight = weight[c];
+      s.all->set_minmax(sd, label[c]);
+      base.update(ec, c);
+    }
+  ec.pred = save_pred;
+  ec.l.simple.label = save_label;
+  ec.weight = save_weight;
+}
+
 // y = f(x) -> [0, 1]
 inline float logistic(float in) { return 1.f / (1.f + correctedExp(- in)); }
 
@@ -56,7 +92,9 @@ LEARNER::base_learner* scorer_setup(arguments& arg)
 
   s->all = arg.all;
 
-  auto base = as_singleline(setup_base(arg));
+  LEARNER::base_learner* (*below)(arguments&);
+  auto base = as_singleline(setup_base(arg, below));
+  arg.all->linear_scorer = below == GD::setup;
   LEARNER::learner<scorer,example>* l;
   void (*multipredict_f)(scorer&, LEARNER::single_learner&, example&, size_t, size_t, polyprediction*, bool) = multipredict<id>;
 
@@ -84,6 +122,7 @@ LEARNER::base_learner* scorer_setup(arguments& arg)
 
   l->set_multipredict(multipredict_f);
   l->set_update(update);
+  l->set_multiupdate(multiupdate);
   arg.all->scorer = LEARNER::as_singleline(l);
 
   return make_base(*arg.all->scorer);
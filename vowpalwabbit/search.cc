@@ -21,6 +21,7 @@ license as described in the file LICENSE.
 #include "active.h"
 #include "label_dictionary.h"
 #include "vw_exception.h"
+#include "thread_pool.h"
 
 using namespace LEARNER;
 using namespace std;
@@ -61,7 +62,7 @@ const bool PRINT_CLOCK_TIME =0;
 string   neighbor_feature_space("neighbor");
 string   condition_feature_space("search_condition");
 
-uint32_t AUTO_CONDITION_FEATURES = 1, AUTO_HAMMING_LOSS = 2, EXAMPLES_DONT_CHANGE = 4, IS_LDF = 8, NO_CACHING = 16, ACTION_COSTS = 32;
+uint32_t AUTO_CONDITION_FEATURES = 1, AUTO_HAMMING_LOSS = 2, EXAMPLES_DONT_CHANGE = 4, IS_LDF = 8, NO_CACHING = 16, ACTION_COSTS = 32, STATELESS_RUN = 64;
 enum SearchState { INITIALIZE, INIT_TEST, INIT_TRAIN, LEARN, GET_TRUTH_STRING };
 enum RollMethod { POLICY, ORACLE, MIX_PER_STATE, MIX_PER_ROLL, NO_ROLLOUT };
 
@@ -122,11 +123,167 @@ struct action_cache
 };
 std::ostream& operator << (std::ostream& os, const action_cache& x) { os << x.k << ':' << x.cost; if (x.is_opt) os << '*'; return os; }
 
+const size_t default_cache_mb = 256;
+
+// memoizes predictions, keyed on the bytes of the tag, policy, learner and
+// conditioning of a prediction.  keys are packed into one arena and the
+// table is open-addressed, so once both have grown to fit an example,
+// caching costs no allocation.  clear() retires every entry by bumping the
+// generation instead of touching the table.
+class memo_cache
+{
+  struct entry
+  {
+    uint64_t hash;
+    uint32_t generation;           // entry is live iff this is the cache's generation
+    uint32_t key_len;
+    size_t key_pos;                // offset into arena
+    scored_action val;
+  };
+
+  v_array<entry> table;            // size is zero or a power of two
+  v_array<unsigned char> arena;
+  size_t occupants;
+  uint32_t generation;
+  size_t budget;                   // bytes the table and arena may use together
+
+  bool key_at(entry& e, const unsigned char* key, size_t len, uint64_t hash)
+  {
+    return (e.hash == hash) && (e.key_len == len) && (memcmp(arena.begin() + e.key_pos, key, len) == 0);
+  }
+
+  size_t slot(uint64_t hash, const unsigned char* key, size_t len)
+  {
+    size_t mask = table.size() - 1;
+    size_t i = hash & mask;
+    while ((table[i].generation == generation) && !key_at(table[i], key, len, hash))
+      i = (i + 1) & mask;
+    return i;
+  }
+
+  bool grow()
+  {
+    size_t new_size = (table.size() == 0) ? 1024 : 2 * table.size();
+    if ((new_size * sizeof(entry) + arena.size()) > budget) return false;
+
+    v_array<entry> old = table;
+    table = v_init<entry>();
+    table.resize(new_size);       // zeroed, so nothing is live
+    table.end() = table.begin() + new_size;
+    for (entry& e : old)
+      if (e.generation == generation)
+        table[slot(e.hash, arena.begin() + e.key_pos, e.key_len)] = e;
+    old.delete_v();
+    return true;
+  }
+
+public:
+  size_t lookups, hits, dropped, peak_bytes;
+
+  void init(size_t budget_bytes)
+  {
+    table = v_init<entry>();
+    arena = v_init<unsigned char>();
+    occupants = 0;
+    generation = 1;
+    budget = budget_bytes;
+    lookups = hits = dropped = peak_bytes = 0;
+  }
+
+  void set_budget(size_t budget_bytes) { budget = budget_bytes; }
+
+  void delete_v() { table.delete_v(); arena.delete_v(); }
+
+  void clear()
+  {
+    occupants = 0;
+    arena.clear();
+    if (++generation == 0)       // wrapped: retire entries the slow way
+    {
+      for (entry& e : table) e.generation = 0;
+      generation = 1;
+    }
+  }
+
+  // only reads, so many threads may look up at once
+  bool find(const unsigned char* key, size_t len, uint64_t hash, scored_action& val)
+  {
+    if (occupants == 0) return false;
+    entry& e = table[slot(hash, key, len)];
+    if (e.generation != generation) return false;
+    val = e.val;
+    return true;
+  }
+
+  void put(const unsigned char* key, size_t len, uint64_t hash, scored_action val)
+  {
+    if (((occupants + 1) * 2 > table.size()) && !grow())
+    {
+      dropped++;
+      return;
+    }
+    entry& e = table[slot(hash, key, len)];
+    if (e.generation == generation)
+    {
+      e.val = val;
+      return;
+    }
+    size_t bytes = table.size() * sizeof(entry) + arena.size() + len;
+    if (bytes > budget)
+    {
+      dropped++;
+      return;
+    }
+    if (bytes > peak_bytes) peak_bytes = bytes;
+
+    e.hash = hash;
+    e.generation = generation;
+    e.key_len = (uint32_t)len;
+    e.key_pos = arena.size();
+    push_many(arena, key, len);
+    e.val = val;
+    occupants++;
+  }
+
+  // copy in what another cache knows and this one does not
+  void merge_from(memo_cache& other)
+  {
+    for (entry& e : other.table)
+      if (e.generation == other.generation)
+      {
+        scored_action unused;
+        if (!find(other.arena.begin() + e.key_pos, e.key_len, e.hash, unused))
+          put(other.arena.begin() + e.key_pos, e.key_len, e.hash, e.val);
+      }
+    lookups += other.lookups;
+    hits += other.hits;
+    dropped += other.dropped;
+    other.lookups = other.hits = other.dropped = 0;
+  }
+};
+
+struct rollout_worker;
+
+// the part of the search state that changes from one example or time step to
+// the next; rollout workers get a copy of it before each parallel rollout
+struct search_progress
+{
+  LEARNER::base_learner* base_learner;
+  uint64_t offset;
+  size_t learn_t;                // what time step are we learning on?
+  v_array<scored_action> train_trajectory; // the training trajectory
+  uint32_t current_policy;       // what policy are we training right now?
+  size_t read_example_last_id;
+  size_t read_example_last_pass;
+  size_t total_examples_generated;
+  bool force_oracle;             // insist on using the oracle to make predictions
+};
+
 struct search_private
 {
   vw* all;
+  search_progress progress;      // what a rollout reads that moves between examples
 
-  uint64_t offset;
   bool auto_condition_features;  // do you want us to automatically add conditioning features?
   bool auto_hamming_loss;        // if you're just optimizing hamming loss, we can do it for you!
   bool examples_dont_change;     // set to true if you don't do any internal example munging
@@ -165,8 +322,6 @@ struct search_private
   polylabel* allowed_actions_cache;
 
   size_t loss_declared_cnt;      // how many times did run declare any loss (implicitly or explicitly)?
-  v_array<scored_action> train_trajectory; // the training trajectory
-  size_t learn_t;                // what time step are we learning on?
   size_t learn_a_idx;            // what action index are we trying?
   bool done_with_all_actions;    // set to true when there are no more learn_a_idx to go
 
@@ -175,7 +330,6 @@ struct search_private
   float train_loss;              // loss incurred when run INIT_TRAIN
 
   bool hit_new_pass;             // have we hit a new pass?
-  bool force_oracle;             // insist on using the oracle to make predictions
   float perturb_oracle;          // with this probability, choose a random action instead of oracle action
 
   size_t num_calls_to_run, num_calls_to_run_previous, save_every_k_runs;
@@ -203,19 +357,16 @@ struct search_private
   bool   adaptive_beta;          // used to implement dagger-like algorithms. if true, beta = 1-(1-alpha)^n after n updates, and policy is mixed with oracle as \pi' = (1-beta)\pi^* + beta \pi
   size_t passes_per_policy;      // if we're not in dagger-mode, then we need to know how many passes to train a policy
 
-  uint32_t current_policy;       // what policy are we training right now?
 
   // various statistics for reporting
   size_t num_features;
   uint32_t total_number_of_policies;
-  size_t read_example_last_id;
   size_t passes_since_new_policy;
-  size_t read_example_last_pass;
-  size_t total_examples_generated;
   size_t total_predictions_made;
-  size_t total_cache_hits;
 
-  v_hashmap<unsigned char*, scored_action> cache_hash_map;
+  memo_cache cache;               // predictions already made for this example
+  v_array<unsigned char> cache_key; // scratch space for building cache keys
+  bool report_cache;             // print cache statistics at the end
 
   // for foreach_feature temporary storage for conditioning
   uint64_t dat_new_feature_idx;
@@ -239,7 +390,6 @@ struct search_private
   bool active_csoaa;
   float active_csoaa_verify;
 
-  LEARNER::base_learner* base_learner;
   clock_t start_clock_time;
 
   CS::label empty_cs_label;
@@ -249,6 +399,17 @@ struct search_private
   BaseTask* metaoverride;
   size_t meta_t;  // the metatask has it's own notion of time. meta_t+t, during a single run, is the way to think about the "real" decision step but this really only matters for caching purposes
   v_array< v_array<action_cache>* > memo_foreach_action; // when foreach_action is on, we need to cache TRAIN trajectory actions for LEARN
+
+  uint64_t* random_state;        // all->random_state, or a rollout worker's own
+  size_t learn_action_cnt;       // how many actions there are at learn_t, known after the first rollout
+  bool stateless_run;            // task promises that run only reads its task data
+
+  // for --search_rollout_threads
+  thread_pool* rollout_pool;     // rolls out the actions of a time step concurrently
+  v_array<rollout_worker*> rollout_workers; // one per thread of rollout_pool
+  v_array<float> rollout_losses; // loss of each action rolled out by the workers
+  bool rollout_examples_copied;  // workers hold copies of the current example sequence
+  search_private* rollout_parent;// on a rollout worker, the instance whose cache it reads
 };
 
   search::search() { priv = &calloc_or_throw<search_private>(); }
@@ -281,29 +442,29 @@ int random_policy(search_private& priv, bool allow_current, bool allow_optimal,
 {
   if (priv.beta >= 1)
   {
-    if (allow_current) return (int)priv.current_policy;
-    if (priv.current_policy > 0) return (((int)priv.current_policy)-1);
+    if (allow_current) return (int)priv.progress.current_policy;
+    if (priv.progress.current_policy > 0) return (((int)priv.progress.current_policy)-1);
     if (allow_optimal) return -1;
     std::cerr << "internal error (bug): no valid policies to choose from!  defaulting to current" << std::endl;
-    return (int)priv.current_policy;
+    return (int)priv.progress.current_policy;
   }
 
-  int num_valid_policies = (int)priv.current_policy + allow_optimal + allow_current;
+  int num_valid_policies = (int)priv.progress.current_policy + allow_optimal + allow_current;
   int pid = -1;
 
   if (num_valid_policies == 0)
   {
     std::cerr << "internal error (bug): no valid policies to choose from!  defaulting to current" << std::endl;
-    return (int)priv.current_policy;
+    return (int)priv.progress.current_policy;
   }
   else if (num_valid_policies == 1)
     pid = 0;
   else if (num_valid_policies == 2)
-    pid = (advance_prng ? merand48(priv.all->random_state) : merand48_noadvance(priv.all->random_state)) >= priv.beta;
+    pid = (advance_prng ? merand48(*priv.random_state) : merand48_noadvance(*priv.random_state)) >= priv.beta;
   else
   {
     // SPEEDUP this up in the case that beta is small!
-    float r = (advance_prng ? merand48(priv.all->random_state) : merand48_noadvance(priv.all->random_state));
+    float r = (advance_prng ? merand48(*priv.random_state) : merand48_noadvance(*priv.random_state));
     pid = 0;
 
     if (r > priv.beta)
@@ -320,7 +481,7 @@ int random_policy(search_private& priv, bool allow_current, bool allow_optimal,
   if (allow_optimal && (pid == num_valid_policies-1))
     return -1; // this is the optimal policy
 
-  pid = (int)priv.current_policy - pid;
+  pid = (int)priv.progress.current_policy - pid;
   if (!allow_current)
     pid--;
 
@@ -454,8 +615,8 @@ void print_update(search_private& priv)
 
   char inst_cntr[9];  number_to_natural((size_t)all.sd->example_number, inst_cntr);
   char total_pred[8]; number_to_natural(priv.total_predictions_made, total_pred);
-  char total_cach[8]; number_to_natural(priv.total_cache_hits, total_cach);
-  char total_exge[8]; number_to_natural(priv.total_examples_generated, total_exge);
+  char total_cach[8]; number_to_natural(priv.cache.hits, total_cach);
+  char total_exge[8]; number_to_natural(priv.progress.total_examples_generated, total_exge);
 
   fprintf(stderr, "%-10.6f %-10.6f %8s  [%s] [%s] %5d %5d  %7s  %7s  %7s  %-8f",
           avg_loss,
@@ -463,8 +624,8 @@ void print_update(search_private& priv)
           inst_cntr,
           true_label,
           pred_label,
-          (int)priv.read_example_last_pass,
-          (int)priv.current_policy,
+          (int)priv.progress.read_example_last_pass,
+          (int)priv.progress.current_policy,
           total_pred,
           total_cach,
           total_exge,
@@ -591,10 +752,10 @@ void reset_search_structure(search_private& priv)
   priv.force_setup_ec_ref = false;
   if (priv.adaptive_beta)
   {
-    float x = - log1pf(- priv.alpha) * (float)priv.total_examples_generated;
+    float x = - log1pf(- priv.alpha) * (float)priv.progress.total_examples_generated;
     static const float log_of_2 = (float)0.6931471805599453;
     priv.beta = (x <= log_of_2) ? -expm1f(-x) : (1-expf(-x)); // numerical stability
-    //float priv_beta = 1.f - powf(1.f - priv.alpha, (float)priv.total_examples_generated);
+    //float priv_beta = 1.f - powf(1.f - priv.alpha, (float)priv.progress.total_examples_generated);
     //assert( fabs(priv_beta - priv.beta) < 1e-2 );
     if (priv.beta > 1) priv.beta = 1;
   }
@@ -610,7 +771,7 @@ void reset_search_structure(search_private& priv)
 
   if (! priv.cb_learner)   // was: if rollout_all_actions
   {
-    priv.all->random_state = (uint32_t)(priv.read_example_last_id * 147483 + 4831921) * 2147483647;
+    *priv.random_state = (uint32_t)(priv.progress.read_example_last_id * 147483 + 4831921) * 2147483647;
   }
 }
 
@@ -964,7 +1125,7 @@ action choose_oracle_action(search_private& priv, size_t ec_cnt, const action* o
         {
           cdbg << ", hit @ " << k;
           count++;
-          if ((count == 1) || (merand48(priv.all->random_state) < 1./(float)count))
+          if ((count == 1) || (merand48(*priv.random_state) < 1./(float)count))
           {
             a = (allowed_actions == nullptr) ? (uint32_t)(k+1) : allowed_actions[k];
             cdbg << "***";
@@ -976,12 +1137,12 @@ action choose_oracle_action(search_private& priv, size_t ec_cnt, const action* o
 
   if (a == (action)-1)
   {
-    if ((priv.perturb_oracle > 0.) && (priv.state == INIT_TRAIN) && (merand48(priv.all->random_state) < priv.perturb_oracle))
+    if ((priv.perturb_oracle > 0.) && (priv.state == INIT_TRAIN) && (merand48(*priv.random_state) < priv.perturb_oracle))
       oracle_actions_cnt = 0;
-    a = ( oracle_actions_cnt > 0) ?  oracle_actions[random(priv.all->random_state, oracle_actions_cnt )] :
-        (allowed_actions_cnt > 0) ? allowed_actions[random(priv.all->random_state, allowed_actions_cnt)] :
-        priv.is_ldf ? (action)random(priv.all->random_state, ec_cnt) :
-        (action)(1 + random(priv.all->random_state, priv.A));
+    a = ( oracle_actions_cnt > 0) ?  oracle_actions[random(*priv.random_state, oracle_actions_cnt )] :
+        (allowed_actions_cnt > 0) ? allowed_actions[random(*priv.random_state, allowed_actions_cnt)] :
+        priv.is_ldf ? (action)random(*priv.random_state, ec_cnt) :
+        (action)(1 + random(*priv.random_state, priv.A));
   }
   cdbg << "choose_oracle_action from oracle_actions = ["; for (size_t i=0; i<oracle_actions_cnt; i++) cdbg << " " << oracle_actions[i]; cdbg << " ], ret=" << a << endl;
   if (need_memo_foreach_action(priv) && (priv.state == INIT_TRAIN))
@@ -1009,14 +1170,16 @@ action single_prediction_notLDF(search_private& priv, example& ec, int policy, c
   vw& all = *priv.all;
   polylabel old_label = ec.l;
   bool need_partial_predictions = need_memo_foreach_action(priv) || (priv.metaoverride && priv.metaoverride->_foreach_action) || (override_action != (action)-1) || priv.active_csoaa;
-  if ((allowed_actions_cnt > 0) || need_partial_predictions)
+  // rollout workers always name every action: for an empty label csoaa
+  // predicts into scratch space that is shared by all threads
+  if ((allowed_actions_cnt > 0) || need_partial_predictions || priv.rollout_parent)
     ec.l = allowed_actions_to_ld(priv, 1, allowed_actions, allowed_actions_cnt, allowed_actions_cost);
   else
     ec.l.cs = priv.empty_cs_label;
 
   cdbg << "allowed_actions_cnt=" << allowed_actions_cnt << ", ec.l = ["; for (size_t i=0; i<ec.l.cs.costs.size(); i++) cdbg << ' ' << ec.l.cs.costs[i].class_index << ':' << ec.l.cs.costs[i].x; cdbg << " ]" << endl;
 
-  as_singleline(priv.base_learner)->predict(ec, policy);
+  as_singleline(priv.progress.base_learner)->predict(ec, policy);
 
   uint32_t act = ec.pred.multiclass;
   cdbg << "a=" << act << " from"; if (allowed_actions) { for (size_t ii=0; ii<allowed_actions_cnt; ii++) cdbg << ' ' << allowed_actions[ii]; } cdbg << endl;
@@ -1155,9 +1318,9 @@ action single_prediction_LDF(search_private& priv, example* ecs, size_t ec_cnt,
 
     multi_ex tmp;
     uint64_t old_offset = ecs[a].ft_offset;
-    ecs[a].ft_offset = priv.offset;
+    ecs[a].ft_offset = priv.progress.offset;
     tmp.push_back(&ecs[a]);
-    as_multiline(priv.base_learner)->predict(tmp, policy);
+    as_multiline(priv.progress.base_learner)->predict(tmp, policy);
 
     ecs[a].ft_offset = old_offset;
     cdbg << "partial_prediction[" << a << "] = " << ecs[a].partial_prediction << endl;
@@ -1239,19 +1402,10 @@ int choose_policy(search_private& priv, bool advance_prng=true)
   }
 }
 
-bool cached_item_equivalent(unsigned char* const & A, unsigned char* const& B)
-{
-  size_t sz_A = *A;
-  size_t sz_B = *B;
-  if (sz_A != sz_B) return false;
-  return memcmp(A, B, sz_A) == 0;
-}
 
-void free_key(unsigned char* mem, scored_action) { free(mem); } // sa.repr.delete_v(); }
-void clear_cache_hash_map(search_private& priv)
+template<class T> void append_bytes(v_array<unsigned char>& key, const T& x)
 {
-  priv.cache_hash_map.iter(free_key);
-  priv.cache_hash_map.clear();
+  push_many(key, (const unsigned char*)&x, sizeof(T));
 }
 
 // returns true if found and do_store is false. if do_store is true, always returns true.
@@ -1260,37 +1414,34 @@ bool cached_action_store_or_find(search_private& priv, ptag mytag, const ptag* c
   if (priv.no_caching) return do_store;
   if (mytag == 0) return do_store; // don't attempt to cache when tag is zero
 
-  size_t sz  = sizeof(size_t) + sizeof(ptag) + sizeof(int) + sizeof(size_t) + sizeof(size_t) + condition_on_cnt * (sizeof(ptag) + sizeof(action) + sizeof(char));
-  if (sz % 4 != 0)
-    sz += 4 - (sz % 4); // make sure sz aligns to 4 so that uniform_hash does the right thing
-
-  unsigned char* item = calloc_or_throw<unsigned char>(sz);
-  unsigned char* here = item;
-  *here = (unsigned char)sz; here += sizeof(size_t);
-  *here = mytag;             here += sizeof(ptag);
-  *here = policy;            here += sizeof(int);
-  *here = (unsigned char)learner_id;        here += sizeof(size_t);
-  *here = (unsigned char)condition_on_cnt;  here += sizeof(size_t);
+  v_array<unsigned char>& key = priv.cache_key;
+  key.clear();
+  append_bytes(key, mytag);
+  append_bytes(key, policy);
+  append_bytes(key, learner_id);
   for (size_t i=0; i<condition_on_cnt; i++)
   {
-    *here = condition_on[i];             here += sizeof(ptag);
-    *here = condition_on_actions[i].a;   here += sizeof(action);
-    *here = condition_on_names[i];       here += sizeof(char);  // SPEEDUP: should we align this at 4?
+    append_bytes(key, condition_on[i]);
+    append_bytes(key, condition_on_actions[i].a);
+    append_bytes(key, condition_on_names[i]);
   }
-  uint64_t hash = uniform_hash(item, sz, 3419);
+  uint64_t hash = uniform_hash(key.begin(), key.size(), 3419);
 
   if (do_store)
   {
-    priv.cache_hash_map.put(item, hash, scored_action(a, a_cost));
+    priv.cache.put(key.begin(), key.size(), hash, scored_action(a, a_cost));
     return true;
   }
   else     // its a find
   {
-    scored_action sa = priv.cache_hash_map.get(item, hash);
+    scored_action sa;
+    priv.cache.lookups++;
+    bool found = priv.cache.find(key.begin(), key.size(), hash, sa) ||
+                 (priv.rollout_parent && priv.rollout_parent->cache.find(key.begin(), key.size(), hash, sa));
+    if (!found) return false;
     a = sa.a;
     a_cost = sa.s;
-    free(item);
-    return a != (action)-1;
+    return true;
   }
 }
 
@@ -1325,15 +1476,15 @@ void generate_training_example(search_private& priv, polylabel& losses, float we
     if (add_conditioning) add_example_conditioning(priv, ec, priv.learn_condition_on.size(), priv.learn_condition_on_names.begin(), priv.learn_condition_on_act.begin());
     for (size_t is_local=0; is_local<= (size_t)priv.xv; is_local++)
     {
-      int learner = select_learner(priv, priv.current_policy, priv.learn_learner_id, true, is_local > 0);
+      int learner = select_learner(priv, priv.progress.current_policy, priv.learn_learner_id, true, is_local > 0);
       ec.in_use = true;
       cdbg << "BEGIN base_learner->learn(ec, " << learner << ")" << endl;
-      as_singleline(priv.base_learner)->learn(ec, learner);
+      as_singleline(priv.progress.base_learner)->learn(ec, learner);
       cdbg << "END   base_learner->learn(ec, " << learner << ")" << endl;
     }
     if (add_conditioning) del_example_conditioning(priv, ec);
     ec.l = old_label;
-    priv.total_examples_generated++;
+    priv.progress.total_examples_generated++;
   }
   else                  // is  LDF
   {
@@ -1350,7 +1501,7 @@ void generate_training_example(search_private& priv, polylabel& losses, float we
 
     for (size_t is_local=0; is_local<= (size_t)priv.xv; is_local++)
     {
-      int learner = select_learner(priv, priv.current_policy, priv.learn_learner_id, true, is_local > 0);
+      int learner = select_learner(priv, priv.progress.current_policy, priv.learn_learner_id, true, is_local > 0);
 
       // create an example collection for
 
@@ -1368,15 +1519,15 @@ void generate_training_example(search_private& priv, polylabel& losses, float we
         lab.costs[0].x = losses.cs.costs[a - start_K].x;
         ec.in_use = true;
         // store the offset to restore it later
-        ec.ft_offset = priv.offset;
+        ec.ft_offset = priv.progress.offset;
         // create the example collection used to learn
         tmp.push_back(&ec);
         cdbg << "generate_training_example called learn on action a=" << a << ", costs.size=" << lab.costs.size() << " ec=" << &ec << endl;
-        priv.total_examples_generated++;
+        priv.progress.total_examples_generated++;
       }
 
       // learn with the multiline example
-      as_multiline(priv.base_learner)->learn(tmp, learner);
+      as_multiline(priv.progress.base_learner)->learn(tmp, learner);
 
       // restore the offsets in examples
       int i = 0;
@@ -1409,9 +1560,9 @@ bool search_predictNeedsExample(search_private& priv)
     if (priv.rollout_method == NO_ROLLOUT) return true;
     break;
   case LEARN:
-    if (priv.t+priv.meta_t < priv.learn_t) return false;  // TODO: in meta search mode with foreach feature we'll need it even here
-    if (priv.t+priv.meta_t == priv.learn_t) return true;  // SPEEDUP: we really only need it on the last learn_a, but this is hard to know...
-    // t > priv.learn_t
+    if (priv.t+priv.meta_t < priv.progress.learn_t) return false;  // TODO: in meta search mode with foreach feature we'll need it even here
+    if (priv.t+priv.meta_t == priv.progress.learn_t) return true;  // SPEEDUP: we really only need it on the last learn_a, but this is hard to know...
+    // t > priv.progress.learn_t
     if ((priv.rollout_num_steps > 0) && (priv.loss_declared_cnt >= priv.rollout_num_steps)) return false; // skipping
     break;
   }
@@ -1454,7 +1605,7 @@ action search_predict(search_private& priv, example* ecs, size_t ec_cnt, ptag my
   if (allowed_actions_cost != nullptr) assert(oracle_actions == nullptr);
 
   // if we're just after the string, choose an oracle action
-  if ((priv.state == GET_TRUTH_STRING) || priv.force_oracle)
+  if ((priv.state == GET_TRUTH_STRING) || priv.progress.force_oracle)
   {
     action a = choose_oracle_action(priv, ec_cnt, oracle_actions, oracle_actions_cnt, allowed_actions, allowed_actions_cnt, allowed_actions_cost);
     //if (priv.metaoverride && priv.metaoverride->_post_prediction)
@@ -1464,12 +1615,12 @@ action search_predict(search_private& priv, example* ecs, size_t ec_cnt, ptag my
   }
 
   // if we're in LEARN mode and before learn_t, return the train action
-  if ((priv.state == LEARN) && (t < priv.learn_t))
+  if ((priv.state == LEARN) && (t < priv.progress.learn_t))
   {
-    assert(t < priv.train_trajectory.size());
-    action a = priv.train_trajectory[t].a;
-    a_cost   = priv.train_trajectory[t].s;
-    cdbg << "LEARN " << t << " < priv.learn_t ==> a=" << a << ", a_cost=" << a_cost << endl;
+    assert(t < priv.progress.train_trajectory.size());
+    action a = priv.progress.train_trajectory[t].a;
+    a_cost   = priv.progress.train_trajectory[t].s;
+    cdbg << "LEARN " << t << " < priv.progress.learn_t ==> a=" << a << ", a_cost=" << a_cost << endl;
     if (priv.metaoverride && priv.metaoverride->_foreach_action)
       foreach_action_from_cache(priv, t);
     if (priv.metaoverride && priv.metaoverride->_post_prediction)
@@ -1485,12 +1636,13 @@ action search_predict(search_private& priv, example* ecs, size_t ec_cnt, ptag my
   //   - choose the next action
   //   - decide if we're done
   //   - if we are, then copy/mark the example ref
-  if ((priv.state == LEARN) && (t == priv.learn_t))
+  if ((priv.state == LEARN) && (t == priv.progress.learn_t))
   {
     action a = (action)priv.learn_a_idx;
     priv.loss_declared_cnt = 0;
+    priv.learn_action_cnt = valid_action_cnt;
 
-    cdbg << "LEARN " << t << " = priv.learn_t ==> a=" << a << ", learn_a_idx=" << priv.learn_a_idx << " valid_action_cnt=" << valid_action_cnt << endl;
+    cdbg << "LEARN " << t << " = priv.progress.learn_t ==> a=" << a << ", learn_a_idx=" << priv.learn_a_idx << " valid_action_cnt=" << valid_action_cnt << endl;
     priv.learn_a_idx++;
 
     // check to see if we're done with available actions
@@ -1572,7 +1724,7 @@ action search_predict(search_private& priv, example* ecs, size_t ec_cnt, ptag my
     return a;
   }
 
-  if ((priv.state == LEARN) && (t > priv.learn_t) && (priv.rollout_num_steps > 0) && (priv.loss_declared_cnt >= priv.rollout_num_steps))
+  if ((priv.state == LEARN) && (t > priv.progress.learn_t) && (priv.rollout_num_steps > 0) && (priv.loss_declared_cnt >= priv.rollout_num_steps))
   {
     cdbg << "... skipping" << endl;
     action a = priv.is_ldf ? 0 : ((allowed_actions && (allowed_actions_cnt > 0)) ? allowed_actions[0] : 1);
@@ -1587,7 +1739,7 @@ action search_predict(search_private& priv, example* ecs, size_t ec_cnt, ptag my
 
   if ((priv.state == INIT_TRAIN) ||
       (priv.state == INIT_TEST) ||
-      ((priv.state == LEARN) && (t > priv.learn_t)))
+      ((priv.state == LEARN) && (t > priv.progress.learn_t)))
   {
     // we actually need to run the policy
 
@@ -1625,7 +1777,7 @@ action search_predict(search_private& priv, example* ecs, size_t ec_cnt, ptag my
 
       if ((!skip) && (!need_fea) && not_test && cached_action_store_or_find(priv, mytag, condition_on, condition_on_names, priv.condition_on_actions.begin(), condition_on_cnt, policy, learner_id, a, false, a_cost))
         // if this succeeded, 'a' has the right action
-        priv.total_cache_hits++;
+        priv.cache.hits++;
       else   // we need to predict, and then cache, and maybe run foreach_action
       {
         size_t start_K = (priv.is_ldf && COST_SENSITIVE::ec_is_example_header(ecs[0])) ? 1 : 0;
@@ -1687,7 +1839,7 @@ action search_predict(search_private& priv, example* ecs, size_t ec_cnt, ptag my
     }
 
     if (priv.state == INIT_TRAIN)
-      priv.train_trajectory.push_back( scored_action(a, a_cost) ); // note the action for future reference
+      priv.progress.train_trajectory.push_back( scored_action(a, a_cost) ); // note the action for future reference
 
     if (priv.metaoverride && priv.metaoverride->_post_prediction)
       priv.metaoverride->_post_prediction(*priv.metaoverride->sch, t-priv.meta_t, a, a_cost);
@@ -1743,10 +1895,10 @@ void get_training_timesteps(search_private& priv, v_array<size_t>& timesteps)
   if (priv.subsample_timesteps <= -1)
   {
     for (size_t i=0; i<priv.active_uncertainty.size(); i++)
-      if (merand48(priv.all->random_state) > priv.active_uncertainty[i].first)
+      if (merand48(*priv.random_state) > priv.active_uncertainty[i].first)
         timesteps.push_back(priv.active_uncertainty[i].second - 1);
     /*
-    float k = (float)priv.total_examples_generated;
+    float k = (float)priv.progress.total_examples_generated;
     priv.ec_seq[t]->revert_weight = priv.all->loss->getRevertingWeight(priv.all->sd, priv.ec_seq[t].pred.scalar, priv.all->eta / powf(k, priv.all->power_t));
     float importance = query_decision(active_str, *priv.ec_seq[t], k);
     if (importance > 0.)
@@ -1772,11 +1924,11 @@ void get_training_timesteps(search_private& priv, v_array<size_t>& timesteps)
   else if (priv.subsample_timesteps < 1)
   {
     for (size_t t=0; t<priv.T; t++)
-      if (merand48(priv.all->random_state) <= priv.subsample_timesteps)
+      if (merand48(*priv.random_state) <= priv.subsample_timesteps)
         timesteps.push_back(t);
 
     if (timesteps.size() == 0) // ensure at least one
-      timesteps.push_back((size_t)(merand48(priv.all->random_state) * priv.T));
+      timesteps.push_back((size_t)(merand48(*priv.random_state) * priv.T));
   }
 
   // finally, if subsample >= 1, then pick (int) that many uniformly at random without replacement; could use an LFSR but why? :P
@@ -1785,7 +1937,7 @@ void get_training_timesteps(search_private& priv, v_array<size_t>& timesteps)
     while ((timesteps.size() < (size_t)priv.subsample_timesteps) &&
            (timesteps.size() < priv.T))
     {
-      size_t t = (size_t)(merand48(priv.all->random_state) * (float)priv.T);
+      size_t t = (size_t)(merand48(*priv.random_state) * (float)priv.T);
       if (! v_array_contains(timesteps, t))
         timesteps.push_back(t);
     }
@@ -1880,7 +2032,7 @@ void verify_active_csoaa(COST_SENSITIVE::label& losses, v_array<pair<CS::wclass&
 
 void advance_from_known_actions(search_private& priv)
 {
-  size_t t = priv.learn_t;
+  size_t t = priv.progress.learn_t;
   if (! priv.active_csoaa) return;
   if (priv.active_csoaa_verify > 0.) return;
   if (t >= priv.active_known.size()) return;
@@ -1909,6 +2061,117 @@ void advance_from_known_actions(search_private& priv)
   advance_from_known_actions(priv);
 }
 
+// a second search instance that rolls out some of the actions at learn_t
+// while the others are rolled out on the other threads
+struct rollout_worker
+{
+  search sch;
+  v_array<example> ec_copy;      // its own copy of the example sequence, which run munges
+  multi_ex ec_seq;               // pointers into ec_copy
+  uint64_t random_state;
+  bool configured;               // holds a copy of the search settings
+};
+
+// the search settings a rollout reads; they are fixed by the time the first
+// example arrives, so a worker copies them once
+void configure_rollout_worker(search_private& priv, search_private& w)
+{
+  w.all = priv.all;
+  w.auto_condition_features = priv.auto_condition_features;
+  w.auto_hamming_loss = priv.auto_hamming_loss;
+  w.examples_dont_change = priv.examples_dont_change;
+  w.is_ldf = priv.is_ldf;
+  w.use_action_costs = priv.use_action_costs;
+  w.acset = priv.acset;
+  w.history_length = priv.history_length;
+  w.A = priv.A;
+  w.num_learners = priv.num_learners;
+  w.cb_learner = priv.cb_learner;
+  w.no_caching = priv.no_caching;
+  w.rollout_num_steps = priv.rollout_num_steps;
+  w.label_is_test = priv.label_is_test;
+  w.perturb_oracle = priv.perturb_oracle;
+  w.alpha = priv.alpha;
+  w.beta = priv.beta;
+  w.rollout_method = priv.rollout_method;
+  w.rollin_method = priv.rollin_method;
+  w.subsample_timesteps = priv.subsample_timesteps;
+  w.xv = priv.xv;
+  w.allow_current_policy = priv.allow_current_policy;
+  w.adaptive_beta = priv.adaptive_beta;
+  w.passes_per_policy = priv.passes_per_policy;
+  w.total_number_of_policies = priv.total_number_of_policies;
+  w.task = priv.task;
+}
+
+// rolls out actions learn_a_idx .. learn_action_cnt-2 on the worker threads
+// and pushes their losses; the last action is left to the caller, whose
+// rollout of it sets up the example at learn_t
+void rollout_in_parallel(search& sch, multi_ex& ec_seq)
+{
+  search_private& priv = *sch.priv;
+  size_t first = priv.learn_a_idx;
+  size_t last = priv.learn_action_cnt - 1;
+  if (last < first + 2) return;
+
+  if (! priv.rollout_examples_copied)
+  {
+    for (rollout_worker* w : priv.rollout_workers)
+    {
+      ensure_size(w->ec_copy, ec_seq.size());
+      w->ec_seq.clear();
+      for (size_t i=0; i<ec_seq.size(); i++)
+      {
+        VW::copy_example_data(false, w->ec_copy.begin()+i, ec_seq[i], sizeof(MC::label_t), nullptr);
+        w->ec_seq.push_back(w->ec_copy.begin()+i);
+      }
+    }
+    priv.rollout_examples_copied = true;
+  }
+
+  for (rollout_worker* w : priv.rollout_workers)
+  {
+    if (! w->configured)
+    {
+      configure_rollout_worker(priv, *w->sch.priv);
+      w->configured = true;
+    }
+    w->sch.priv->progress = priv.progress; // train_trajectory is shared, only read during LEARN
+  }
+  ensure_size(priv.rollout_losses, last - first);
+
+  size_t num_workers = priv.rollout_workers.size();
+  priv.rollout_pool->parallel_for(num_workers, [&priv, first, last, num_workers](size_t i)
+  {
+    rollout_worker& w = *priv.rollout_workers[i];
+    search_private& wpriv = *w.sch.priv;
+    for (size_t a = first + i; a < last; a += num_workers)
+    {
+      reset_search_structure(wpriv);
+      wpriv.state = LEARN;
+      wpriv.learn_a_idx = a;
+      run_task(w.sch, w.ec_seq);
+      priv.rollout_losses[a - first] = wpriv.learn_loss;
+    }
+  });
+
+  // keep what the workers predicted for the rollouts still to come
+  for (rollout_worker* w : priv.rollout_workers)
+  {
+    search_private& wpriv = *w->sch.priv;
+    priv.cache.merge_from(wpriv.cache);
+    wpriv.cache.clear();
+
+    priv.num_calls_to_run += wpriv.num_calls_to_run;
+    priv.total_predictions_made += wpriv.total_predictions_made;
+    wpriv.num_calls_to_run = 0;
+    wpriv.total_predictions_made = 0;
+  }
+
+  for (size_t a = first; a < last; a++)
+    cs_cost_push_back(false, priv.learn_losses, (uint32_t)(a+1), priv.rollout_losses[a - first]);
+  priv.learn_a_idx = last;
+}
 
 template <bool is_learn>
 void train_single_example(search& sch, bool is_test_ex, bool is_holdout_ex, multi_ex& ec_seq)
@@ -1918,14 +2181,14 @@ void train_single_example(search& sch, bool is_test_ex, bool is_holdout_ex, mult
   bool ran_test = false;  // we must keep track so that even if we skip test, we still update # of examples seen
 
   //if (! priv.no_caching)
-  clear_cache_hash_map(priv);
+  priv.cache.clear();
 
   cdbg << "is_test_ex=" << is_test_ex << " vw_is_main=" << all.vw_is_main << endl;
   cdbg << "must_run_test = " << must_run_test(all, ec_seq, is_test_ex) << endl;
   // do an initial test pass to compute output (and loss)
   if (must_run_test(all, ec_seq, is_test_ex))
   {
-    cdbg << "======================================== INIT TEST (" << priv.current_policy << "," << priv.read_example_last_pass << ") ========================================" << endl;
+    cdbg << "======================================== INIT TEST (" << priv.progress.current_policy << "," << priv.progress.read_example_last_pass << ") ========================================" << endl;
 
     ran_test = true;
 
@@ -1956,15 +2219,15 @@ void train_single_example(search& sch, bool is_test_ex, bool is_holdout_ex, mult
   // SPEEDUP: if the oracle was never called, we can skip this!
 
   // do a pass over the data allowing oracle
-  cdbg << "======================================== INIT TRAIN (" << priv.current_policy << "," << priv.read_example_last_pass << ") ========================================" << endl;
+  cdbg << "======================================== INIT TRAIN (" << priv.progress.current_policy << "," << priv.progress.read_example_last_pass << ") ========================================" << endl;
   //cerr << "training" << endl;
 
-  clear_cache_hash_map(priv);
+  priv.cache.clear();
   reset_search_structure(priv);
   clear_memo_foreach_action(priv);
   priv.state = INIT_TRAIN;
   priv.active_uncertainty.clear();
-  priv.train_trajectory.clear();  // this is where we'll store the training sequence
+  priv.progress.train_trajectory.clear();  // this is where we'll store the training sequence
   run_task(sch, ec_seq);
 
   if (!ran_test)    // was  && !priv.ec_seq[0]->test_only) { but we know it's not test_only
@@ -1977,11 +2240,11 @@ void train_single_example(search& sch, bool is_test_ex, bool is_holdout_ex, mult
   }
 
   // otherwise, we have some learn'in to do!
-  cdbg << "======================================== LEARN (" << priv.current_policy << "," << priv.read_example_last_pass << ") ========================================" << endl;
+  cdbg << "======================================== LEARN (" << priv.progress.current_policy << "," << priv.progress.read_example_last_pass << ") ========================================" << endl;
   priv.T = priv.metatask ? priv.meta_t : priv.t;
   get_training_timesteps(priv, priv.timesteps);
-  cdbg << "train_trajectory.size() = " << priv.train_trajectory.size() << ":\t";
-  cdbg_print_array<scored_action>("", priv.train_trajectory);
+  cdbg << "train_trajectory.size() = " << priv.progress.train_trajectory.size() << ":\t";
+  cdbg_print_array<scored_action>("", priv.progress.train_trajectory);
   //cdbg << "memo_foreach_action = " << priv.memo_foreach_action << endl;
   for (size_t i=0; i<priv.memo_foreach_action.size(); i++)
   {
@@ -1993,6 +2256,7 @@ void train_single_example(search& sch, bool is_test_ex, bool is_holdout_ex, mult
 
   if (priv.cb_learner) priv.learn_losses.cb.costs.clear();
   else                 priv.learn_losses.cs.costs.clear();
+  priv.rollout_examples_copied = false;
 
   for (size_t tid=0; tid<priv.timesteps.size(); tid++)
   {
@@ -2014,7 +2278,7 @@ void train_single_example(search& sch, bool is_test_ex, bool is_holdout_ex, mult
     // for each action, roll out to get a loss
     while (! priv.done_with_all_actions)
     {
-      priv.learn_t = priv.timesteps[tid];
+      priv.progress.learn_t = priv.timesteps[tid];
       advance_from_known_actions(priv);
       if (priv.done_with_all_actions) break;
 
@@ -2022,27 +2286,29 @@ void train_single_example(search& sch, bool is_test_ex, bool is_holdout_ex, mult
       reset_search_structure(priv);
 
       priv.state = LEARN;
-      priv.learn_t = priv.timesteps[tid];
+      priv.progress.learn_t = priv.timesteps[tid];
       cdbg << "-------------------------------------------------------------------------------------" << endl;
-      cdbg << "learn_t = " << priv.learn_t << ", learn_a_idx = " << priv.learn_a_idx << endl;
-      //cdbg_print_array("priv.active_known[learn_t]", priv.active_known[priv.learn_t]);
+      cdbg << "learn_t = " << priv.progress.learn_t << ", learn_a_idx = " << priv.learn_a_idx << endl;
+      //cdbg_print_array("priv.active_known[learn_t]", priv.active_known[priv.progress.learn_t]);
       run_task(sch, ec_seq);
       //cerr_print_array("in GENER, learn_allowed_actions", priv.learn_allowed_actions);
       float this_loss = priv.learn_loss;
       cs_cost_push_back(priv.cb_learner, priv.learn_losses, priv.is_ldf ? (uint32_t)(priv.learn_a_idx - 1) : (uint32_t)priv.learn_a_idx, this_loss);
+      if (priv.rollout_pool && !priv.done_with_all_actions)
+        rollout_in_parallel(sch, ec_seq);
       //                          (priv.learn_allowed_actions.size() > 0) ? priv.learn_allowed_actions[priv.learn_a_idx-1] : priv.is_ldf ? (priv.learn_a_idx-1) : (priv.learn_a_idx),
       //                           priv.learn_loss);
     }
-    if (priv.active_csoaa_verify > 0.) verify_active_csoaa(priv.learn_losses.cs, priv.active_known[priv.learn_t], ec_seq[0]->example_counter, priv.active_csoaa_verify);
+    if (priv.active_csoaa_verify > 0.) verify_active_csoaa(priv.learn_losses.cs, priv.active_known[priv.progress.learn_t], ec_seq[0]->example_counter, priv.active_csoaa_verify);
 
     if (skipped_all_actions)
     {
       reset_search_structure(priv);
       priv.state = LEARN;
-      priv.learn_t = priv.timesteps[tid];
+      priv.progress.learn_t = priv.timesteps[tid];
       priv.force_setup_ec_ref = true;
       cdbg << "<<<<<" << endl;
-      cdbg << "skipped all actions; learn_t = " << priv.learn_t << ", learn_a_idx = " << priv.learn_a_idx << endl;
+      cdbg << "skipped all actions; learn_t = " << priv.progress.learn_t << ", learn_a_idx = " << priv.learn_a_idx << endl;
       run_task(sch, ec_seq); // TODO: i guess we can break out of this early
       cdbg << ">>>>>" << endl;
     }
@@ -2106,11 +2372,11 @@ void do_actual_learning(search& sch, base_learner& base, multi_ex& ec_seq)
   bool is_holdout_ex = false;
 
   search_private& priv = *sch.priv;
-  priv.offset = ec_seq[0]->ft_offset;
-  priv.base_learner = &base;
+  priv.progress.offset = ec_seq[0]->ft_offset;
+  priv.progress.base_learner = &base;
 
   adjust_auto_condition(priv);
-  priv.read_example_last_id = ec_seq[ec_seq.size()-1]->example_counter;
+  priv.progress.read_example_last_id = ec_seq[ec_seq.size()-1]->example_counter;
 
   // hit_new_pass true would have already triggered a printout
   // finish_example(multi_ex).  so we can reset hit_new_pass here
@@ -2126,7 +2392,7 @@ void do_actual_learning(search& sch, base_learner& base, multi_ex& ec_seq)
   if (priv.task->run_setup) priv.task->run_setup(sch, ec_seq);
 
   // if we're going to have to print to the screen, generate the "truth" string
-  cdbg << "======================================== GET TRUTH STRING (" << priv.current_policy << "," << priv.read_example_last_pass << ") ========================================" << endl;
+  cdbg << "======================================== GET TRUTH STRING (" << priv.progress.current_policy << "," << priv.progress.read_example_last_pass << ") ========================================" << endl;
   if (might_print_update(*priv.all))
   {
     if (is_test_ex)
@@ -2153,22 +2419,22 @@ void end_pass(search& sch)
   search_private& priv = *sch.priv;
   vw* all = priv.all;
   priv.hit_new_pass = true;
-  priv.read_example_last_pass++;
+  priv.progress.read_example_last_pass++;
   priv.passes_since_new_policy++;
 
   if (priv.passes_since_new_policy >= priv.passes_per_policy)
   {
     priv.passes_since_new_policy = 0;
     if(all->training)
-      priv.current_policy++;
-    if (priv.current_policy > priv.total_number_of_policies)
+      priv.progress.current_policy++;
+    if (priv.progress.current_policy > priv.total_number_of_policies)
     {
       std::cerr << "internal error (bug): too many policies; not advancing" << std::endl;
-      priv.current_policy = priv.total_number_of_policies;
+      priv.progress.current_policy = priv.total_number_of_policies;
     }
     //reset search_trained_nb_policies in options_from_file so it is saved to regressor file later
     std::stringstream ss;
-    ss << priv.current_policy;
+    ss << priv.progress.current_policy;
     VW::cmd_string_replace_value(all->opts_n_args.file_options,"--search_trained_nb_policies", ss.str());
   }
 }
@@ -2188,7 +2454,7 @@ void end_examples(search& sch)
   {
     std::stringstream ss1;
     std::stringstream ss2;
-    ss1 << ((priv.passes_since_new_policy == 0) ? priv.current_policy : (priv.current_policy+1));
+    ss1 << ((priv.passes_since_new_policy == 0) ? priv.progress.current_policy : (priv.progress.current_policy+1));
     //use cmd_string_replace_value in case we already loaded a predictor which had a value stored for --search_trained_nb_policies
     VW::cmd_string_replace_value(all->opts_n_args.file_options,"--search_trained_nb_policies", ss1.str());
     ss2 << priv.total_number_of_policies;
@@ -2231,10 +2497,7 @@ void search_initialize(vw* all, search& sch)
 
   priv.acset.feature_value = 1.;
 
-  scored_action sa((action)-1,0.);
-  new (&priv.cache_hash_map) v_hashmap<unsigned char*, scored_action>();
-  priv.cache_hash_map.set_default_value(sa);
-  priv.cache_hash_map.set_equivalent(cached_item_equivalent);
+  priv.cache.init(default_cache_mb << 20);
 
   sch.task_data = nullptr;
 
@@ -2247,19 +2510,19 @@ void search_initialize(vw* all, search& sch)
   priv.rawOutputStringStream = new stringstream(priv.rawOutputString);
   new (&priv.test_action_sequence) vector<action>();
   new (&priv.dat_new_feature_audit_ss) stringstream();
+
+  priv.random_state = &all->random_state;
 }
 
-void search_finish(search& sch)
+// frees what search_initialize and learning allocated, but leaves the task alone
+void free_search_private(search_private& priv)
 {
-  search_private& priv = *sch.priv;
-  cdbg << "search_finish" << endl;
-
-  clear_cache_hash_map(priv);
+  priv.cache.delete_v();
+  priv.cache_key.delete_v();
 
   delete priv.truth_string;
   delete priv.pred_string;
   delete priv.bad_string_stream;
-  priv.cache_hash_map.~v_hashmap<unsigned char*, scored_action>();
   priv.rawOutputString.~string();
   priv.test_action_sequence.~vector<action>();
   priv.dat_new_feature_audit_ss.~stringstream();
@@ -2284,7 +2547,7 @@ void search_finish(search& sch)
   else
     priv.allowed_actions_cache->cs.costs.delete_v();
 
-  priv.train_trajectory.delete_v();
+  priv.progress.train_trajectory.delete_v();
   for (Search::action_repr& ar : priv.ptag_to_action)
   {
     if(ar.repr !=nullptr)
@@ -2310,14 +2573,44 @@ void search_finish(search& sch)
   priv.learn_condition_on.delete_v();
   priv.learn_condition_on_act.delete_v();
 
+  free(priv.allowed_actions_cache);
+  delete priv.rawOutputStringStream;
+}
+
+void search_finish(search& sch)
+{
+  search_private& priv = *sch.priv;
+  cdbg << "search_finish" << endl;
+
+  if (priv.rollout_pool)
+  {
+    delete priv.rollout_pool;
+    for (rollout_worker* w : priv.rollout_workers)
+    {
+      search_private& wpriv = *w->sch.priv;
+      wpriv.progress.train_trajectory = v_init<scored_action>(); // belongs to priv
+      free_search_private(wpriv);
+      for (example* ec = w->ec_copy.begin(); ec != w->ec_copy.end_array; ++ec)
+        VW::dealloc_example(MC::mc_label.delete_label, *ec);
+      w->ec_copy.delete_v();
+      delete w;
+    }
+    priv.rollout_workers.delete_v();
+    priv.rollout_losses.delete_v();
+  }
+
+  if (priv.report_cache && !priv.all->quiet)
+    std::cerr << "search cache: " << priv.cache.hits << " hits in " << priv.cache.lookups << " lookups, "
+              << priv.cache.dropped << " entries dropped, peak " << (priv.cache.peak_bytes >> 10) << "KB" << endl;
+
+  free_search_private(priv);
+
   if (priv.active_csoaa)
     std::cerr << "search calls to run = " << priv.num_calls_to_run << endl;
 
   if (priv.task->finish) priv.task->finish(sch);
   if (priv.metatask && priv.metatask->finish) priv.metatask->finish(sch);
 
-  free(priv.allowed_actions_cache);
-  delete priv.rawOutputStringStream;
   free (sch.priv);
 }
 
@@ -2432,6 +2725,8 @@ base_learner* setup(arguments& arg)
   std::string metatask_string;
   std::string interpolation_string = "data";
   string neighbor_features_string;
+  size_t rollout_threads;
+  size_t cache_mb;
   std::string rollout_string = "mix_per_state";
   std::string rollin_string = "mix_per_state";
 
@@ -2468,14 +2763,18 @@ base_learner* setup(arguments& arg)
       .keep("search_history_length",   priv.history_length, (size_t)1, "some tasks allow you to specify how much history their depend on; specify that here")
 
       (priv.no_caching, "search_no_caching",                             "turn off the built-in caching ability (makes things slower, but technically more safe)")
+      ("search_cache_mb", cache_mb, default_cache_mb, "memory budget of the prediction cache in MB; when given, cache statistics are printed at the end")
       (priv.xv, "search_xv",                                     "train two separate policies, alternating prediction/learning")
       ("search_perturb_oracle", priv.perturb_oracle, 0.f, "perturb the oracle on rollin with this probability")
       (priv.linear_ordering, "search_linear_ordering", "insist on generating examples in linear order (def: hoopla permutation)")
       ("search_active_verify",    priv.active_csoaa_verify,  "verify that active learning is doing the right thing (arg = multiplier, should be = cost_range * range_c)")
-      ("search_save_every_k_runs", priv.save_every_k_runs, "save model every k runs").missing())
+      ("search_save_every_k_runs", priv.save_every_k_runs, "save model every k runs")
+      ("search_rollout_threads", rollout_threads, (size_t)1, "roll out the actions of a time step on this many threads (for tasks whose run only reads the task data)").missing())
     return nullptr;
 
   search_initialize(arg.all, *sch.get());
+  priv.cache.set_budget(cache_mb << 20);
+  priv.report_cache = arg.vm.count("search_cache_mb") && !arg.vm["search_cache_mb"].defaulted();
 
   parse_neighbor_features(neighbor_features_string, *sch.get());
 
@@ -2484,7 +2783,7 @@ base_learner* setup(arguments& arg)
     priv.adaptive_beta = true;
     priv.allow_current_policy = true;
     priv.passes_per_policy = arg.all->numpasses;
-    if (priv.current_policy > 1) priv.current_policy = 1;
+    if (priv.progress.current_policy > 1) priv.progress.current_policy = 1;
   }
   else if (interpolation_string.compare("policy") == 0) ;
   else
@@ -2529,31 +2828,31 @@ base_learner* setup(arguments& arg)
 
   //compute total number of policies we will have at end of training
   // we add current_policy for cases where we start from an initial set of policies loaded through -i option
-  uint32_t tmp_number_of_policies = priv.current_policy;
+  uint32_t tmp_number_of_policies = priv.progress.current_policy;
   if( arg.all->training )
     tmp_number_of_policies += (int)ceil(((float)arg.all->numpasses) / ((float)priv.passes_per_policy));
 
   //the user might have specified the number of policies that will eventually be trained through multiple vw calls,
   //so only set total_number_of_policies to computed value if it is larger
-  cdbg << "current_policy=" << priv.current_policy << " tmp_number_of_policies=" << tmp_number_of_policies << " total_number_of_policies=" << priv.total_number_of_policies << endl;
+  cdbg << "current_policy=" << priv.progress.current_policy << " tmp_number_of_policies=" << tmp_number_of_policies << " total_number_of_policies=" << priv.total_number_of_policies << endl;
   if( tmp_number_of_policies > priv.total_number_of_policies )
   {
     priv.total_number_of_policies = tmp_number_of_policies;
-    if( priv.current_policy > 0 ) //we loaded a file but total number of policies didn't match what is needed for training
+    if( priv.progress.current_policy > 0 ) //we loaded a file but total number of policies didn't match what is needed for training
       std::cerr << "warning: you're attempting to train more classifiers than was allocated initially. Likely to cause bad performance." << endl;
   }
 
   //current policy currently points to a new policy we would train
   //if we are not training and loaded a bunch of policies for testing, we need to subtract 1 from current policy
   //so that we only use those loaded when testing (as run_prediction is called with allow_current to true)
-  if( !arg.all->training && priv.current_policy > 0 )
-    priv.current_policy--;
+  if( !arg.all->training && priv.progress.current_policy > 0 )
+    priv.progress.current_policy--;
 
   std::stringstream ss1, ss2;
-  ss1 << priv.current_policy;           VW::cmd_string_replace_value(arg.file_options,"--search_trained_nb_policies", ss1.str());
+  ss1 << priv.progress.current_policy;           VW::cmd_string_replace_value(arg.file_options,"--search_trained_nb_policies", ss1.str());
   ss2 << priv.total_number_of_policies; VW::cmd_string_replace_value(arg.file_options,"--search_total_nb_policies",   ss2.str());
 
-  cdbg << "search current_policy = " << priv.current_policy << " total_number_of_policies = " << priv.total_number_of_policies << endl;
+  cdbg << "search current_policy = " << priv.progress.current_policy << " total_number_of_policies = " << priv.total_number_of_policies << endl;
 
   if (task_string.compare("list") == 0)
   {
@@ -2631,6 +2930,33 @@ base_learner* setup(arguments& arg)
   if (!priv.allow_current_policy) // if we're not dagger
     arg.all->check_holdout_every_n_passes = priv.passes_per_policy;
 
+  if ((rollout_threads > 1) && (priv.rollout_method != NO_ROLLOUT))
+  {
+    if (!priv.stateless_run || priv.is_ldf || priv.cb_learner || priv.metatask || priv.active_csoaa ||
+        priv.acset.use_passthrough_repr || arg.all->audit || arg.all->weights.sparse ||
+        (base != arg.all->cost_sensitive) || !arg.all->linear_cost_sensitive)
+      arg.all->trace_message << "warning: --search_rollout_threads needs a task that declares STATELESS_RUN and plain --csoaa on gd with dense weights, without ldf, cb, metatasks, active learning, passthrough features or audit; rolling out on one thread" << endl;
+    else
+    {
+      priv.rollout_pool = new thread_pool(rollout_threads);
+      for (size_t i=0; i<priv.rollout_pool->size(); i++)
+      {
+        rollout_worker* w = new rollout_worker();
+        w->configured = false;
+        search_private& wpriv = *w->sch.priv;
+        search_initialize(arg.all, w->sch);
+        w->sch.task_data = sch->task_data;
+        w->sch.task_name = sch->task_name;
+        wpriv.allowed_actions_cache = &calloc_or_throw<polylabel>();
+        CS::cs_label.default_label(wpriv.allowed_actions_cache);
+        wpriv.random_state = &w->random_state;
+        wpriv.rollout_parent = &priv;
+        wpriv.cache.set_budget(cache_mb << 20);
+        priv.rollout_workers.push_back(w);
+      }
+    }
+  }
+
   arg.all->searchstr = &sch;
 
   priv.start_clock_time = clock();
@@ -2748,6 +3074,7 @@ void  search::set_options(uint32_t opts)
   if ((opts & IS_LDF)                  != 0) this->priv->is_ldf = true;
   if ((opts & NO_CACHING)              != 0) this->priv->no_caching = true;
   if ((opts & ACTION_COSTS)            != 0) this->priv->use_action_costs = true;
+  if ((opts & STATELESS_RUN)           != 0) this->priv->stateless_run = true;
 
   if (this->priv->is_ldf && this->priv->use_action_costs)
     THROW("using LDF and actions costs is not yet implemented; turn off action costs"); // TODO fix
@@ -2794,7 +3121,7 @@ string search::pretty_label(action a)
 }
 
 vw& search::get_vw_pointer_unsafe() { return *this->priv->all; }
-void search::set_force_oracle(bool force) { this->priv->force_oracle = force; }
+void search::set_force_oracle(bool force) { this->priv->progress.force_oracle = force; }
 
 // predictor implementation
 predictor::predictor(search& sch, ptag my_tag) : is_ldf(false), my_tag(my_tag), ec(nullptr), ec_cnt(0), ec_alloced(false), weight(1.), oracle_is_pointer(false), allowed_is_pointer(false), allowed_cost_is_pointer(false), learner_id(0), sch(sch)
@@ -19,7 +19,7 @@ namespace Search
 struct search_private;
 struct search_task;
 
-extern uint32_t AUTO_CONDITION_FEATURES, AUTO_HAMMING_LOSS, EXAMPLES_DONT_CHANGE, IS_LDF, NO_CACHING, ACTION_COSTS;
+extern uint32_t AUTO_CONDITION_FEATURES, AUTO_HAMMING_LOSS, EXAMPLES_DONT_CHANGE, IS_LDF, NO_CACHING, ACTION_COSTS, STATELESS_RUN;
 
 struct search;
 
@@ -57,6 +57,8 @@ struct search
 
   // for setting programmatic options during initialization
   // this should be an or ("|") of AUTO_CONDITION_FEATURES, etc.
+  // STATELESS_RUN promises that run only reads your task data, so that
+  // --search_rollout_threads may call it on several threads at once.
   void set_options(uint32_t opts);
 
   // change the default label parser, but you _must_ tell me how
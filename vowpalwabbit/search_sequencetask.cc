@@ -21,6 +21,7 @@ void initialize(Search::search& sch, size_t& /*num_actions*/, arguments& /*arg*/
   sch.set_options( Search::AUTO_CONDITION_FEATURES  |    // automatically add history features to our examples, please
                    Search::AUTO_HAMMING_LOSS        |    // please just use hamming loss on individual predictions -- we won't declare loss
                    Search::EXAMPLES_DONT_CHANGE     |    // we don't do any internal example munging
+                   Search::STATELESS_RUN            |    // run keeps no state, so rollouts can run concurrently
                    0);
 }
 
@@ -244,6 +245,7 @@ void initialize(Search::search& sch, size_t& num_actions, arguments& arg)
                    Search::AUTO_HAMMING_LOSS        |    // please just use hamming loss on individual predictions -- we won't declare loss
                    Search::EXAMPLES_DONT_CHANGE     |    // we don't do any internal example munging
                    Search::ACTION_COSTS             |    // we'll provide cost-per-action (rather than oracle)
+                   Search::STATELESS_RUN            |    // run keeps no state, so rollouts can run concurrently
                    0);
   sch.set_task_data<size_t>(&num_actions);
 }
@@ -295,10 +297,12 @@ void initialize(Search::search& sch, size_t& /*num_actions*/, arguments& arg)
   sch.set_task_data(D);
 
   if (D->predict_max)
-    sch.set_options( Search::EXAMPLES_DONT_CHANGE );   // we don't do any internal example munging
+    sch.set_options( Search::EXAMPLES_DONT_CHANGE |       // we don't do any internal example munging
+                     Search::STATELESS_RUN );          // run only reads D, so rollouts can run concurrently
   else
     sch.set_options( Search::AUTO_CONDITION_FEATURES |    // automatically add history features to our examples, please
-                     Search::EXAMPLES_DONT_CHANGE );   // we don't do any internal example munging
+                     Search::EXAMPLES_DONT_CHANGE    |    // we don't do any internal example munging
+                     Search::STATELESS_RUN );          // run only reads D, so rollouts can run concurrently
 }
 
 void finish(Search::search& sch)
@@ -17,6 +17,7 @@ license as described in the file LICENSE.
 #include <cmath>
 #include <map>
 #include <future>
+#include <algorithm>
 
 using namespace std;
 
@@ -24,14 +25,38 @@ struct client
 {
   uint32_t client_ip;
   socket_t socket;
+  size_t pass; // position of the all_reduce the node is waiting in
+  size_t seq;
 };
 
 struct partial
 {
   client* nodes;
+  size_t total;
   size_t filled;
 };
 
+// A waiting node is alive as long as its connection has neither been closed
+// nor reset.  Only called on sockets select() reported readable (or during a
+// heartbeat sweep), so the peek does not block on a healthy connection.
+static bool node_alive(socket_t s)
+{
+  fd_set fds;
+  FD_ZERO(&fds);
+  FD_SET(s, &fds);
+  timeval no_wait;
+  no_wait.tv_sec = 0;
+  no_wait.tv_usec = 0;
+  int ready = select((int)s + 1, &fds, nullptr, nullptr, &no_wait);
+  if (ready == 0)
+    return true;
+  if (ready < 0)
+    return false;
+
+  char probe;
+  return recv(s, &probe, sizeof(probe), MSG_PEEK) > 0;
+}
+
 static int socket_sort(const void* s1, const void* s2)
 {
   client* socket1 = (client*)s1;
@@ -74,6 +99,22 @@ int build_tree(int*  parent, uint16_t* kid_count, size_t source_count, int offse
   return oroot;
 }
 
+// Every node of a tree must be about to make the same all_reduce call.
+static bool same_position(size_t nonce, const partial& p)
+{
+  bool same = true;
+  for (size_t i = 1; i < p.total; i++)
+    same &= p.nodes[i].pass == p.nodes[0].pass && p.nodes[i].seq == p.nodes[0].seq;
+  if (!same)
+  {
+    cerr << "nonce " << nonce << ": nodes are at different all_reduce calls, refusing the tree:";
+    for (size_t i = 0; i < p.total; i++)
+      cerr << " node " << i << " pass " << p.nodes[i].pass << " call " << p.nodes[i].seq << ";";
+    cerr << endl;
+  }
+  return same;
+}
+
 void fail_send(const socket_t fd, const void* buf, const int count)
 {
   if (send(fd, (char*)buf, count, 0) == -1)
@@ -82,7 +123,8 @@ void fail_send(const socket_t fd, const void* buf, const int count)
 
 namespace VW
 {
-SpanningTree::SpanningTree() : m_stop(false), port(26543), m_future(nullptr)
+SpanningTree::SpanningTree(size_t heartbeat_interval_s)
+  : m_stop(false), port(26543), heartbeat_interval(heartbeat_interval_s > 0 ? heartbeat_interval_s : 1), m_future(nullptr)
 {
 #ifdef _WIN32
   WSAData wsaData;
@@ -140,10 +182,57 @@ void SpanningTree::Stop()
 void SpanningTree::Run()
 {
   map<size_t, partial> partial_nodesets;
+  if (listen(sock, 1024) < 0)
+    THROWERRNO("listen: ");
+
   while (!m_stop)
   {
-    if (listen(sock, 1024) < 0)
-      THROWERRNO("listen: ");
+    // Wait for either a new connection or activity on one of the nodes that
+    // are parked waiting for their tree.  The timeout doubles as the
+    // heartbeat interval used to sweep for dead nodes.
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(sock, &fds);
+    socket_t max_fd = sock;
+    for (auto& p : partial_nodesets)
+      for (size_t i = 0; i < p.second.total; i++)
+        if (p.second.nodes[i].client_ip != (uint32_t)-1)
+        {
+          FD_SET(p.second.nodes[i].socket, &fds);
+          max_fd = (std::max)(max_fd, p.second.nodes[i].socket);
+        }
+
+    timeval heartbeat;
+    heartbeat.tv_sec = (long)heartbeat_interval;
+    heartbeat.tv_usec = 0;
+    int ready = select((int)max_fd + 1, &fds, nullptr, nullptr, &heartbeat);
+    if (m_stop)
+      break;
+    if (ready < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    // A parked node never sends anything before its tree is built, so a
+    // readable socket means it hung up (crashed mapper, killed executor).
+    // Free the slot so a restarted node with the same id can rejoin.
+    for (auto& p : partial_nodesets)
+      for (size_t i = 0; i < p.second.total; i++)
+      {
+        client& c = p.second.nodes[i];
+        if (c.client_ip != (uint32_t)-1 && (ready == 0 || FD_ISSET(c.socket, &fds)) && !node_alive(c.socket))
+        {
+          cerr << "nonce " << p.first << ": node " << i << " disconnected, waiting for it to rejoin" << endl;
+          CLOSESOCK(c.socket);
+          c.client_ip = (uint32_t)-1;
+          p.second.filled--;
+        }
+      }
+
+    if (!FD_ISSET(sock, &fds))
+      continue;
 
     sockaddr_in client_address;
     socklen_t size = sizeof(client_address);
@@ -198,6 +287,15 @@ void SpanningTree::Run()
     }
     else cerr << dotted_quad << "(" << hostname << ':' << ntohs(port)
                 << "): node id=" << id << endl;
+    size_t pass = 0, seq = 0;
+    if (recv(f, (char*)&pass, sizeof(pass), 0) != sizeof(pass) || recv(f, (char*)&seq, sizeof(seq), 0) != sizeof(seq))
+    {
+      cerr << dotted_quad << "(" << hostname << ':' << ntohs(port)
+           << "): position read failed, exiting" << endl;
+      exit(1);
+    }
+    else cerr << dotted_quad << "(" << hostname << ':' << ntohs(port)
+                << "): pass=" << pass << " allreduce=" << seq << endl;
 
     int ok = true;
     if (id >= total)
@@ -211,6 +309,7 @@ void SpanningTree::Run()
     if (partial_nodesets.find(nonce) == partial_nodesets.end())
     {
       partial_nodeset.nodes = (client*)calloc(total, sizeof(client));
+      partial_nodeset.total = total;
       for (size_t i = 0; i < total; i++)
         partial_nodeset.nodes[i].client_ip = (uint32_t)-1;
       partial_nodeset.filled = 0;
@@ -221,16 +320,48 @@ void SpanningTree::Run()
       partial_nodesets.erase(nonce);
     }
 
-    if (ok && partial_nodeset.nodes[id].client_ip != (uint32_t)-1)
+    if (ok && total != partial_nodeset.total)
+    {
+      cout << dotted_quad << "(" << hostname << ':' << ntohs(port)
+           << "): total=" << total << " disagrees with " << partial_nodeset.total << " for nonce " << nonce << endl;
       ok = false;
+    }
+
+    if (ok && partial_nodeset.nodes[id].client_ip != (uint32_t)-1)
+    {
+      // A node restarted before the heartbeat noticed its previous incarnation
+      // died: take over the slot, otherwise reject the duplicate.
+      if (node_alive(partial_nodeset.nodes[id].socket))
+        ok = false;
+      else
+      {
+        cerr << "nonce " << nonce << ": node " << id << " rejoined" << endl;
+        CLOSESOCK(partial_nodeset.nodes[id].socket);
+        partial_nodeset.nodes[id].client_ip = (uint32_t)-1;
+        partial_nodeset.filled--;
+      }
+    }
     fail_send(f, &ok, sizeof(ok));
 
-    if (ok)
+    if (!ok)
     {
-      partial_nodeset.nodes[id].client_ip = client_address.sin_addr.s_addr;
-      partial_nodeset.nodes[id].socket = f;
-      partial_nodeset.filled++;
+      // a refused node leaves the group as it was; the group keeps the size
+      // its first node reported, whatever this one claimed
+      CLOSESOCK(f);
+      if (partial_nodeset.filled > 0)
+        partial_nodesets[nonce] = partial_nodeset;
+      else
+        free(partial_nodeset.nodes);
+      continue;
     }
+
+    partial_nodeset.nodes[id].client_ip = client_address.sin_addr.s_addr;
+    partial_nodeset.nodes[id].socket = f;
+    partial_nodeset.nodes[id].pass = pass;
+    partial_nodeset.nodes[id].seq = seq;
+    partial_nodeset.filled++;
+    total = partial_nodeset.total;
+
     if (partial_nodeset.filled != total) //Need to wait for more connections
     {
       partial_nodesets[nonce] = partial_nodeset;
@@ -245,6 +376,19 @@ void SpanningTree::Run()
         }
       }
     }
+    else if (!same_position(nonce, partial_nodeset))
+    {
+      // Pairing up different calls would silently mix unrelated buffers, so
+      // fail every node instead.  This is what a node restarted anywhere but
+      // at a pass boundary, or without its checkpoint, runs into.
+      uint16_t refused = (uint16_t)-1;
+      for (size_t i = 0; i < total; i++)
+      {
+        fail_send(partial_nodeset.nodes[i].socket, &refused, sizeof(refused));
+        CLOSESOCK(partial_nodeset.nodes[i].socket);
+      }
+      free(partial_nodeset.nodes);
+    }
     else
     {
       //Time to make the spanning tree
@@ -46,12 +46,15 @@ private:
   socket_t sock;
   short unsigned int port;
 
+  // seconds between sweeps for nodes that disconnected while waiting for their tree
+  size_t heartbeat_interval;
+
   // future to signal end of thread running.
   // Need a pointer since C++/CLI doesn't like futures yet
   std::future<void>* m_future;
 
 public:
-  SpanningTree();
+  SpanningTree(size_t heartbeat_interval_s = 1);
   ~SpanningTree();
 
   void Start();
@@ -14,6 +14,7 @@ using namespace LEARNER;
 
 static const uint32_t parent_bit = 1;
 static const uint32_t cycle_bit = 2;
+static const uint32_t candidate_bit = 4;
 static const uint32_t tree_atomics = 134;
 static const float tolerance = 1e-9f;
 static const uint32_t indicator_bit = 128;
@@ -35,7 +36,13 @@ struct stagewise_poly
 
   sort_data *sd;
   size_t sd_len;
-  uint8_t *depthsbits; //interleaved array storing depth information and parent/cycle bits
+  uint8_t *depthsbits; //interleaved array storing depth information and parent/cycle/candidate bits
+
+  //wids that may have picked up weight since the last support update: every
+  //monomial synthesized in training, plus whatever one full scan found.  Marked
+  //by candidate_bit so each is listed once.
+  v_array<uint64_t> candidates;
+  bool candidates_seeded;
 
   uint64_t sum_sparsity; //of synthetic example
   uint64_t sum_input_sparsity; //of input example
@@ -47,6 +54,7 @@ struct stagewise_poly
 
   example synth_ec;
   //following is bookkeeping in synth_ec creation (dfs)
+  features atomics; //the input example's features, interactions resolved, without ft_offset
   feature synth_rec_f;
   example *original_ec;
   uint32_t cur_depth;
@@ -80,21 +88,6 @@ inline uint64_t do_ft_offset(const stagewise_poly &poly, uint64_t idx)
   return idx + poly.synth_ec.ft_offset;
 }
 
-inline uint64_t un_ft_offset(const stagewise_poly &poly, uint64_t idx)
-{
-  assert(!poly.original_ec || poly.synth_ec.ft_offset == poly.original_ec->ft_offset);
-  if (poly.synth_ec.ft_offset == 0)
-    return idx;
-  else
-  {
-    while (idx < poly.synth_ec.ft_offset)
-    {
-      idx += poly.all->length() << poly.all->weights.stride_shift();
-    }
-    return idx - poly.synth_ec.ft_offset;
-  }
-}
-
 inline uint64_t wid_mask(const stagewise_poly &poly, uint64_t wid)
 { return wid & poly.all->weights.mask(); }
 
@@ -157,6 +150,28 @@ inline void cycle_toggle(stagewise_poly &poly, uint64_t wid)
   poly.depthsbits[wid_mask_un_shifted(poly, wid) * 2 + 1] ^= cycle_bit;
 }
 
+inline bool candidate_get(const stagewise_poly &poly, uint64_t wid)
+{
+  //note: like cycle, flat: wid already includes any ft_offset.
+  assert(wid % stride_shift(poly, 1) == 0);
+  return (poly.depthsbits[wid_mask_un_shifted(poly, wid) * 2 + 1] & candidate_bit) > 0;
+}
+
+inline void candidate_toggle(stagewise_poly &poly, uint64_t wid)
+{
+  assert(wid % stride_shift(poly, 1) == 0);
+  poly.depthsbits[wid_mask_un_shifted(poly, wid) * 2 + 1] ^= candidate_bit;
+}
+
+inline void candidate_add(stagewise_poly &poly, uint64_t wid)
+{
+  if (!candidate_get(poly, wid))
+  {
+    candidate_toggle(poly, wid);
+    poly.candidates.push_back(wid);
+  }
+}
+
 inline uint8_t min_depths_get(const stagewise_poly &poly, uint64_t wid)
 {
   assert(wid % stride_shift(poly, 1) == 0);
@@ -188,7 +203,7 @@ void sanity_check_state(stagewise_poly &poly)
       assert(!(min_depths_get(poly, wid) == default_depth && fabsf(poly.all->weights.dense_weights[wid]) > 0));
     //assert( min_depths_get(poly, wid) != default_depth && fabsf(poly.all->weights[wid]) < tolerance );
 
-    assert( ! (poly.depthsbits[wid_mask_un_shifted(poly, wid) * 2 + 1] & ~(parent_bit + cycle_bit + indicator_bit)) );
+    assert( ! (poly.depthsbits[wid_mask_un_shifted(poly, wid) * 2 + 1] & ~(parent_bit + cycle_bit + candidate_bit + indicator_bit)) );
   }
 }
 #endif //NDEBUG
@@ -259,18 +274,56 @@ int sort_data_compar_heap(sort_data &a_v, sort_data &b_v)
   return (a_v.weightsal > b_v.weightsal);
 }
 
+inline float weightsal_get(const stagewise_poly &poly, uint64_t wid)
+{
+  return fabsf(poly.all->weights[wid]) * poly.all->weights[poly.all->normalized_idx + (wid)];
+}
+
+inline bool candidate_live(const stagewise_poly &poly, uint64_t wid)
+{
+  return !parent_get(poly, wid) && wid != constant_feat_masked(poly) && weightsal_get(poly, wid) > tolerance;
+}
+
+//One pass over the whole weight vector, listing every wid that could be picked.
+//Needed once per run (weights may be loaded or initialized nonzero), after
+//every allreduce, which brings in weights other nodes touched, and whenever
+//the list has grown dense.
+void candidates_seed(stagewise_poly &poly)
+{
+  poly.candidates.clear();
+  for (uint64_t i = 0; i != poly.all->length(); ++i)
+  {
+    uint64_t wid = stride_shift(poly, i);
+    if (candidate_get(poly, wid))
+      candidate_toggle(poly, wid);
+    if (candidate_live(poly, wid))
+      candidate_add(poly, wid);
+  }
+  poly.candidates_seeded = true;
+}
+
+//Drop the candidates that can no longer be picked: new parents and weights
+//that went to zero.  Synthesizing them again in training puts them back.
+void candidates_compact(stagewise_poly &poly)
+{
+  uint64_t *out = poly.candidates.begin();
+  for (uint64_t *c = poly.candidates.begin(); c != poly.candidates.end(); ++c)
+    if (candidate_live(poly, *c))
+      *out++ = *c;
+    else
+      candidate_toggle(poly, *c);
+  poly.candidates.end() = out;
+}
+
 /*
  * Performance note.
  *
- * On my laptop (Intel(R) Core(TM) i7-3520M CPU @ 2.90GHz), with compiler
- * optimizations enabled, this routine takes ~0.001 seconds with -b 18 and
- * ~0.06 seconds with -b 24.  Since it is intended to run ~8 times in 1-pass
- * mode and otherwise once per pass, it is considered adequate.
- *
- * Another choice (implemented in another version) is to never process the
- * whole weight vector (e.g., by updating a hash set of nonzero weights after
- * creating the synthetic example, and only processing that here).  This
- * choice was implemented in a similar algorithm and performed well.
+ * Only weights that changed since the last call can have become worth
+ * picking, and a weight only changes when its monomial is synthesized in
+ * training, so the heap is fed from the candidate list rather than the whole
+ * weight vector: the cost is in the number of monomials seen, not 2^b.  The
+ * list is visited in wid order, so ties break exactly as a full scan would.
+ * A dense list falls back to the full scan, which also rebuilds it.
  */
 void sort_data_update_support(stagewise_poly &poly)
 {
@@ -286,14 +339,22 @@ void sort_data_update_support(stagewise_poly &poly)
   num_new_features = (num_new_features > poly.all->length()) ? (uint64_t)poly.all->length() : num_new_features;
   sort_data_ensure_sz(poly, num_new_features);
 
+  //once the list covers a good part of the weight vector, sorting it costs
+  //more than walking the weight vector itself
+  if (!poly.candidates_seeded || poly.all->all_reduce != nullptr
+      || poly.candidates.size() * 16 > poly.all->length())
+    candidates_seed(poly);
+  else
+    sort(poly.candidates.begin(), poly.candidates.end());
+
   sort_data *heap_end = poly.sd;
   make_heap(poly.sd, heap_end, sort_data_compar_heap); //redundant
-  for (uint64_t i = 0; i != poly.all->length(); ++i)
+  for (uint64_t *c = poly.candidates.begin(); c != poly.candidates.end(); ++c)
   {
-    uint64_t wid = stride_shift(poly, i);
+    uint64_t wid = *c;
     if (!parent_get(poly, wid) && wid != constant_feat_masked(poly))
     {
-      float weightsal = (fabsf(poly.all->weights[wid]) * poly.all->weights[poly.all->normalized_idx + (wid)]);
+      float weightsal = weightsal_get(poly, wid);
       /*
        * here's some depth penalization code.  It was found to not improve
        * statistical performance, and meanwhile it is verified as giving
@@ -349,6 +410,8 @@ void sort_data_update_support(stagewise_poly &poly)
 #endif //DEBUG
   }
 
+  candidates_compact(poly);
+
 #ifdef DEBUG
   cout << "depths:";
   for (uint64_t depth = 0; depth <= poly.max_depth && depth < sizeof(poly.depths) / sizeof(*poly.depths); ++depth)
@@ -416,10 +479,20 @@ void synthetic_decycle(stagewise_poly &poly)
   }
 }
 
+void synthetic_create_rec(stagewise_poly &poly, float v, uint64_t findex);
+
+//children of the current monomial: one per atomic feature of the input
+inline void synthetic_create_children(stagewise_poly &poly)
+{
+  features &fs = poly.atomics;
+  for (size_t i = 0; i < fs.size(); ++i)
+    synthetic_create_rec(poly, fs.values[i], fs.indicies[i]);
+}
+
 void synthetic_create_rec(stagewise_poly &poly, float v, uint64_t findex)
 {
-  //Note: need to un_ft_shift since gd::foreach_feature bakes in the offset.
-  uint64_t wid_atomic = wid_mask(poly, un_ft_offset(poly, findex));
+  //Note: poly.atomics leaves the ft_offset out, unlike gd::foreach_feature.
+  uint64_t wid_atomic = wid_mask(poly, findex);
   uint64_t wid_cur = child_wid(poly, wid_atomic, poly.synth_rec_f.weight_index);
   assert(wid_atomic % stride_shift(poly, 1) == 0);
 
@@ -458,6 +531,8 @@ void synthetic_create_rec(stagewise_poly &poly, float v, uint64_t findex)
     feature temp = {v * poly.synth_rec_f.x, wid_cur};
     poly.synth_ec.feature_space[tree_atomics].push_back(temp.x, temp.weight_index);
     poly.synth_ec.num_features++;
+    if (poly.training)
+      candidate_add(poly, wid_mask(poly, do_ft_offset(poly, temp.weight_index)));
 
     if (parent_get(poly, temp.weight_index))
     {
@@ -467,7 +542,7 @@ void synthetic_create_rec(stagewise_poly &poly, float v, uint64_t findex)
 #ifdef DEBUG
       poly.max_depth = (poly.max_depth > poly.cur_depth) ? poly.max_depth : poly.cur_depth;
 #endif //DEBUG
-      GD::foreach_feature<stagewise_poly, uint64_t, synthetic_create_rec>(*(poly.all), *(poly.original_ec), poly);
+      synthetic_create_children(poly);
       --poly.cur_depth;
       poly.synth_rec_f = parent_f;
     }
@@ -487,8 +562,12 @@ void synthetic_create(stagewise_poly &poly, example &ec, bool training)
    * Another choice is to mark the constant feature as the single initial
    * parent, and recurse just on that feature (which arguably correctly interprets poly.cur_depth).
    * Problem with this is if there is a collision with the root...
+   *
+   * The input's features (quadratic and cubic ones included) are resolved
+   * once here, then reused for the children of every parent reached.
    */
-  GD::foreach_feature<stagewise_poly, uint64_t, synthetic_create_rec>(*poly.all, *poly.original_ec, poly);
+  GD::cache_features(*poly.all, *poly.original_ec, poly.atomics);
+  synthetic_create_children(poly);
   synthetic_decycle(poly);
   poly.synth_ec.total_sum_feat_sq = poly.synth_ec.feature_space[tree_atomics].sum_feat_sq;
 
@@ -577,7 +656,7 @@ void reduce_min_max(uint8_t &v1,const uint8_t &v2)
   }
 
   if(parent_or_depth)
-    v1 = (v1 >= v2) ? v1 : v2;
+    v1 = v1 | v2; //the flag bits of either side
   else
   {
     if(v1 == default_depth)
@@ -653,6 +732,8 @@ void finish(stagewise_poly &poly)
 
   poly.synth_ec.feature_space[tree_atomics].delete_v();
   poly.synth_ec.indices.delete_v();
+  poly.atomics.delete_v();
+  poly.candidates.delete_v();
   sort_data_destroy(poly);
   depthsbits_destroy(poly);
 }
@@ -663,7 +744,16 @@ void save_load(stagewise_poly &poly, io_buf &model_file, bool read, bool text)
   if (model_file.files.size() > 0)
   {
     stringstream msg;
+    //candidate bits are run state, so they are kept out of the model
+    if (!read)
+      for (uint64_t *c = poly.candidates.begin(); c != poly.candidates.end(); ++c)
+        candidate_toggle(poly, *c);
     bin_text_read_write_fixed(model_file, (char *) poly.depthsbits, (uint32_t)depthsbits_sizeof(poly), "", read, msg, text);
+    if (read)
+      poly.candidates_seeded = false;
+    else
+      for (uint64_t *c = poly.candidates.begin(); c != poly.candidates.end(); ++c)
+        candidate_toggle(poly, *c);
   }
   //unfortunately, following can't go here since save_load called before gd::save_load and thus
   //weight vector state uninitialiazed.
@@ -703,6 +793,7 @@ base_learner *stagewise_poly_setup(arguments& arg)
   poly->last_example_counter = -1;
   poly->numpasses = 1;
   poly->update_support = false;
+  poly->candidates_seeded = false;
   poly->original_ec = nullptr;
   poly->next_batch_sz = poly->batch_sz;
 
@@ -0,0 +1,92 @@
+/*
+Copyright (c) by respective owners including Yahoo!, Microsoft, and
+individual contributors. All rights reserved.  Released under a BSD (revised)
+license as described in the file LICENSE.
+ */
+#include "thread_pool.h"
+
+using namespace std;
+
+thread_pool::thread_pool(size_t threads)
+  : _job(nullptr), _count(0), _next(0), _busy(0), _generation(0), _stopping(false)
+{
+  for (size_t t = 1; t < threads; t++)
+    _workers.push_back(thread([this]() { work(); }));
+}
+
+thread_pool::~thread_pool()
+{
+  {
+    lock_guard<mutex> lock(_mutex);
+    _stopping = true;
+  }
+  _start.notify_all();
+  for (thread& t : _workers)
+    t.join();
+}
+
+void thread_pool::run()
+{
+  for (size_t i = _next++; i < _count; i = _next++)
+  {
+    try
+    {
+      (*_job)(i);
+    }
+    catch (...)
+    {
+      lock_guard<mutex> lock(_mutex);
+      if (!_error)
+        _error = current_exception();
+    }
+  }
+}
+
+void thread_pool::work()
+{
+  uint64_t seen = 0;
+  unique_lock<mutex> lock(_mutex);
+  for (;;)
+  {
+    _start.wait(lock, [&]() { return _stopping || _generation != seen; });
+    if (_stopping)
+      return;
+    seen = _generation;
+    lock.unlock();
+    run();
+    lock.lock();
+    if (--_busy == 0)
+      _done.notify_all();
+  }
+}
+
+void thread_pool::parallel_for(size_t n, const function<void(size_t)>& f)
+{
+  if (_workers.size() == 0 || n <= 1)
+  {
+    for (size_t i = 0; i < n; i++)
+      f(i);
+    return;
+  }
+
+  {
+    lock_guard<mutex> lock(_mutex);
+    _job = &f;
+    _count = n;
+    _next = 0;
+    _busy = _workers.size();
+    _generation++;
+  }
+  _start.notify_all();
+  run();
+
+  exception_ptr error;
+  {
+    unique_lock<mutex> lock(_mutex);
+    _done.wait(lock, [&]() { return _busy == 0; });
+    _job = nullptr;
+    swap(error, _error);
+  }
+  if (error)
+    rethrow_exception(error);
+}
@@ -0,0 +1,46 @@
+/*
+Copyright (c) by respective owners including Yahoo!, Microsoft, and
+individual contributors. All rights reserved.  Released under a BSD
+license as described in the file LICENSE.
+ */
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads for loops over independent items, kept
+// around so that per-example work does not pay for thread creation.
+class thread_pool
+{
+public:
+  // threads counts the calling thread, which takes part in every loop.
+  explicit thread_pool(size_t threads);
+  ~thread_pool();
+
+  size_t size() { return _workers.size() + 1; }
+
+  // Run f(i) for every i in [0, n) and return once all are done.  The first
+  // exception thrown by f is rethrown here.
+  void parallel_for(size_t n, const std::function<void(size_t)>& f);
+
+private:
+  void work();
+  void run();
+
+  std::vector<std::thread> _workers;
+  std::mutex _mutex;
+  std::condition_variable _start;
+  std::condition_variable _done;
+
+  const std::function<void(size_t)>* _job;
+  size_t _count;
+  std::atomic<size_t> _next;
+  size_t _busy;
+  uint64_t _generation;
+  bool _stopping;
+  std::exception_ptr _error;
+};
@@ -200,6 +200,24 @@ public:
     }
   }
 
+  // get() that leaves last_position alone, so several threads can look up at once
+  V& find(const K& key, uint64_t hash)
+  { size_t sz  = base_size();
+    size_t first_position = hash % sz;
+    size_t position = first_position;
+    while (true)
+    { if (!dat[position].occupied)
+        return default_value;
+      if ((dat[position].hash == hash) && is_equivalent(key, dat[position].key))
+        return dat[position].val;
+      position++;
+      if (position >= sz)
+        position = 0;
+      if (position == first_position)
+        THROW("error: v_hashmap did not grow enough!");
+    }
+  }
+
   bool contains(const K& key, size_t hash)
   { size_t sz  = base_size();
     size_t first_position = hash % sz;
@@ -162,4 +162,12 @@ inline uint32_t num_weights(vw& all)
 
 inline uint32_t get_stride(vw& all)
 { return all.weights.stride(); }
+
+// How many of the best actions csoaa_ldf ranking returns, 0 for all; can be
+// changed between examples, except under cb_explore_adf.
+inline void set_rank_top(vw& all, size_t k)
+{ if (k > 0 && all.all_action_scores)
+    THROW("rank_top can not be set with --cb_explore_adf, exploration needs the score of every action");
+  all.rank_top = k;
+}
 }
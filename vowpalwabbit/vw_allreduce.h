@@ -12,7 +12,7 @@ license as described in the file LICENSE.
 template <class T, void(*f)(T&, const T&)> void all_reduce(vw& all, T* buffer, const size_t n)
 { switch (all.all_reduce_type)
   { case AllReduceType::Socket:
-      ((AllReduceSockets*)all.all_reduce)->all_reduce<T, f>(buffer, n);
+      ((AllReduceSockets*)all.all_reduce)->all_reduce<T, f>(buffer, n, all.current_pass);
       break;
 
     case AllReduceType::Thread:
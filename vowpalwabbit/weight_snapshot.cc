@@ -0,0 +1,270 @@
+/*
+Copyright (c) by respective owners including Yahoo!, Microsoft, and
+individual contributors. All rights reserved.  Released under a BSD (revised)
+license as described in the file LICENSE.
+ */
+#include <cstring>
+#include <mutex>
+#include <thread>
+#ifndef _WIN32
+#include <signal.h>
+#include <unistd.h>
+#endif
+#include "weight_snapshot.h"
+#include "vw_exception.h"
+
+using namespace std;
+
+// Blocks grow with the table so that unprotecting scattered blocks cannot
+// split the mapping into more pieces than the kernel allows a process.
+const size_t max_blocks = 1 << 14;
+
+enum block_state : uint8_t
+{
+  PROTECTED, // as of start(), still write protected
+  COPYING,   // being saved aside by a writer
+  SAVED,     // saved aside, the table is writable again
+  READING,   // being read by the saver
+  DONE       // read by the saver, or given up on
+};
+
+static atomic<weight_snapshot*> current(nullptr);
+
+#ifndef _WIN32
+static struct sigaction previous_segv, previous_bus;
+
+static void on_fault(int sig, siginfo_t* info, void* context)
+{
+  if (weight_snapshot::claim(info->si_addr))
+    return; // the write is retried and goes through
+
+  // Not a snapshot: hand the fault to whoever had the signal before, or
+  // restore the default action and let the fault happen again.
+  struct sigaction& previous = sig == SIGBUS ? previous_bus : previous_segv;
+  if (previous.sa_flags & SA_SIGINFO)
+    previous.sa_sigaction(sig, info, context);
+  else if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN)
+    previous.sa_handler(sig);
+  else
+    signal(sig, SIG_DFL);
+}
+
+static void install_fault_handler()
+{
+  static once_flag installed;
+  call_once(installed, []()
+  {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = on_fault;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, &previous_segv);
+    sigaction(SIGBUS, &sa, &previous_bus); // what some systems raise for protection faults
+  });
+}
+#endif
+
+weight_snapshot::weight_snapshot()
+  : _region(nullptr), _bytes(0), _block(1), _reserve(nullptr), _states(nullptr), _active(false),
+    _offset(0), _mask(0), _stride_shift(0), _row_bytes(0), _window_start(0)
+{ }
+
+weight_snapshot::~weight_snapshot()
+{
+  finish();
+  weight_snapshot* self = this;
+  current.compare_exchange_strong(self, nullptr);
+  delete[] _states;
+}
+
+bool weight_snapshot::start(dense_parameters& weights)
+{
+#ifdef _WIN32
+  return false;
+#else
+  finish();
+  if (!weights.not_null())
+    return false;
+
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  char* begin = (char*)weights.first();
+  char* end = begin + (weights.mask() + 1) * sizeof(weight);
+  _region = begin - (uintptr_t)begin % page;
+  _bytes = (end - _region + page - 1) / page * page;
+  _block = page;
+  while (_bytes / _block > max_blocks)
+    _block *= 2;
+
+  void* reserve = mmap(nullptr, _bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (reserve == MAP_FAILED)
+    return false;
+  _reserve = (char*)reserve;
+
+  // Blocks are only claimed by the fault handler of a snapshot that is still
+  // current, so the previous snapshot's states can go now.
+  delete[] _states;
+  _states = new atomic<uint8_t>[blocks()];
+  for (size_t b = 0; b < blocks(); b++)
+    _states[b].store(PROTECTED);
+
+  _offset = begin - _region;
+  _mask = weights.mask();
+  _stride_shift = weights.stride_shift();
+  _row_bytes = sizeof(weight) << _stride_shift;
+  _window.clear();
+  _window_start = 0;
+
+  // Blocks reaching outside the table may share pages with other memory, so
+  // they are saved now rather than protected.
+  size_t first = 0, last = blocks();
+  if (_offset > 0)
+  {
+    memcpy(_reserve, _region, block_bytes(0));
+    _states[first++].store(SAVED);
+  }
+  if (_region + _bytes > end && last > first)
+  {
+    last--;
+    memcpy(_reserve + last * _block, _region + last * _block, block_bytes(last));
+    _states[last].store(SAVED);
+  }
+
+  install_fault_handler();
+  current.store(this);
+  size_t protected_bytes = last > first ? min(last * _block, _bytes) - first * _block : 0;
+  if (protected_bytes > 0 && mprotect(_region + first * _block, protected_bytes, PROT_READ) != 0)
+  {
+    // part of the range may have been protected before the call failed
+    mprotect(_region + first * _block, protected_bytes, PROT_READ | PROT_WRITE);
+    for (size_t b = 0; b < blocks(); b++)
+      _states[b].store(DONE);
+    munmap(_reserve, _bytes);
+    _reserve = nullptr;
+    return false;
+  }
+  _active = true;
+  return true;
+#endif
+}
+
+void weight_snapshot::finish()
+{
+#ifndef _WIN32
+  if (!_active)
+    return;
+  for (size_t b = 0; b < blocks(); b++)
+  {
+    uint8_t state = PROTECTED;
+    if (_states[b].compare_exchange_strong(state, READING))
+    {
+      unprotect(b);
+      _states[b].store(DONE);
+    }
+    else
+      while (_states[b].load() == COPYING)
+        this_thread::yield();
+  }
+  munmap(_reserve, _bytes);
+  _reserve = nullptr;
+  _window.clear();
+  _window.shrink_to_fit();
+  _active = false;
+#endif
+}
+
+bool weight_snapshot::claim(void* address)
+{
+  weight_snapshot* s = current.load();
+  char* at = (char*)address;
+  if (s == nullptr || at < s->_region || at >= s->_region + s->_bytes)
+    return false;
+  s->save_block((at - s->_region) / s->_block);
+  return true;
+}
+
+// Runs in the fault handler, so it only copies and makes system calls.
+void weight_snapshot::save_block(size_t b)
+{
+#ifndef _WIN32
+  uint8_t state = PROTECTED;
+  if (_states[b].compare_exchange_strong(state, COPYING))
+  {
+    memcpy(_reserve + b * _block, _region + b * _block, block_bytes(b));
+    unprotect(b);
+    _states[b].store(SAVED);
+    return;
+  }
+  // someone else is on it; once they are done the block is writable
+  while (state == COPYING || state == READING)
+  {
+    sched_yield();
+    state = _states[b].load();
+  }
+#endif
+}
+
+void weight_snapshot::unprotect(size_t b)
+{
+#ifndef _WIN32
+  if (mprotect(_region + b * _block, block_bytes(b), PROT_READ | PROT_WRITE) != 0)
+  {
+    // nothing else can make the faulting write succeed
+    const char msg[] = "weight snapshot: cannot unprotect the weight table\n";
+    if (write(2, msg, sizeof(msg) - 1)) {}
+    abort();
+  }
+#endif
+}
+
+void weight_snapshot::read_block(size_t b, char* out)
+{
+  uint8_t state = PROTECTED;
+  if (_states[b].compare_exchange_strong(state, READING))
+  {
+    // still protected, so the table holds the block as of start()
+    memcpy(out, _region + b * _block, block_bytes(b));
+    unprotect(b);
+    _states[b].store(DONE);
+    return;
+  }
+  while (state == COPYING)
+  {
+    this_thread::yield();
+    state = _states[b].load();
+  }
+  if (state != SAVED)
+    THROW("weight snapshot block " << b << " was already read");
+  memcpy(out, _reserve + b * _block, block_bytes(b));
+#ifndef _WIN32
+  madvise(_reserve + b * _block, block_bytes(b), MADV_DONTNEED);
+#endif
+  _states[b].store(DONE);
+}
+
+// Move the window so that it starts with the block holding byte at, keeping
+// the block already read if the window only moves on by one.
+void weight_snapshot::slide(uint64_t at)
+{
+  if (!_active)
+    THROW("weight snapshot read without an active snapshot");
+  size_t b = (size_t)(at / _block);
+  size_t have = (size_t)(_window_start / _block);
+  size_t kept = 0;
+  if (_window.size() > 0)
+  {
+    if (b <= have)
+      THROW("weight snapshot read out of order");
+    if (b == have + 1 && _window.size() > _block)
+    {
+      kept = _window.size() - _block;
+      memmove(_window.data(), _window.data() + _block, kept);
+    }
+  }
+
+  size_t last = min(b + 2, blocks());
+  _window.resize((last - 1 - b) * _block + block_bytes(last - 1));
+  _window_start = (uint64_t)b * _block;
+  for (size_t k = kept > 0 ? b + 1 : b; k < last; k++)
+    read_block(k, _window.data() + (k - b) * _block);
+}
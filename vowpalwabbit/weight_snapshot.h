@@ -0,0 +1,99 @@
+/*
+Copyright (c) by respective owners including Yahoo!, Microsoft, and
+individual contributors. All rights reserved.  Released under a BSD
+license as described in the file LICENSE.
+ */
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <vector>
+#include "array_parameters_dense.h"
+
+// A copy-on-write snapshot of a dense weight table, so a background save can
+// stream the table while learning keeps updating it.  start() write protects
+// the table; the first write to a protected block copies the block aside
+// before it goes ahead.  The saver reads the rows once, in order, and sees
+// every block as it was at start().  Only the blocks written before the
+// saver got to them take extra memory, and each is freed once it is read.
+class weight_snapshot
+{
+public:
+  class iterator
+  {
+  private:
+    weight_snapshot* _snapshot;
+    uint64_t _index;
+    uint32_t _stride;
+
+  public:
+    iterator(weight_snapshot* snapshot, uint64_t index, uint32_t stride)
+      : _snapshot(snapshot), _index(index), _stride(stride)
+    { }
+
+    const weight& operator*() { return *_snapshot->row(_index); }
+
+    size_t index() { return _index; }
+
+    iterator& operator++()
+    {
+      _index += _stride;
+      return *this;
+    }
+
+    bool operator==(const iterator& rhs) const { return _index == rhs._index; }
+    bool operator!=(const iterator& rhs) const { return _index != rhs._index; }
+  };
+
+  weight_snapshot();
+  ~weight_snapshot();
+
+  // Returns false, leaving the table alone, when it cannot be protected.
+  bool start(dense_parameters& weights);
+
+  // Unprotect whatever the saver did not read.  Safe to call more than once.
+  void finish();
+
+  // The row starting at weight index i as of start(); i must not decrease
+  // from one call to the next.
+  const weight* row(uint64_t i)
+  {
+    uint64_t at = _offset + i * sizeof(weight);
+    if (at < _window_start || at + _row_bytes > _window_start + _window.size())
+      slide(at);
+    return (const weight*)(_window.data() + (at - _window_start));
+  }
+
+  iterator begin() { return iterator(this, 0, 1 << _stride_shift); }
+  iterator end() { return iterator(this, _mask + 1, 1 << _stride_shift); }
+
+  uint64_t mask() const { return _mask; }
+  uint32_t stride_shift() const { return _stride_shift; }
+
+  // Called on a write fault: copies the block holding address aside and
+  // makes it writable.  Returns false if no snapshot covers address.
+  static bool claim(void* address);
+
+private:
+  char* _region;    // the protected range: the table widened to whole pages
+  size_t _bytes;
+  size_t _block;    // bytes copied and unprotected at once
+  char* _reserve;   // where written blocks are saved, laid out like _region
+  std::atomic<uint8_t>* _states; // per block
+  bool _active;
+
+  uint64_t _offset; // of the table's first weight in _region
+  uint64_t _mask;
+  uint32_t _stride_shift;
+  size_t _row_bytes;
+
+  std::vector<char> _window; // two consecutive blocks as of start()
+  uint64_t _window_start;
+
+  size_t blocks() const { return (_bytes + _block - 1) / _block; }
+  size_t block_bytes(size_t b) const { return b + 1 < blocks() ? _block : _bytes - b * _block; }
+
+  void slide(uint64_t at);
+  void read_block(size_t b, char* out);
+  void save_block(size_t b);
+  void unprotect(size_t b);
+};